@@ -0,0 +1,478 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include "clipboard.h"
+
+enum clipboard_transfer_kind {
+    CLIPBOARD_TRANSFER_PASTE,
+    CLIPBOARD_TRANSFER_COPY,
+};
+
+struct clipboard_transfer {
+    bool active;
+    enum clipboard_transfer_kind kind;
+    int in_fd, out_fd;
+    /* Copies read the source at an explicit offset, it is shared with others */
+    off_t offset;
+    off_t remaining;
+    bool use_sendfile;
+    uint64_t bytes;
+    uint64_t start_us;
+};
+
+/* An offer is either a wl_data_offer or a zwp_primary_selection_offer_v1 */
+struct clipboard_offer {
+    void *offer;
+    enum clipboard_selection selection;
+    char *mime;
+    int score;
+};
+
+struct clipboard_source {
+    struct clipboard *clipboard;
+    void *source;
+    int fd;
+};
+
+struct clipboard {
+    struct wl_data_device_manager *manager;
+    struct wl_data_device *device;
+    struct zwp_primary_selection_device_manager_v1 *primary_manager;
+    struct zwp_primary_selection_device_v1 *primary_device;
+    /* Current selections, and the drag-and-drop offer which is never accepted */
+    struct clipboard_offer *offers[2];
+    struct clipboard_offer *dnd_offer;
+    struct clipboard_source sources[2];
+    struct clipboard_transfer transfers[CLIPBOARD_MAX_TRANSFERS];
+};
+
+static const char *clipboard_text_types[] = {
+        "text/plain;charset=utf-8", "UTF8_STRING", "text/plain",
+};
+
+static uint64_t monotonic_us() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Transfers */
+static struct clipboard_transfer *transfer_start(struct clipboard *clipboard,
+                                                 enum clipboard_transfer_kind kind,
+                                                 int in_fd, int out_fd) {
+    for (int i = 0; i < CLIPBOARD_MAX_TRANSFERS; ++i) {
+        struct clipboard_transfer *transfer = &clipboard->transfers[i];
+        if (transfer->active)
+            continue;
+        memset(transfer, 0, sizeof(*transfer));
+        transfer->active = true;
+        transfer->kind = kind;
+        transfer->in_fd = in_fd;
+        transfer->out_fd = out_fd;
+        transfer->start_us = monotonic_us();
+        return transfer;
+    }
+    fprintf(stderr, "clipboard: too many transfers in flight\n");
+    close(in_fd);
+    close(out_fd);
+    return NULL;
+}
+
+static void transfer_finish(struct clipboard_transfer *transfer, int error) {
+    uint64_t elapsed_us = monotonic_us() - transfer->start_us;
+    const char *name = transfer->kind == CLIPBOARD_TRANSFER_PASTE ? "paste" : "copy";
+    if (error) {
+        fprintf(stderr, "clipboard: %s failed after %llu bytes: %s\n", name,
+                (unsigned long long) transfer->bytes, strerror(error));
+    } else {
+        fprintf(stderr, "clipboard: %s of %llu bytes in %.1f ms (%.1f MB/s)\n", name,
+                (unsigned long long) transfer->bytes, elapsed_us / 1000.0,
+                elapsed_us ? transfer->bytes / (double) elapsed_us : 0.0);
+    }
+    close(transfer->in_fd);
+    close(transfer->out_fd);
+    transfer->active = false;
+}
+
+/* Moves at most one chunk, whatever the other end is ready for */
+static void transfer_step(struct clipboard_transfer *transfer) {
+    ssize_t moved;
+    if (transfer->kind == CLIPBOARD_TRANSFER_PASTE) {
+        moved = splice(transfer->in_fd, NULL, transfer->out_fd, NULL, CLIPBOARD_CHUNK,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    } else {
+        size_t count = transfer->remaining < CLIPBOARD_CHUNK ? transfer->remaining : CLIPBOARD_CHUNK;
+        if (!transfer->use_sendfile) {
+            moved = splice(transfer->in_fd, &transfer->offset, transfer->out_fd, NULL, count,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            /* The receiver handed over something other than a pipe */
+            if (moved < 0 && errno == EINVAL)
+                transfer->use_sendfile = true;
+        }
+        if (transfer->use_sendfile)
+            moved = sendfile(transfer->out_fd, transfer->in_fd, &transfer->offset, count);
+    }
+
+    if (moved < 0) {
+        if (errno != EAGAIN && errno != EINTR)
+            transfer_finish(transfer, errno);
+        return;
+    }
+    transfer->bytes += moved;
+    if (transfer->kind == CLIPBOARD_TRANSFER_COPY)
+        transfer->remaining -= moved;
+    if (moved == 0 || (transfer->kind == CLIPBOARD_TRANSFER_COPY && transfer->remaining == 0))
+        transfer_finish(transfer, 0);
+}
+
+int clipboard_poll_fds(struct clipboard *clipboard, struct pollfd *fds, int max) {
+    int count = 0;
+    for (int i = 0; i < CLIPBOARD_MAX_TRANSFERS && count < max; ++i) {
+        struct clipboard_transfer *transfer = &clipboard->transfers[i];
+        if (!transfer->active)
+            continue;
+        if (transfer->kind == CLIPBOARD_TRANSFER_PASTE)
+            fds[count++] = {transfer->in_fd, POLLIN, 0};
+        else
+            fds[count++] = {transfer->out_fd, POLLOUT, 0};
+    }
+    return count;
+}
+
+void clipboard_dispatch(struct clipboard *clipboard, const struct pollfd *fds, int count) {
+    for (int i = 0; i < count; ++i) {
+        if (fds[i].revents == 0)
+            continue;
+        for (int j = 0; j < CLIPBOARD_MAX_TRANSFERS; ++j) {
+            struct clipboard_transfer *transfer = &clipboard->transfers[j];
+            int fd = transfer->kind == CLIPBOARD_TRANSFER_PASTE ? transfer->in_fd : transfer->out_fd;
+            if (transfer->active && fd == fds[i].fd) {
+                transfer_step(transfer);
+                break;
+            }
+        }
+    }
+}
+
+/* Offers */
+static void offer_destroy(struct clipboard_offer *offer) {
+    if (!offer)
+        return;
+    if (offer->selection == CLIPBOARD_SELECTION_PRIMARY)
+        zwp_primary_selection_offer_v1_destroy(
+                static_cast<struct zwp_primary_selection_offer_v1 *>(offer->offer));
+    else
+        wl_data_offer_destroy(static_cast<struct wl_data_offer *>(offer->offer));
+    free(offer->mime);
+    free(offer);
+}
+
+/* Prefers UTF-8 text, anything else can still be pasted into a file */
+static void offer_add_type(struct clipboard_offer *offer, const char *mime_type) {
+    int score = 0;
+    for (int i = 0; i < 3; ++i) {
+        if (strcmp(mime_type, clipboard_text_types[i]) == 0)
+            score = 3 - i;
+    }
+    if (offer->mime && score <= offer->score)
+        return;
+    free(offer->mime);
+    offer->mime = strdup(mime_type);
+    offer->score = score;
+}
+
+static struct clipboard_offer *offer_create(void *offer, enum clipboard_selection selection) {
+    struct clipboard_offer *clipboard_offer =
+            static_cast<struct clipboard_offer *>(calloc(1, sizeof(*clipboard_offer)));
+    clipboard_offer->offer = offer;
+    clipboard_offer->selection = selection;
+    return clipboard_offer;
+}
+
+static void clipboard_set_offer(struct clipboard *clipboard, enum clipboard_selection selection,
+                                struct clipboard_offer *offer) {
+    offer_destroy(clipboard->offers[selection]);
+    clipboard->offers[selection] = offer;
+}
+
+static void wl_data_offer_offer(void *data, struct wl_data_offer *wl_data_offer,
+                                const char *mime_type) {
+    offer_add_type(static_cast<struct clipboard_offer *>(data), mime_type);
+}
+
+static void wl_data_offer_source_actions(void *data, struct wl_data_offer *wl_data_offer,
+                                         uint32_t source_actions) {
+    /* This space deliberately left blank */
+}
+
+static void wl_data_offer_action(void *data, struct wl_data_offer *wl_data_offer,
+                                 uint32_t dnd_action) {
+    /* This space deliberately left blank */
+}
+
+static const struct wl_data_offer_listener wl_data_offer_listener = {
+        .offer = wl_data_offer_offer,
+        .source_actions = wl_data_offer_source_actions,
+        .action = wl_data_offer_action,
+};
+
+static void wl_data_device_data_offer(void *data, struct wl_data_device *wl_data_device,
+                                      struct wl_data_offer *id) {
+    struct clipboard_offer *offer = offer_create(id, CLIPBOARD_SELECTION_CLIPBOARD);
+    wl_data_offer_add_listener(id, &wl_data_offer_listener, offer);
+}
+
+static void wl_data_device_enter(void *data, struct wl_data_device *wl_data_device,
+                                 uint32_t serial, struct wl_surface *surface,
+                                 wl_fixed_t x, wl_fixed_t y, struct wl_data_offer *id) {
+    struct clipboard *clipboard = static_cast<struct clipboard *>(data);
+    offer_destroy(clipboard->dnd_offer);
+    clipboard->dnd_offer = id ? static_cast<struct clipboard_offer *>(wl_data_offer_get_user_data(id)) : NULL;
+}
+
+static void wl_data_device_leave(void *data, struct wl_data_device *wl_data_device) {
+    struct clipboard *clipboard = static_cast<struct clipboard *>(data);
+    offer_destroy(clipboard->dnd_offer);
+    clipboard->dnd_offer = NULL;
+}
+
+static void wl_data_device_motion(void *data, struct wl_data_device *wl_data_device,
+                                  uint32_t time, wl_fixed_t x, wl_fixed_t y) {
+    /* This space deliberately left blank */
+}
+
+static void wl_data_device_drop(void *data, struct wl_data_device *wl_data_device) {
+    /* Drops are never accepted, so there is nothing to receive */
+}
+
+static void wl_data_device_selection(void *data, struct wl_data_device *wl_data_device,
+                                     struct wl_data_offer *id) {
+    struct clipboard *clipboard = static_cast<struct clipboard *>(data);
+    clipboard_set_offer(clipboard, CLIPBOARD_SELECTION_CLIPBOARD, id ?
+            static_cast<struct clipboard_offer *>(wl_data_offer_get_user_data(id)) : NULL);
+}
+
+static const struct wl_data_device_listener wl_data_device_listener = {
+        .data_offer = wl_data_device_data_offer,
+        .enter = wl_data_device_enter,
+        .leave = wl_data_device_leave,
+        .motion = wl_data_device_motion,
+        .drop = wl_data_device_drop,
+        .selection = wl_data_device_selection,
+};
+
+static void zwp_primary_selection_offer_v1_offer(void *data,
+                                                 struct zwp_primary_selection_offer_v1 *offer,
+                                                 const char *mime_type) {
+    offer_add_type(static_cast<struct clipboard_offer *>(data), mime_type);
+}
+
+static const struct zwp_primary_selection_offer_v1_listener zwp_primary_selection_offer_v1_listener = {
+        .offer = zwp_primary_selection_offer_v1_offer,
+};
+
+static void zwp_primary_selection_device_v1_data_offer(void *data,
+                                                       struct zwp_primary_selection_device_v1 *device,
+                                                       struct zwp_primary_selection_offer_v1 *offer) {
+    struct clipboard_offer *clipboard_offer = offer_create(offer, CLIPBOARD_SELECTION_PRIMARY);
+    zwp_primary_selection_offer_v1_add_listener(offer, &zwp_primary_selection_offer_v1_listener,
+                                                clipboard_offer);
+}
+
+static void zwp_primary_selection_device_v1_selection(void *data,
+                                                      struct zwp_primary_selection_device_v1 *device,
+                                                      struct zwp_primary_selection_offer_v1 *id) {
+    struct clipboard *clipboard = static_cast<struct clipboard *>(data);
+    clipboard_set_offer(clipboard, CLIPBOARD_SELECTION_PRIMARY, id ?
+            static_cast<struct clipboard_offer *>(zwp_primary_selection_offer_v1_get_user_data(id)) : NULL);
+}
+
+static const struct zwp_primary_selection_device_v1_listener zwp_primary_selection_device_v1_listener = {
+        .data_offer = zwp_primary_selection_device_v1_data_offer,
+        .selection = zwp_primary_selection_device_v1_selection,
+};
+
+bool clipboard_paste(struct clipboard *clipboard, enum clipboard_selection selection, int fd) {
+    struct clipboard_offer *offer = clipboard->offers[selection];
+    if (!offer || !offer->mime) {
+        fprintf(stderr, "clipboard: nothing to paste\n");
+        close(fd);
+        return false;
+    }
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+        close(fd);
+        return false;
+    }
+    /* A larger pipe means fewer wakeups per megabyte, the kernel may refuse */
+    fcntl(fds[0], F_SETPIPE_SZ, CLIPBOARD_CHUNK);
+
+    if (selection == CLIPBOARD_SELECTION_PRIMARY)
+        zwp_primary_selection_offer_v1_receive(
+                static_cast<struct zwp_primary_selection_offer_v1 *>(offer->offer), offer->mime, fds[1]);
+    else
+        wl_data_offer_receive(static_cast<struct wl_data_offer *>(offer->offer), offer->mime, fds[1]);
+    /* The request holds its own copy, ours would keep the pipe from ever ending */
+    close(fds[1]);
+
+    fprintf(stderr, "clipboard: pasting %s\n", offer->mime);
+    return transfer_start(clipboard, CLIPBOARD_TRANSFER_PASTE, fds[0], fd) != NULL;
+}
+
+/* Sources */
+static void source_clear(struct clipboard_source *source, enum clipboard_selection selection) {
+    if (!source->source)
+        return;
+    if (selection == CLIPBOARD_SELECTION_PRIMARY)
+        zwp_primary_selection_source_v1_destroy(
+                static_cast<struct zwp_primary_selection_source_v1 *>(source->source));
+    else
+        wl_data_source_destroy(static_cast<struct wl_data_source *>(source->source));
+    close(source->fd);
+    source->source = NULL;
+    source->fd = -1;
+}
+
+static void source_send(struct clipboard_source *source, int32_t fd) {
+    struct stat st{};
+    int in_fd = dup(source->fd);
+    if (in_fd < 0 || fstat(in_fd, &st) < 0) {
+        if (in_fd >= 0)
+            close(in_fd);
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    struct clipboard_transfer *transfer =
+            transfer_start(source->clipboard, CLIPBOARD_TRANSFER_COPY, in_fd, fd);
+    if (transfer)
+        transfer->remaining = st.st_size;
+}
+
+static void wl_data_source_target(void *data, struct wl_data_source *wl_data_source,
+                                  const char *mime_type) {
+    /* This space deliberately left blank */
+}
+
+static void wl_data_source_send(void *data, struct wl_data_source *wl_data_source,
+                                const char *mime_type, int32_t fd) {
+    source_send(static_cast<struct clipboard_source *>(data), fd);
+}
+
+static void wl_data_source_cancelled(void *data, struct wl_data_source *wl_data_source) {
+    source_clear(static_cast<struct clipboard_source *>(data), CLIPBOARD_SELECTION_CLIPBOARD);
+}
+
+static void wl_data_source_dnd_drop_performed(void *data, struct wl_data_source *wl_data_source) {
+    /* This space deliberately left blank */
+}
+
+static void wl_data_source_dnd_finished(void *data, struct wl_data_source *wl_data_source) {
+    /* This space deliberately left blank */
+}
+
+static void wl_data_source_action(void *data, struct wl_data_source *wl_data_source,
+                                  uint32_t dnd_action) {
+    /* This space deliberately left blank */
+}
+
+static const struct wl_data_source_listener wl_data_source_listener = {
+        .target = wl_data_source_target,
+        .send = wl_data_source_send,
+        .cancelled = wl_data_source_cancelled,
+        .dnd_drop_performed = wl_data_source_dnd_drop_performed,
+        .dnd_finished = wl_data_source_dnd_finished,
+        .action = wl_data_source_action,
+};
+
+static void zwp_primary_selection_source_v1_send(void *data,
+                                                 struct zwp_primary_selection_source_v1 *source,
+                                                 const char *mime_type, int32_t fd) {
+    source_send(static_cast<struct clipboard_source *>(data), fd);
+}
+
+static void zwp_primary_selection_source_v1_cancelled(void *data,
+                                                      struct zwp_primary_selection_source_v1 *source) {
+    source_clear(static_cast<struct clipboard_source *>(data), CLIPBOARD_SELECTION_PRIMARY);
+}
+
+static const struct zwp_primary_selection_source_v1_listener zwp_primary_selection_source_v1_listener = {
+        .send = zwp_primary_selection_source_v1_send,
+        .cancelled = zwp_primary_selection_source_v1_cancelled,
+};
+
+bool clipboard_copy(struct clipboard *clipboard, enum clipboard_selection selection,
+                    int fd, uint32_t serial) {
+    if (selection == CLIPBOARD_SELECTION_PRIMARY && !clipboard->primary_device) {
+        close(fd);
+        return false;
+    }
+    struct clipboard_source *source = &clipboard->sources[selection];
+    source_clear(source, selection);
+    source->fd = fd;
+
+    if (selection == CLIPBOARD_SELECTION_PRIMARY) {
+        struct zwp_primary_selection_source_v1 *primary_source =
+                zwp_primary_selection_device_manager_v1_create_source(clipboard->primary_manager);
+        zwp_primary_selection_source_v1_add_listener(primary_source,
+                                                     &zwp_primary_selection_source_v1_listener, source);
+        for (int i = 0; i < 3; ++i)
+            zwp_primary_selection_source_v1_offer(primary_source, clipboard_text_types[i]);
+        zwp_primary_selection_device_v1_set_selection(clipboard->primary_device, primary_source, serial);
+        source->source = primary_source;
+    } else {
+        struct wl_data_source *data_source = wl_data_device_manager_create_data_source(clipboard->manager);
+        wl_data_source_add_listener(data_source, &wl_data_source_listener, source);
+        for (int i = 0; i < 3; ++i)
+            wl_data_source_offer(data_source, clipboard_text_types[i]);
+        wl_data_device_set_selection(clipboard->device, data_source, serial);
+        source->source = data_source;
+    }
+    return true;
+}
+
+struct clipboard *clipboard_create(struct wl_seat *seat,
+                                   struct wl_data_device_manager *manager,
+                                   struct zwp_primary_selection_device_manager_v1 *primary_manager) {
+    struct clipboard *clipboard =
+            static_cast<struct clipboard *>(calloc(1, sizeof(*clipboard)));
+    if (!clipboard)
+        return NULL;
+    for (int i = 0; i < 2; ++i) {
+        clipboard->sources[i].clipboard = clipboard;
+        clipboard->sources[i].fd = -1;
+    }
+    clipboard->manager = manager;
+    clipboard->device = wl_data_device_manager_get_data_device(manager, seat);
+    wl_data_device_add_listener(clipboard->device, &wl_data_device_listener, clipboard);
+    if (primary_manager) {
+        clipboard->primary_manager = primary_manager;
+        clipboard->primary_device = zwp_primary_selection_device_manager_v1_get_device(primary_manager, seat);
+        zwp_primary_selection_device_v1_add_listener(clipboard->primary_device,
+                                                     &zwp_primary_selection_device_v1_listener, clipboard);
+    }
+    return clipboard;
+}
+
+void clipboard_destroy(struct clipboard *clipboard) {
+    for (int i = 0; i < CLIPBOARD_MAX_TRANSFERS; ++i) {
+        if (clipboard->transfers[i].active)
+            transfer_finish(&clipboard->transfers[i], ECANCELED);
+    }
+    for (int i = 0; i < 2; ++i) {
+        source_clear(&clipboard->sources[i], static_cast<enum clipboard_selection>(i));
+        offer_destroy(clipboard->offers[i]);
+    }
+    offer_destroy(clipboard->dnd_offer);
+    if (clipboard->primary_device)
+        zwp_primary_selection_device_v1_destroy(clipboard->primary_device);
+    wl_data_device_release(clipboard->device);
+    free(clipboard);
+}
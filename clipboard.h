@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <poll.h>
+#include <wayland-client.h>
+#include "primary-selection-unstable-v1-client-protocol.h"
+
+/*
+ * Clipboard and primary selection
+ *
+ * Selections are moved between file descriptors by the kernel: pasting
+ * splices the offer's pipe into the destination file or memfd, copying
+ * splices (or sendfile()s when the peer did not hand over a pipe) the source
+ * file into the receiving fd. Every fd is non-blocking and polled together
+ * with the display, and each ready transfer moves at most one chunk per loop
+ * iteration, so a huge selection neither stalls dispatch nor gets buffered in
+ * memory.
+ */
+
+#define CLIPBOARD_MAX_TRANSFERS 8
+#define CLIPBOARD_CHUNK (1 << 20)
+
+enum clipboard_selection {
+    CLIPBOARD_SELECTION_CLIPBOARD = 0,
+    CLIPBOARD_SELECTION_PRIMARY = 1,
+};
+
+struct clipboard;
+
+/* `primary_manager` may be NULL, the primary selection is unavailable then */
+struct clipboard *clipboard_create(struct wl_seat *seat,
+                                   struct wl_data_device_manager *manager,
+                                   struct zwp_primary_selection_device_manager_v1 *primary_manager);
+void clipboard_destroy(struct clipboard *clipboard);
+/* Starts writing the current selection into `fd`, which is taken over */
+bool clipboard_paste(struct clipboard *clipboard, enum clipboard_selection selection, int fd);
+/* Offers the contents of the regular file or memfd `fd` as text, `fd` is taken over */
+bool clipboard_copy(struct clipboard *clipboard, enum clipboard_selection selection,
+                    int fd, uint32_t serial);
+/* Fills in the fds of running transfers, returns how many were added */
+int clipboard_poll_fds(struct clipboard *clipboard, struct pollfd *fds, int max);
+/* Advances the transfers polled by the matching clipboard_poll_fds() call */
+void clipboard_dispatch(struct clipboard *clipboard, const struct pollfd *fds, int count);
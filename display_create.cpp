@@ -1,24 +1,1126 @@
-#include <stdio.h>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <wayland-server.h>
+#include <xkbcommon/xkbcommon.h>
+#include "xdg-shell-server-protocol.h"
+#include "server.h"
+#include "server_input.h"
+
+/*
+ * A minimal headless compositor: wl_compositor, wl_shm, xdg_wm_base, wl_seat,
+ * wl_output and wp_presentation, enough to run every SHM sample in this
+ * repository without a GPU or a desktop session. Nothing is shown anywhere,
+ * the outputs are plain images in memory that are composited on a virtual
+ * vblank, see server_output.cpp.
+ */
+
+#define SERVER_OUTPUT_WIDTH 1280
+#define SERVER_OUTPUT_HEIGHT 720
+#define SERVER_OUTPUT_REFRESH_MHZ 60000
+#define SERVER_CASCADE 32
+
+/* For resources kept in a wl_list through their link */
+static void unlink_resource(struct wl_resource *resource) {
+    wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void destroy_resource(struct wl_client *client, struct wl_resource *resource) {
+    wl_resource_destroy(resource);
+}
+
+/* Regions */
+static void region_add(struct wl_client *client, struct wl_resource *resource,
+                       int32_t x, int32_t y, int32_t width, int32_t height) {
+    struct server_region *region = static_cast<struct server_region *>(wl_resource_get_user_data(resource));
+    struct server_box box = server_box_make(x, y, width, height);
+    server_region_add(region, &box);
+}
+
+static void region_subtract(struct wl_client *client, struct wl_resource *resource,
+                            int32_t x, int32_t y, int32_t width, int32_t height) {
+    struct server_region *region = static_cast<struct server_region *>(wl_resource_get_user_data(resource));
+    struct server_box box = server_box_make(x, y, width, height);
+    server_region_subtract(region, &box);
+}
+
+static const struct wl_region_interface region_implementation = {
+        .destroy = destroy_resource,
+        .add = region_add,
+        .subtract = region_subtract,
+};
+
+static void region_resource_destroy(struct wl_resource *resource) {
+    free(wl_resource_get_user_data(resource));
+}
+
+/* Seat focus */
+static struct wl_resource *surface_resource_for(struct wl_resource *resource,
+                                                struct server_surface *surface) {
+    if (!surface || wl_resource_get_client(resource) != wl_resource_get_client(surface->resource))
+        return NULL;
+    return surface->resource;
+}
+
+static void seat_send_enter(struct server_seat *seat, struct server *server) {
+    struct server_surface *surface = seat->focus;
+    uint32_t serial = wl_display_next_serial(server->display);
+    struct wl_resource *resource;
+
+    wl_resource_for_each(resource, &seat->keyboards) {
+        struct wl_resource *target = surface_resource_for(resource, surface);
+        if (!target)
+            continue;
+        struct wl_array keys;
+        wl_array_init(&keys);
+        wl_keyboard_send_enter(resource, serial, target, &keys);
+        wl_keyboard_send_modifiers(resource, serial, 0, 0, 0, 0);
+        wl_array_release(&keys);
+    }
+    wl_resource_for_each(resource, &seat->pointers) {
+        struct wl_resource *target = surface_resource_for(resource, surface);
+        if (!target)
+            continue;
+        wl_pointer_send_enter(resource, serial, target,
+                              wl_fixed_from_int(server_surface_width(surface) / 2),
+                              wl_fixed_from_int(server_surface_height(surface) / 2));
+        if (wl_resource_get_version(resource) >= WL_POINTER_FRAME_SINCE_VERSION)
+            wl_pointer_send_frame(resource);
+    }
+}
+
+static void seat_send_leave(struct server_seat *seat, struct server *server) {
+    struct server_surface *surface = seat->focus;
+    uint32_t serial = wl_display_next_serial(server->display);
+    struct wl_resource *resource;
+
+    wl_resource_for_each(resource, &seat->keyboards) {
+        struct wl_resource *target = surface_resource_for(resource, surface);
+        if (target)
+            wl_keyboard_send_leave(resource, serial, target);
+    }
+    wl_resource_for_each(resource, &seat->pointers) {
+        struct wl_resource *target = surface_resource_for(resource, surface);
+        if (!target)
+            continue;
+        wl_pointer_send_leave(resource, serial, target);
+        if (wl_resource_get_version(resource) >= WL_POINTER_FRAME_SINCE_VERSION)
+            wl_pointer_send_frame(resource);
+    }
+}
+
+/* Keyboard and pointer focus follow the most recently mapped toplevel */
+static void seat_set_focus(struct server *server, struct server_surface *surface) {
+    struct server_seat *seat = &server->seat;
+    if (seat->focus == surface)
+        return;
+    if (seat->focus)
+        seat_send_leave(seat, server);
+    seat->focus = surface;
+    if (surface)
+        seat_send_enter(seat, server);
+}
+
+static struct server_surface *topmost_toplevel(struct server *server) {
+    struct server_surface *surface;
+    wl_list_for_each_reverse(surface, &server->surfaces, link) {
+        if (surface->mapped && surface->role == SERVER_ROLE_XDG_TOPLEVEL)
+            return surface;
+    }
+    return NULL;
+}
+
+/* Surfaces */
+static void surface_state_buffer_destroyed(struct wl_listener *listener, void *data) {
+    struct server_surface_state *state = wl_container_of(listener, state, buffer_destroy);
+    state->buffer = NULL;
+    wl_list_remove(&listener->link);
+    wl_list_init(&listener->link);
+}
+
+static void surface_state_init(struct server_surface_state *state) {
+    memset(state, 0, sizeof(*state));
+    state->scale = 1;
+    state->buffer_destroy.notify = surface_state_buffer_destroyed;
+    wl_list_init(&state->buffer_destroy.link);
+    server_region_init(&state->damage, false);
+    server_region_init(&state->buffer_damage, false);
+    server_region_init(&state->opaque, true);
+    wl_list_init(&state->frame_callbacks);
+    wl_list_init(&state->feedbacks);
+}
+
+static void surface_state_set_buffer(struct server_surface_state *state, struct wl_resource *buffer) {
+    wl_list_remove(&state->buffer_destroy.link);
+    wl_list_init(&state->buffer_destroy.link);
+    state->buffer = buffer;
+    if (buffer)
+        wl_resource_add_destroy_listener(buffer, &state->buffer_destroy);
+}
+
+static void destroy_frame_callbacks(struct wl_list *callbacks) {
+    struct wl_resource *resource, *tmp;
+    wl_resource_for_each_safe(resource, tmp, callbacks) {
+        wl_resource_destroy(resource);
+    }
+}
+
+static void surface_map(struct server_surface *surface) {
+    struct server *server = surface->server;
+    surface->mapped = true;
+    if (surface->role == SERVER_ROLE_XDG_TOPLEVEL) {
+        int32_t step = server->toplevels++ % 8;
+        surface->x = step * SERVER_CASCADE;
+        surface->y = step * SERVER_CASCADE;
+    }
+
+    /* Newly mapped surfaces go on top */
+    wl_list_remove(&surface->link);
+    wl_list_insert(server->surfaces.prev, &surface->link);
+
+    server_surface_update_outputs(surface);
+    server_surface_damage(surface);
+    if (surface->role == SERVER_ROLE_XDG_TOPLEVEL)
+        seat_set_focus(server, surface);
+}
+
+static void surface_unmap(struct server_surface *surface) {
+    if (!surface->mapped)
+        return;
+    server_surface_damage(surface);
+    surface->mapped = false;
+    server_surface_update_outputs(surface);
+    struct server *server = surface->server;
+    if (server->seat.focus == surface) {
+        seat_set_focus(server, NULL);
+        seat_set_focus(server, topmost_toplevel(server));
+    }
+}
+
+/* Copies the SHM contents so the buffer can go back to the client at once, returns the bytes copied */
+static uint64_t surface_upload(struct server_surface *surface, struct wl_resource *buffer) {
+    struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(buffer);
+    if (!shm_buffer) {
+        fprintf(stderr, "only wl_shm buffers are supported\n");
+        wl_buffer_send_release(buffer);
+        return 0;
+    }
+
+    int32_t width = wl_shm_buffer_get_width(shm_buffer);
+    int32_t height = wl_shm_buffer_get_height(shm_buffer);
+    int32_t stride = wl_shm_buffer_get_stride(shm_buffer);
+    if (width != surface->buffer_width || height != surface->buffer_height) {
+        free(surface->pixels);
+        surface->pixels = static_cast<uint32_t *>(malloc((size_t) width * height * 4));
+        surface->buffer_width = surface->pixels ? width : 0;
+        surface->buffer_height = surface->pixels ? height : 0;
+    }
+    surface->has_alpha = wl_shm_buffer_get_format(shm_buffer) == WL_SHM_FORMAT_ARGB8888;
+
+    if (surface->pixels) {
+        wl_shm_buffer_begin_access(shm_buffer);
+        const uint8_t *data = static_cast<const uint8_t *>(wl_shm_buffer_get_data(shm_buffer));
+        for (int32_t y = 0; y < height; ++y)
+            memcpy(surface->pixels + (size_t) y * width, data + (size_t) y * stride, (size_t) width * 4);
+        wl_shm_buffer_end_access(shm_buffer);
+    }
+    wl_buffer_send_release(buffer);
+    return surface->pixels ? (uint64_t) width * height * 4 : 0;
+}
+
+static void surface_send_configure(struct server_surface *surface) {
+    if (!surface->xdg_surface || !surface->role_resource)
+        return;
+    uint32_t serial = wl_display_next_serial(surface->server->display);
+    if (surface->role == SERVER_ROLE_XDG_TOPLEVEL) {
+        struct wl_array states;
+        wl_array_init(&states);
+        uint32_t *state = static_cast<uint32_t *>(wl_array_add(&states, sizeof(uint32_t)));
+        *state = XDG_TOPLEVEL_STATE_ACTIVATED;
+        /* Zero size lets the client pick its own */
+        xdg_toplevel_send_configure(surface->role_resource, 0, 0, &states);
+        wl_array_release(&states);
+    } else if (surface->role == SERVER_ROLE_XDG_POPUP) {
+        xdg_popup_send_configure(surface->role_resource, surface->x, surface->y,
+                                 server_surface_width(surface), server_surface_height(surface));
+    }
+    xdg_surface_send_configure(surface->xdg_surface, serial);
+    surface->configure_serial = serial;
+}
+
+/* True if the commit changes the size of the surface on screen */
+static bool surface_pending_reshapes(const struct server_surface *surface) {
+    const struct server_surface_state *pending = &surface->pending;
+    if (pending->scale != surface->scale)
+        return true;
+    if (!pending->attached || !pending->buffer)
+        return false;
+    struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(pending->buffer);
+    return !shm_buffer || wl_shm_buffer_get_width(shm_buffer) != surface->buffer_width
+           || wl_shm_buffer_get_height(shm_buffer) != surface->buffer_height;
+}
+
+/* Merges both kinds of pending damage into surface coordinates */
+static void surface_pending_damage(const struct server_surface *surface, struct server_region *damage) {
+    const struct server_surface_state *pending = &surface->pending;
+    *damage = pending->damage;
+    int64_t scale = surface->scale;
+    for (uint32_t i = 0; i < pending->buffer_damage.count; ++i) {
+        const struct server_box *box = &pending->buffer_damage.boxes[i];
+        /* Rounded outwards, a partly damaged buffer pixel damages its whole logical pixel */
+        struct server_box logical = {
+                (int32_t) (box->x1 / scale), (int32_t) (box->y1 / scale),
+                server_coord_saturate((box->x2 + scale - 1) / scale),
+                server_coord_saturate((box->y2 + scale - 1) / scale),
+        };
+        server_region_add(damage, &logical);
+    }
+}
+
+static void surface_commit(struct server_surface *surface) {
+    struct server_surface_state *pending = &surface->pending;
+    bool xdg = surface->role == SERVER_ROLE_XDG_TOPLEVEL || surface->role == SERVER_ROLE_XDG_POPUP;
+
+    if (xdg && pending->attached && pending->buffer && !surface->configured) {
+        wl_resource_post_error(surface->xdg_surface, XDG_SURFACE_ERROR_UNCONFIGURED_BUFFER,
+                               "buffer attached before the first ack_configure");
+        return;
+    }
+
+    /* A new size redraws where the surface was as well as where it is */
+    bool reshaped = surface->mapped && surface_pending_reshapes(surface);
+    if (reshaped)
+        server_surface_damage(surface);
+    surface->scale = pending->scale;
+
+    bool unmap = false;
+    uint64_t shm_bytes = 0;
+    if (pending->attached) {
+        if (pending->buffer)
+            shm_bytes = surface_upload(surface, pending->buffer);
+        else
+            unmap = true;
+        surface_state_set_buffer(pending, NULL);
+        pending->attached = false;
+        /* Content that never reached a vblank was not presented */
+        server_feedbacks_discard(&surface->feedbacks);
+        if (surface->mapped && !reshaped && !unmap) {
+            struct server_region damage;
+            surface_pending_damage(surface, &damage);
+            server_surface_damage_region(surface, &damage);
+        }
+    }
+    if (reshaped) {
+        server_surface_update_outputs(surface);
+        server_surface_damage(surface);
+    }
+    server_region_clear(&pending->damage);
+    server_region_clear(&pending->buffer_damage);
+    if (pending->opaque_set) {
+        surface->opaque = pending->opaque;
+        pending->opaque_set = false;
+    }
+    wl_list_insert_list(surface->frame_callbacks.prev, &pending->frame_callbacks);
+    wl_list_init(&pending->frame_callbacks);
+    wl_list_insert_list(surface->feedbacks.prev, &pending->feedbacks);
+    wl_list_init(&pending->feedbacks);
+
+    if (xdg) {
+        if (unmap) {
+            surface_unmap(surface);
+        } else if (surface->configure_serial == 0) {
+            /* The initial commit, answered with the first configure */
+            surface_send_configure(surface);
+        } else if (!surface->mapped && surface->pixels && surface->role_resource) {
+            surface_map(surface);
+        }
+    }
+    if (surface->server->accounting)
+        server_accounting_commit(surface->server->accounting, wl_resource_get_client(surface->resource), shm_bytes);
+    server_clock_surface_committed(surface);
+}
+
+static void surface_attach(struct wl_client *client, struct wl_resource *resource,
+                           struct wl_resource *buffer, int32_t x, int32_t y) {
+    struct server_surface *surface = static_cast<struct server_surface *>(wl_resource_get_user_data(resource));
+    surface_state_set_buffer(&surface->pending, buffer);
+    surface->pending.attached = true;
+    surface->pending.dx = x;
+    surface->pending.dy = y;
+}
+
+static void surface_damage(struct wl_client *client, struct wl_resource *resource,
+                           int32_t x, int32_t y, int32_t width, int32_t height) {
+    struct server_surface *surface = static_cast<struct server_surface *>(wl_resource_get_user_data(resource));
+    struct server_box box = server_box_make(x, y, width, height);
+    server_region_add(&surface->pending.damage, &box);
+}
+
+static void surface_frame(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct server_surface *surface = static_cast<struct server_surface *>(wl_resource_get_user_data(resource));
+    struct wl_resource *callback = wl_resource_create(client, &wl_callback_interface, 1, id);
+    if (!callback) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(callback, NULL, NULL, unlink_resource);
+    wl_list_insert(surface->pending.frame_callbacks.prev, wl_resource_get_link(callback));
+}
+
+static void surface_set_opaque_region(struct wl_client *client, struct wl_resource *resource,
+                                      struct wl_resource *region) {
+    struct server_surface *surface = static_cast<struct server_surface *>(wl_resource_get_user_data(resource));
+    server_region_clear(&surface->pending.opaque);
+    if (region) {
+        const struct server_region *source =
+                static_cast<const struct server_region *>(wl_resource_get_user_data(region));
+        surface->pending.opaque.count = source->count;
+        memcpy(surface->pending.opaque.boxes, source->boxes, source->count * sizeof(source->boxes[0]));
+    }
+    surface->pending.opaque_set = true;
+}
+
+static void surface_set_input_region(struct wl_client *client, struct wl_resource *resource,
+                                     struct wl_resource *region) {
+    /* Input always covers the whole surface */
+}
+
+static void surface_commit_request(struct wl_client *client, struct wl_resource *resource) {
+    surface_commit(static_cast<struct server_surface *>(wl_resource_get_user_data(resource)));
+}
+
+static void surface_set_buffer_transform(struct wl_client *client, struct wl_resource *resource,
+                                         int32_t transform) {
+    /* Only WL_OUTPUT_TRANSFORM_NORMAL is composited */
+}
+
+static void surface_set_buffer_scale(struct wl_client *client, struct wl_resource *resource,
+                                     int32_t scale) {
+    struct server_surface *surface = static_cast<struct server_surface *>(wl_resource_get_user_data(resource));
+    if (scale < 1) {
+        wl_resource_post_error(resource, WL_SURFACE_ERROR_INVALID_SCALE, "scale %d is not positive", scale);
+        return;
+    }
+    surface->pending.scale = scale;
+}
+
+static void surface_damage_buffer(struct wl_client *client, struct wl_resource *resource,
+                                  int32_t x, int32_t y, int32_t width, int32_t height) {
+    struct server_surface *surface = static_cast<struct server_surface *>(wl_resource_get_user_data(resource));
+    struct server_box box = server_box_make(x, y, width, height);
+    server_region_add(&surface->pending.buffer_damage, &box);
+}
+
+static const struct wl_surface_interface surface_implementation = {
+        .destroy = destroy_resource,
+        .attach = surface_attach,
+        .damage = surface_damage,
+        .frame = surface_frame,
+        .set_opaque_region = surface_set_opaque_region,
+        .set_input_region = surface_set_input_region,
+        .commit = surface_commit_request,
+        .set_buffer_transform = surface_set_buffer_transform,
+        .set_buffer_scale = surface_set_buffer_scale,
+        .damage_buffer = surface_damage_buffer,
+};
+
+static void surface_resource_destroy(struct wl_resource *resource) {
+    struct server_surface *surface = static_cast<struct server_surface *>(wl_resource_get_user_data(resource));
+    struct server *server = surface->server;
+    surface_unmap(surface);
+    /* Role objects may outlive the surface while a client disconnects */
+    if (surface->xdg_surface)
+        wl_resource_set_user_data(surface->xdg_surface, NULL);
+    if (surface->role_resource)
+        wl_resource_set_user_data(surface->role_resource, NULL);
+    destroy_frame_callbacks(&surface->pending.frame_callbacks);
+    destroy_frame_callbacks(&surface->frame_callbacks);
+    server_feedbacks_discard(&surface->pending.feedbacks);
+    server_feedbacks_discard(&surface->feedbacks);
+    surface_state_set_buffer(&surface->pending, NULL);
+    wl_list_remove(&surface->link);
+    free(surface->pixels);
+    free(surface);
+    server_clock_surface_destroyed(server);
+}
+
+/* Compositor */
+static void compositor_create_surface(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct server *server = static_cast<struct server *>(wl_resource_get_user_data(resource));
+    struct server_surface *surface = static_cast<struct server_surface *>(calloc(1, sizeof(*surface)));
+    if (!surface) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    surface->resource = wl_resource_create(client, &wl_surface_interface,
+                                           wl_resource_get_version(resource), id);
+    if (!surface->resource) {
+        free(surface);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    surface->server = server;
+    surface->scale = 1;
+    surface_state_init(&surface->pending);
+    server_region_init(&surface->opaque, true);
+    wl_list_init(&surface->frame_callbacks);
+    wl_list_init(&surface->feedbacks);
+    wl_list_insert(server->surfaces.prev, &surface->link);
+    wl_resource_set_implementation(surface->resource, &surface_implementation, surface,
+                                   surface_resource_destroy);
+}
+
+static void compositor_create_region(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct server_region *region = static_cast<struct server_region *>(malloc(sizeof(*region)));
+    struct wl_resource *region_resource = wl_resource_create(client, &wl_region_interface, 1, id);
+    if (!region || !region_resource) {
+        free(region);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    /* Only used for opaque regions, so never claim more than was given */
+    server_region_init(region, true);
+    wl_resource_set_implementation(region_resource, &region_implementation, region,
+                                   region_resource_destroy);
+}
+
+static const struct wl_compositor_interface compositor_implementation = {
+        .create_surface = compositor_create_surface,
+        .create_region = compositor_create_region,
+};
+
+static void compositor_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *resource = wl_resource_create(client, &wl_compositor_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &compositor_implementation, data, NULL);
+}
+
+/* xdg-shell */
+struct server_positioner {
+    int32_t width, height;
+    struct server_box anchor_rect;
+    int32_t offset_x, offset_y;
+};
+
+static void positioner_set_size(struct wl_client *client, struct wl_resource *resource,
+                                int32_t width, int32_t height) {
+    struct server_positioner *positioner =
+            static_cast<struct server_positioner *>(wl_resource_get_user_data(resource));
+    positioner->width = width;
+    positioner->height = height;
+}
+
+static void positioner_set_anchor_rect(struct wl_client *client, struct wl_resource *resource,
+                                       int32_t x, int32_t y, int32_t width, int32_t height) {
+    struct server_positioner *positioner =
+            static_cast<struct server_positioner *>(wl_resource_get_user_data(resource));
+    positioner->anchor_rect = server_box_make(x, y, width, height);
+}
+
+static void positioner_set_anchor(struct wl_client *client, struct wl_resource *resource,
+                                  uint32_t anchor) {
+    /* Popups are placed at the top left corner of the anchor rectangle */
+}
+
+static void positioner_set_gravity(struct wl_client *client, struct wl_resource *resource,
+                                   uint32_t gravity) {
+    /* This space deliberately left blank */
+}
+
+static void positioner_set_constraint_adjustment(struct wl_client *client, struct wl_resource *resource,
+                                                 uint32_t constraint_adjustment) {
+    /* This space deliberately left blank */
+}
+
+static void positioner_set_offset(struct wl_client *client, struct wl_resource *resource,
+                                  int32_t x, int32_t y) {
+    struct server_positioner *positioner =
+            static_cast<struct server_positioner *>(wl_resource_get_user_data(resource));
+    positioner->offset_x = x;
+    positioner->offset_y = y;
+}
+
+static const struct xdg_positioner_interface positioner_implementation = {
+        .destroy = destroy_resource,
+        .set_size = positioner_set_size,
+        .set_anchor_rect = positioner_set_anchor_rect,
+        .set_anchor = positioner_set_anchor,
+        .set_gravity = positioner_set_gravity,
+        .set_constraint_adjustment = positioner_set_constraint_adjustment,
+        .set_offset = positioner_set_offset,
+};
+
+static void positioner_resource_destroy(struct wl_resource *resource) {
+    free(wl_resource_get_user_data(resource));
+}
+
+/* Toplevels accept every request and ignore it, windows never move */
+static void toplevel_set_parent(struct wl_client *client, struct wl_resource *resource,
+                                struct wl_resource *parent) {}
+static void toplevel_set_title(struct wl_client *client, struct wl_resource *resource,
+                               const char *title) {}
+static void toplevel_set_app_id(struct wl_client *client, struct wl_resource *resource,
+                                const char *app_id) {}
+static void toplevel_show_window_menu(struct wl_client *client, struct wl_resource *resource,
+                                      struct wl_resource *seat, uint32_t serial, int32_t x, int32_t y) {}
+static void toplevel_move(struct wl_client *client, struct wl_resource *resource,
+                          struct wl_resource *seat, uint32_t serial) {}
+static void toplevel_resize(struct wl_client *client, struct wl_resource *resource,
+                            struct wl_resource *seat, uint32_t serial, uint32_t edges) {}
+static void toplevel_set_max_size(struct wl_client *client, struct wl_resource *resource,
+                                  int32_t width, int32_t height) {}
+static void toplevel_set_min_size(struct wl_client *client, struct wl_resource *resource,
+                                  int32_t width, int32_t height) {}
+static void toplevel_set_maximized(struct wl_client *client, struct wl_resource *resource) {}
+static void toplevel_unset_maximized(struct wl_client *client, struct wl_resource *resource) {}
+static void toplevel_set_fullscreen(struct wl_client *client, struct wl_resource *resource,
+                                    struct wl_resource *output) {}
+static void toplevel_unset_fullscreen(struct wl_client *client, struct wl_resource *resource) {}
+static void toplevel_set_minimized(struct wl_client *client, struct wl_resource *resource) {}
+
+static const struct xdg_toplevel_interface toplevel_implementation = {
+        .destroy = destroy_resource,
+        .set_parent = toplevel_set_parent,
+        .set_title = toplevel_set_title,
+        .set_app_id = toplevel_set_app_id,
+        .show_window_menu = toplevel_show_window_menu,
+        .move = toplevel_move,
+        .resize = toplevel_resize,
+        .set_max_size = toplevel_set_max_size,
+        .set_min_size = toplevel_set_min_size,
+        .set_maximized = toplevel_set_maximized,
+        .unset_maximized = toplevel_unset_maximized,
+        .set_fullscreen = toplevel_set_fullscreen,
+        .unset_fullscreen = toplevel_unset_fullscreen,
+        .set_minimized = toplevel_set_minimized,
+};
+
+static void popup_grab(struct wl_client *client, struct wl_resource *resource,
+                       struct wl_resource *seat, uint32_t serial) {}
+
+static const struct xdg_popup_interface popup_implementation = {
+        .destroy = destroy_resource,
+        .grab = popup_grab,
+};
+
+/* Shared by toplevels and popups, the surface keeps its role */
+static void role_resource_destroy(struct wl_resource *resource) {
+    struct server_surface *surface = static_cast<struct server_surface *>(wl_resource_get_user_data(resource));
+    if (!surface)
+        return;
+    surface_unmap(surface);
+    surface->role_resource = NULL;
+    surface->configured = false;
+    surface->configure_serial = 0;
+}
+
+static void xdg_surface_get_toplevel(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct server_surface *surface = static_cast<struct server_surface *>(wl_resource_get_user_data(resource));
+    if (!surface)
+        return;
+    if (surface->role_resource) {
+        wl_resource_post_error(resource, XDG_SURFACE_ERROR_ALREADY_CONSTRUCTED, "role object already exists");
+        return;
+    }
+    struct wl_resource *toplevel = wl_resource_create(client, &xdg_toplevel_interface,
+                                                      wl_resource_get_version(resource), id);
+    if (!toplevel) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(toplevel, &toplevel_implementation, surface, role_resource_destroy);
+    surface->role = SERVER_ROLE_XDG_TOPLEVEL;
+    surface->role_resource = toplevel;
+}
+
+static void xdg_surface_get_popup(struct wl_client *client, struct wl_resource *resource, uint32_t id,
+                                  struct wl_resource *parent, struct wl_resource *positioner_resource) {
+    struct server_surface *surface = static_cast<struct server_surface *>(wl_resource_get_user_data(resource));
+    if (!surface)
+        return;
+    if (surface->role_resource) {
+        wl_resource_post_error(resource, XDG_SURFACE_ERROR_ALREADY_CONSTRUCTED, "role object already exists");
+        return;
+    }
+    struct wl_resource *popup = wl_resource_create(client, &xdg_popup_interface,
+                                                   wl_resource_get_version(resource), id);
+    if (!popup) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(popup, &popup_implementation, surface, role_resource_destroy);
+    surface->role = SERVER_ROLE_XDG_POPUP;
+    surface->role_resource = popup;
+
+    const struct server_positioner *positioner =
+            static_cast<const struct server_positioner *>(wl_resource_get_user_data(positioner_resource));
+    struct server_surface *parent_surface =
+            parent ? static_cast<struct server_surface *>(wl_resource_get_user_data(parent)) : NULL;
+    surface->x = positioner->anchor_rect.x1 + positioner->offset_x;
+    surface->y = positioner->anchor_rect.y1 + positioner->offset_y;
+    if (parent_surface) {
+        surface->x += parent_surface->x;
+        surface->y += parent_surface->y;
+    }
+}
+
+static void xdg_surface_set_window_geometry(struct wl_client *client, struct wl_resource *resource,
+                                            int32_t x, int32_t y, int32_t width, int32_t height) {
+    /* Window geometry only matters for placement, which is fixed */
+}
+
+static void xdg_surface_ack_configure(struct wl_client *client, struct wl_resource *resource,
+                                      uint32_t serial) {
+    struct server_surface *surface = static_cast<struct server_surface *>(wl_resource_get_user_data(resource));
+    if (surface && serial == surface->configure_serial)
+        surface->configured = true;
+}
+
+static const struct xdg_surface_interface xdg_surface_implementation = {
+        .destroy = destroy_resource,
+        .get_toplevel = xdg_surface_get_toplevel,
+        .get_popup = xdg_surface_get_popup,
+        .set_window_geometry = xdg_surface_set_window_geometry,
+        .ack_configure = xdg_surface_ack_configure,
+};
+
+static void xdg_surface_resource_destroy(struct wl_resource *resource) {
+    struct server_surface *surface = static_cast<struct server_surface *>(wl_resource_get_user_data(resource));
+    if (!surface)
+        return;
+    surface_unmap(surface);
+    surface->xdg_surface = NULL;
+}
+
+static void xdg_wm_base_create_positioner(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct server_positioner *positioner =
+            static_cast<struct server_positioner *>(calloc(1, sizeof(*positioner)));
+    struct wl_resource *positioner_resource = wl_resource_create(client, &xdg_positioner_interface,
+                                                                 wl_resource_get_version(resource), id);
+    if (!positioner || !positioner_resource) {
+        free(positioner);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(positioner_resource, &positioner_implementation, positioner,
+                                   positioner_resource_destroy);
+}
+
+static void xdg_wm_base_get_xdg_surface(struct wl_client *client, struct wl_resource *resource, uint32_t id,
+                                        struct wl_resource *surface_resource) {
+    struct server_surface *surface =
+            static_cast<struct server_surface *>(wl_resource_get_user_data(surface_resource));
+    if (surface->xdg_surface || (surface->role != SERVER_ROLE_NONE && surface->role != SERVER_ROLE_XDG_TOPLEVEL
+                                 && surface->role != SERVER_ROLE_XDG_POPUP)) {
+        wl_resource_post_error(resource, XDG_WM_BASE_ERROR_ROLE, "surface already has a role");
+        return;
+    }
+    struct wl_resource *xdg_surface = wl_resource_create(client, &xdg_surface_interface,
+                                                         wl_resource_get_version(resource), id);
+    if (!xdg_surface) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(xdg_surface, &xdg_surface_implementation, surface,
+                                   xdg_surface_resource_destroy);
+    surface->xdg_surface = xdg_surface;
+}
+
+static void xdg_wm_base_pong(struct wl_client *client, struct wl_resource *resource, uint32_t serial) {
+    /* Clients are never pinged */
+}
+
+static const struct xdg_wm_base_interface xdg_wm_base_implementation = {
+        .destroy = destroy_resource,
+        .create_positioner = xdg_wm_base_create_positioner,
+        .get_xdg_surface = xdg_wm_base_get_xdg_surface,
+        .pong = xdg_wm_base_pong,
+};
+
+static void xdg_wm_base_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *resource = wl_resource_create(client, &xdg_wm_base_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &xdg_wm_base_implementation, data, NULL);
+}
+
+/* Seat */
+static void pointer_set_cursor(struct wl_client *client, struct wl_resource *resource, uint32_t serial,
+                               struct wl_resource *surface_resource, int32_t hotspot_x, int32_t hotspot_y) {
+    if (!surface_resource)
+        return;
+    /* Cursor surfaces take buffers and frame callbacks but are never drawn */
+    struct server_surface *surface =
+            static_cast<struct server_surface *>(wl_resource_get_user_data(surface_resource));
+    if (surface->role == SERVER_ROLE_NONE)
+        surface->role = SERVER_ROLE_CURSOR;
+}
+
+static const struct wl_pointer_interface pointer_implementation = {
+        .set_cursor = pointer_set_cursor,
+        .release = destroy_resource,
+};
+
+static const struct wl_keyboard_interface keyboard_implementation = {
+        .release = destroy_resource,
+};
+
+static const struct wl_touch_interface touch_implementation = {
+        .release = destroy_resource,
+};
+
+static struct wl_resource *seat_create_device(struct wl_client *client, struct wl_resource *seat_resource,
+                                              const struct wl_interface *interface, const void *implementation,
+                                              struct wl_list *list, uint32_t id) {
+    struct wl_resource *resource = wl_resource_create(client, interface,
+                                                      wl_resource_get_version(seat_resource), id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return NULL;
+    }
+    wl_resource_set_implementation(resource, implementation, wl_resource_get_user_data(seat_resource),
+                                   unlink_resource);
+    wl_list_insert(list, wl_resource_get_link(resource));
+    return resource;
+}
+
+static void seat_get_pointer(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct server *server = static_cast<struct server *>(wl_resource_get_user_data(resource));
+    struct wl_resource *pointer = seat_create_device(client, resource, &wl_pointer_interface,
+                                                     &pointer_implementation, &server->seat.pointers, id);
+    struct server_surface *focus = server->seat.focus;
+    if (pointer && surface_resource_for(pointer, focus)) {
+        wl_pointer_send_enter(pointer, wl_display_next_serial(server->display), focus->resource,
+                              wl_fixed_from_int(server_surface_width(focus) / 2),
+                              wl_fixed_from_int(server_surface_height(focus) / 2));
+        if (wl_resource_get_version(pointer) >= WL_POINTER_FRAME_SINCE_VERSION)
+            wl_pointer_send_frame(pointer);
+    }
+}
+
+static void seat_get_keyboard(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct server *server = static_cast<struct server *>(wl_resource_get_user_data(resource));
+    struct wl_resource *keyboard = seat_create_device(client, resource, &wl_keyboard_interface,
+                                                      &keyboard_implementation, &server->seat.keyboards, id);
+    if (!keyboard)
+        return;
+    if (server->seat.keymap_fd >= 0)
+        wl_keyboard_send_keymap(keyboard, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1,
+                                server->seat.keymap_fd, server->seat.keymap_size);
+    else
+        wl_keyboard_send_keymap(keyboard, WL_KEYBOARD_KEYMAP_FORMAT_NO_KEYMAP, -1, 0);
+    if (wl_resource_get_version(keyboard) >= WL_KEYBOARD_REPEAT_INFO_SINCE_VERSION)
+        wl_keyboard_send_repeat_info(keyboard, 25, 600);
+
+    struct server_surface *focus = server->seat.focus;
+    if (surface_resource_for(keyboard, focus)) {
+        uint32_t serial = wl_display_next_serial(server->display);
+        struct wl_array keys;
+        wl_array_init(&keys);
+        wl_keyboard_send_enter(keyboard, serial, focus->resource, &keys);
+        wl_keyboard_send_modifiers(keyboard, serial, 0, 0, 0, 0);
+        wl_array_release(&keys);
+    }
+}
+
+static void seat_get_touch(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct server *server = static_cast<struct server *>(wl_resource_get_user_data(resource));
+    seat_create_device(client, resource, &wl_touch_interface, &touch_implementation,
+                       &server->seat.touches, id);
+}
+
+static const struct wl_seat_interface seat_implementation = {
+        .get_pointer = seat_get_pointer,
+        .get_keyboard = seat_get_keyboard,
+        .get_touch = seat_get_touch,
+        .release = destroy_resource,
+};
+
+static void seat_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct server *server = static_cast<struct server *>(data);
+    struct wl_resource *resource = wl_resource_create(client, &wl_seat_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &seat_implementation, server, unlink_resource);
+    wl_list_insert(&server->seat.resources, wl_resource_get_link(resource));
+
+    uint32_t capabilities = WL_SEAT_CAPABILITY_POINTER;
+    if (server->seat.keymap_fd >= 0)
+        capabilities |= WL_SEAT_CAPABILITY_KEYBOARD;
+    if (server->seat.touch)
+        capabilities |= WL_SEAT_CAPABILITY_TOUCH;
+    wl_seat_send_capabilities(resource, capabilities);
+    if (version >= WL_SEAT_NAME_SINCE_VERSION)
+        wl_seat_send_name(resource, "headless");
+}
+
+/* The default XKB keymap, shared with every client through one memfd */
+static bool seat_init_keymap(struct server_seat *seat) {
+    seat->keymap_fd = -1;
+    struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    if (!context)
+        return false;
+    struct xkb_keymap *keymap = xkb_keymap_new_from_names(context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
+    if (!keymap) {
+        xkb_context_unref(context);
+        return false;
+    }
+    char *text = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+    xkb_keymap_unref(keymap);
+    xkb_context_unref(context);
+    if (!text)
+        return false;
+
+    uint32_t size = strlen(text) + 1;
+    int fd = memfd_create("keymap", MFD_CLOEXEC);
+    if (fd >= 0 && write(fd, text, size) != (ssize_t) size) {
+        close(fd);
+        fd = -1;
+    }
+    free(text);
+    seat->keymap_fd = fd;
+    seat->keymap_size = size;
+    return fd >= 0;
+}
+
+static int handle_signal(int signal_number, void *data) {
+    wl_display_terminate(static_cast<struct wl_display *>(data));
+    return 0;
+}
+
+static int handle_dump(int signal_number, void *data) {
+    server_accounting_dump(static_cast<struct server_accounting *>(data), stderr);
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--output WIDTHxHEIGHT@HZ]... [--virtual-time] [--threads N] [--stats]\n"
+                    "       [--input GENERATOR]... [--capture FILE]... [--capture-every N] [--capture-slots N]\n"
+                    "       [--client-stats]\n", name);
+    fprintf(stderr, "  --output        add an output, refresh between 30 and 240 Hz (default %dx%d@60)\n",
+            SERVER_OUTPUT_WIDTH, SERVER_OUTPUT_HEIGHT);
+    fprintf(stderr, "  --virtual-time  advance vblanks once every drawing client has committed\n");
+    fprintf(stderr, "  --threads       compositor threads, 0 for one per CPU (default)\n");
+    fprintf(stderr, "  --stats         log damage, culling and timing of every composited frame\n");
+    fprintf(stderr, "  --input         synthetic input for the focused surface, %d to %d Hz:\n"
+                    "                  pointer@HZ, axis@HZ, keys@HZ, touch@HZ or trace:FILE\n",
+            SERVER_INPUT_MIN_RATE, SERVER_INPUT_MAX_RATE);
+    fprintf(stderr, "  --capture       record the next output to FILE, Y4M if it ends in .y4m, else raw RGB24\n");
+    fprintf(stderr, "  --capture-every keep one vblank out of N (default 1)\n");
+    fprintf(stderr, "  --capture-slots frames queued for the writer thread before dropping, %d to %d (default %d)\n",
+            SERVER_CAPTURE_MIN_SLOTS, SERVER_CAPTURE_MAX_SLOTS, SERVER_CAPTURE_DEFAULT_SLOTS);
+    fprintf(stderr, "  --client-stats  count requests, events, bytes and handler time per client,\n"
+                    "                  printed on SIGUSR1 and when a client disconnects\n");
+}
 
 int
 main(int argc, char *argv[])
 {
-    struct wl_display *display = wl_display_create();
-    if (!display) {
+    struct {
+        int32_t width, height, refresh_mhz;
+    } modes[SERVER_MAX_OUTPUTS];
+    int mode_count = 0;
+    bool virtual_time = false, stats = false, client_stats = false;
+    int threads = 0;
+    const char *inputs[SERVER_MAX_INPUTS];
+    int input_count = 0;
+    const char *captures[SERVER_MAX_OUTPUTS];
+    int capture_count = 0, capture_every = 1, capture_slots = SERVER_CAPTURE_DEFAULT_SLOTS;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc && capture_count < SERVER_MAX_OUTPUTS) {
+            captures[capture_count++] = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--capture-every") == 0 && i + 1 < argc) {
+            capture_every = atoi(argv[++i]);
+            if (capture_every > 0)
+                continue;
+        }
+        if (strcmp(argv[i], "--capture-slots") == 0 && i + 1 < argc) {
+            capture_slots = atoi(argv[++i]);
+            if (capture_slots >= SERVER_CAPTURE_MIN_SLOTS && capture_slots <= SERVER_CAPTURE_MAX_SLOTS)
+                continue;
+        }
+        if (strcmp(argv[i], "--input") == 0 && i + 1 < argc && input_count < SERVER_MAX_INPUTS) {
+            inputs[input_count++] = argv[++i];
+            continue;
+        }
+        if (strcmp(argv[i], "--client-stats") == 0) {
+            client_stats = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--virtual-time") == 0) {
+            virtual_time = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            if (threads >= 0)
+                continue;
+        }
+        double hz = 0;
+        if (strcmp(argv[i], "--output") == 0 && i + 1 < argc && mode_count < SERVER_MAX_OUTPUTS
+                && sscanf(argv[++i], "%dx%d@%lf", &modes[mode_count].width, &modes[mode_count].height, &hz) == 3
+                && modes[mode_count].width > 0 && modes[mode_count].height > 0) {
+            modes[mode_count].refresh_mhz = (int32_t) (hz * 1000 + 0.5);
+            if (modes[mode_count].refresh_mhz >= SERVER_MIN_REFRESH_MHZ
+                    && modes[mode_count].refresh_mhz <= SERVER_MAX_REFRESH_MHZ) {
+                mode_count++;
+                continue;
+            }
+        }
+        usage(argv[0]);
+        return 1;
+    }
+    if (mode_count == 0) {
+        modes[0].width = SERVER_OUTPUT_WIDTH;
+        modes[0].height = SERVER_OUTPUT_HEIGHT;
+        modes[0].refresh_mhz = SERVER_OUTPUT_REFRESH_MHZ;
+        mode_count = 1;
+    }
+    if (capture_count > mode_count) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct server server = {};
+    server.display = wl_display_create();
+    if (!server.display) {
         fprintf(stderr, "Unable to create Wayland display.\n");
         return 1;
     }
+    server.loop = wl_display_get_event_loop(server.display);
+    server.stats = stats;
+    wl_list_init(&server.surfaces);
+    wl_list_init(&server.outputs);
+    wl_list_init(&server.inputs);
+    wl_list_init(&server.seat.resources);
+    wl_list_init(&server.seat.pointers);
+    wl_list_init(&server.seat.keyboards);
+    wl_list_init(&server.seat.touches);
+
+    if (client_stats) {
+        server.accounting = server_accounting_create(server.display);
+        if (!server.accounting) {
+            fprintf(stderr, "Unable to set up client accounting.\n");
+            return 1;
+        }
+    }
+
+    if (!seat_init_keymap(&server.seat))
+        fprintf(stderr, "No XKB keymap, the seat has no keyboard.\n");
+    wl_display_init_shm(server.display);
+    wl_global_create(server.display, &wl_compositor_interface, 4, &server, compositor_bind);
+    wl_global_create(server.display, &xdg_wm_base_interface, 1, &server, xdg_wm_base_bind);
+    server.seat.global = wl_global_create(server.display, &wl_seat_interface, 7, &server, seat_bind);
+    server_presentation_init(&server);
+    /*
+     * The event loop takes these through a signalfd, so no thread may leave them
+     * unblocked. Compositor and capture threads inherit this mask.
+     */
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    server.compositor = server_compositor_create((uint32_t) threads);
+    if (!server.compositor) {
+        fprintf(stderr, "Unable to create the compositor.\n");
+        return 1;
+    }
+    server_clock_init(&server, virtual_time);
+    for (int i = 0; i < mode_count; ++i) {
+        struct server_output *output = server_output_create(&server, modes[i].width, modes[i].height,
+                                                            modes[i].refresh_mhz);
+        if (!output) {
+            fprintf(stderr, "Unable to create the output.\n");
+            return 1;
+        }
+        if (i >= capture_count)
+            continue;
+        /* Virtual vblanks can wait for the writer, real ones drop instead */
+        output->capture = server_capture_create(captures[i], output->width, output->height, output->refresh_mhz,
+                                                (uint32_t) capture_every, (uint32_t) capture_slots, virtual_time);
+        if (!output->capture) {
+            fprintf(stderr, "Unable to capture to %s: %s\n", captures[i], strerror(errno));
+            return 1;
+        }
+    }
 
-    const char *socket = wl_display_add_socket_auto(display);
+    for (int i = 0; i < input_count; ++i) {
+        struct server_input *input = server_input_create(&server, inputs[i]);
+        if (!input) {
+            fprintf(stderr, "Invalid input generator %s\n", inputs[i]);
+            usage(argv[0]);
+            return 1;
+        }
+        server.seat.touch |= server_input_uses_touch(input);
+    }
+
+    const char *socket = wl_display_add_socket_auto(server.display);
     if (!socket) {
         fprintf(stderr, "Unable to add socket to Wayland display.\n");
         return 1;
     }
 
-    fprintf(stderr, "Running Wayland display on %s\n", socket);
-    wl_display_run(display);
+    struct wl_event_source *sigint = wl_event_loop_add_signal(server.loop, SIGINT, handle_signal,
+                                                              server.display);
+    struct wl_event_source *sigterm = wl_event_loop_add_signal(server.loop, SIGTERM, handle_signal,
+                                                               server.display);
+    struct wl_event_source *sigusr1 = NULL;
+    if (server.accounting)
+        sigusr1 = wl_event_loop_add_signal(server.loop, SIGUSR1, handle_dump, server.accounting);
+
+    fprintf(stderr, "Running Wayland display on %s%s, compositing with %s on %u threads\n", socket,
+            virtual_time ? " in virtual time" : "", server_compositor_kernel(server.compositor),
+            server_compositor_threads(server.compositor));
+    wl_display_run(server.display);
 
-    wl_display_destroy(display);
+    struct server_output *output, *tmp;
+    wl_list_for_each(output, &server.outputs, link) {
+        const struct server_scene *scene = &output->scene;
+        fprintf(stderr, "output %u %dx%d@%.3f: %llu vblanks, %llu composites", output->index,
+                output->width, output->height, output->refresh_mhz / 1000.0,
+                (unsigned long long) output->msc, (unsigned long long) scene->frames);
+        if (scene->frames)
+            fprintf(stderr, ", %.2f%% pixels touched, %.2f layers culled, %.1f us mean, %.1f us max",
+                    100.0 * scene->touched_pixels / scene->frame_pixels,
+                    (double) scene->culled_layers / scene->frames,
+                    scene->composite_ns / 1000.0 / scene->frames, scene->composite_max_ns / 1000.0);
+        fprintf(stderr, "\n");
+    }
+    server_inputs_destroy(&server);
+    wl_event_source_remove(sigint);
+    wl_event_source_remove(sigterm);
+    if (sigusr1)
+        wl_event_source_remove(sigusr1);
+    wl_display_destroy_clients(server.display);
+    if (server.accounting)
+        server_accounting_destroy(server.accounting);
+    server_clock_fini(&server);
+    wl_list_for_each_safe(output, tmp, &server.outputs, link) {
+        server_output_destroy(output);
+    }
+    server_compositor_destroy(server.compositor);
+    if (server.seat.keymap_fd >= 0)
+        close(server.seat.keymap_fd);
+    wl_display_destroy(server.display);
     return 0;
-}
\ No newline at end of file
+}
@@ -1,34 +1,407 @@
-#include <stdint.h>
-#include <stdio.h>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <wayland-client.h>
+#include "xdg-shell-client-protocol.h"
+
+/*
+ * Startup profiler
+ *
+ * Every run connects, lists the globals with a registry roundtrip, binds each
+ * global it knows followed by a roundtrip of its own, so the time includes the
+ * events the compositor sends on bind, then maps a toplevel: the first commit
+ * until the configure arrives, and the first buffer until the commit is
+ * through. With --exec the runs start another client instead and time from
+ * fork to its first wl_surface.commit with a buffer attached, as its
+ * WAYLAND_DEBUG log shows it.
+ */
+
+#define PROFILE_MAX_PHASES 48
+#define PROFILE_EXEC_TIMEOUT_MS 10000
+
+struct profile_phase {
+    char name[64];
+    uint64_t *samples;
+    uint32_t count;
+};
+
+struct profile {
+    struct profile_phase phases[PROFILE_MAX_PHASES];
+    uint32_t phase_count;
+    uint32_t runs;
+};
+
+struct profile_global {
+    uint32_t name;
+    char interface[64];
+    uint32_t version;
+};
+
+struct client_state {
+    struct wl_display *display;
+    struct wl_registry *registry;
+    struct profile_global globals[PROFILE_MAX_PHASES];
+    uint32_t global_count;
+    /* Everything bound, destroyed at the end of the run */
+    struct wl_proxy *bound[PROFILE_MAX_PHASES];
+    uint32_t bound_count;
+    bool print;
+    struct wl_compositor *compositor;
+    struct wl_shm *shm;
+    struct xdg_wm_base *xdg_wm_base;
+    bool configured;
+};
+
+static const struct wl_interface *known_interfaces[] = {
+        &wl_compositor_interface, &wl_subcompositor_interface, &wl_shm_interface, &wl_seat_interface,
+        &wl_output_interface, &wl_data_device_manager_interface, &xdg_wm_base_interface,
+};
+
+static uint64_t monotonic_ns() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void profile_add(struct profile *profile, const char *name, uint64_t ns) {
+    struct profile_phase *phase = NULL;
+    for (uint32_t i = 0; i < profile->phase_count; ++i) {
+        if (strcmp(profile->phases[i].name, name) == 0) {
+            phase = &profile->phases[i];
+            break;
+        }
+    }
+    if (!phase) {
+        if (profile->phase_count == PROFILE_MAX_PHASES)
+            return;
+        phase = &profile->phases[profile->phase_count++];
+        snprintf(phase->name, sizeof(phase->name), "%s", name);
+        phase->samples = static_cast<uint64_t *>(calloc(profile->runs, sizeof(uint64_t)));
+    }
+    if (phase->samples && phase->count < profile->runs)
+        phase->samples[phase->count++] = ns;
+}
+
+static double percentile_ms(const uint64_t *sorted, uint32_t count, double p) {
+    return sorted[(uint32_t) (p * (count - 1) + 0.5)] / 1e6;
+}
+
+static void profile_print(struct profile *profile) {
+    printf("%-32s %6s %9s %9s %9s %9s %9s\n", "phase", "runs", "min ms", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (uint32_t i = 0; i < profile->phase_count; ++i) {
+        struct profile_phase *phase = &profile->phases[i];
+        if (phase->count == 0)
+            continue;
+        std::sort(phase->samples, phase->samples + phase->count);
+        printf("%-32s %6u %9.3f %9.3f %9.3f %9.3f %9.3f\n", phase->name, phase->count, phase->samples[0] / 1e6,
+               percentile_ms(phase->samples, phase->count, 0.5), percentile_ms(phase->samples, phase->count, 0.9),
+               percentile_ms(phase->samples, phase->count, 0.99), phase->samples[phase->count - 1] / 1e6);
+        free(phase->samples);
+    }
+}
 
 static void
 registry_handle_global(void *data, struct wl_registry *registry,
         uint32_t name, const char *interface, uint32_t version)
-        {
-    printf("interface: '%s', version: %d, name: %d\n",
-           interface, version, name);
-        }
+{
+    struct client_state *state = static_cast<struct client_state *>(data);
+    if (state->print)
+        printf("interface: '%s', version: %d, name: %d\n", interface, version, name);
+    if (state->global_count < PROFILE_MAX_PHASES) {
+        struct profile_global *global = &state->globals[state->global_count++];
+        global->name = name;
+        global->version = version;
+        snprintf(global->interface, sizeof(global->interface), "%s", interface);
+    }
+}
 
-        static void
-        registry_handle_global_remove(void *data, struct wl_registry *registry,
-                uint32_t name)
-                {
+static void
+registry_handle_global_remove(void *data, struct wl_registry *registry,
+        uint32_t name)
+{
     // This space deliberately left blank
-                }
+}
 
-                static const struct wl_registry_listener
-                        registry_listener = {
+static const struct wl_registry_listener
+        registry_listener = {
         .global = registry_handle_global,
         .global_remove = registry_handle_global_remove,
-        };
+};
+
+static void xdg_wm_base_ping(void *data, struct xdg_wm_base *xdg_wm_base, uint32_t serial) {
+    xdg_wm_base_pong(xdg_wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener xdg_wm_base_listener = {
+        .ping = xdg_wm_base_ping,
+};
+
+static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface, uint32_t serial) {
+    xdg_surface_ack_configure(xdg_surface, serial);
+    static_cast<struct client_state *>(data)->configured = true;
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+        .configure = xdg_surface_configure,
+};
+
+static struct wl_buffer *create_buffer(struct wl_shm *shm, int32_t width, int32_t height) {
+    int fd = memfd_create("display_globals", MFD_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    int32_t size = width * height * 4;
+    if (ftruncate(fd, size) < 0) {
+        close(fd);
+        return NULL;
+    }
+    struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size);
+    struct wl_buffer *buffer = wl_shm_pool_create_buffer(pool, 0, width, height, width * 4, WL_SHM_FORMAT_XRGB8888);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+    return buffer;
+}
+
+/* One in-process startup, false if the compositor can't be reached */
+static bool profile_run(struct profile *profile, bool print) {
+    struct client_state state = {};
+    state.print = print;
+    uint64_t start = monotonic_ns();
+    state.display = wl_display_connect(NULL);
+    if (!state.display) {
+        fprintf(stderr, "Failed to connect to Wayland display.\n");
+        return false;
+    }
+    uint64_t connected = monotonic_ns();
+    profile_add(profile, "connect", connected - start);
+
+    state.registry = wl_display_get_registry(state.display);
+    wl_registry_add_listener(state.registry, &registry_listener, &state);
+    wl_display_roundtrip(state.display);
+    uint64_t listed = monotonic_ns();
+    profile_add(profile, "registry roundtrip", listed - connected);
+
+    char name[64];
+    for (uint32_t i = 0; i < state.global_count; ++i) {
+        const struct profile_global *global = &state.globals[i];
+        for (const struct wl_interface *interface : known_interfaces) {
+            if (strcmp(global->interface, interface->name) != 0)
+                continue;
+            uint32_t version = std::min(global->version, (uint32_t) interface->version);
+            uint64_t bind_start = monotonic_ns();
+            void *proxy = wl_registry_bind(state.registry, global->name, interface, version);
+            wl_display_roundtrip(state.display);
+            snprintf(name, sizeof(name), "bind %s", interface->name);
+            profile_add(profile, name, monotonic_ns() - bind_start);
+            state.bound[state.bound_count++] = static_cast<struct wl_proxy *>(proxy);
+
+            /* The first of each is kept for the toplevel */
+            if (interface == &wl_compositor_interface && !state.compositor)
+                state.compositor = static_cast<struct wl_compositor *>(proxy);
+            else if (interface == &wl_shm_interface && !state.shm)
+                state.shm = static_cast<struct wl_shm *>(proxy);
+            else if (interface == &xdg_wm_base_interface && !state.xdg_wm_base)
+                state.xdg_wm_base = static_cast<struct xdg_wm_base *>(proxy);
+        }
+    }
+    uint64_t bound = monotonic_ns();
+    profile_add(profile, "all binds", bound - listed);
+
+    if (state.compositor && state.shm && state.xdg_wm_base) {
+        xdg_wm_base_add_listener(state.xdg_wm_base, &xdg_wm_base_listener, &state);
+        struct wl_surface *surface = wl_compositor_create_surface(state.compositor);
+        struct xdg_surface *xdg_surface = xdg_wm_base_get_xdg_surface(state.xdg_wm_base, surface);
+        xdg_surface_add_listener(xdg_surface, &xdg_surface_listener, &state);
+        struct xdg_toplevel *toplevel = xdg_surface_get_toplevel(xdg_surface);
+        xdg_toplevel_set_title(toplevel, "display_globals");
+        uint64_t commit = monotonic_ns();
+        wl_surface_commit(surface);
+        while (!state.configured && wl_display_dispatch(state.display) >= 0) {
+        }
+        uint64_t configured = monotonic_ns();
+        profile_add(profile, "first configure", configured - commit);
+
+        struct wl_buffer *buffer = create_buffer(state.shm, 64, 64);
+        if (buffer) {
+            wl_surface_attach(surface, buffer, 0, 0);
+            wl_surface_damage_buffer(surface, 0, 0, INT32_MAX, INT32_MAX);
+            wl_surface_commit(surface);
+            wl_display_roundtrip(state.display);
+            profile_add(profile, "first buffer", monotonic_ns() - configured);
+            wl_buffer_destroy(buffer);
+        }
+        xdg_toplevel_destroy(toplevel);
+        xdg_surface_destroy(xdg_surface);
+        wl_surface_destroy(surface);
+    }
+    profile_add(profile, "total", monotonic_ns() - start);
+
+    /* Disconnecting does not free the proxies, --runs would leak a set per run */
+    for (uint32_t i = 0; i < state.bound_count; ++i)
+        wl_proxy_destroy(state.bound[i]);
+    wl_registry_destroy(state.registry);
+    wl_display_disconnect(state.display);
+    return true;
+}
+
+/*
+ * True for a "-> wl_surface@ID.NAME(" request in a WAYLAND_DEBUG line, with ID
+ * filled in. libwayland 1.22 prints wl_surface#ID and 1.23 adds the queue name
+ * before the arrow, so neither the separator nor the position is fixed.
+ */
+static bool debug_surface_request(const char *line, const char *request, unsigned *id) {
+    const char *arrow = strstr(line, "->");
+    if (!arrow)
+        return false;
+    const char *p = strstr(arrow, "wl_surface");
+    if (!p || (p[10] != '@' && p[10] != '#'))
+        return false;
+    char *end;
+    *id = (unsigned) strtoul(p + 11, &end, 10);
+    size_t length = strlen(request);
+    return end != p + 11 && *end == '.' && strncmp(end + 1, request, length) == 0 && end[1 + length] == '(';
+}
+
+/* Lines as the libwayland releases print them, checked before relying on the parser */
+static bool debug_surface_request_check() {
+    static const struct {
+        const char *line;
+        const char *request;
+        bool match;
+        unsigned id;
+    } cases[] = {
+            {"[1234567.890]  -> wl_surface@3.attach(wl_buffer@9, 0, 0)", "attach", true, 3},
+            {"[1234567.890]  -> wl_surface@3.commit()", "commit", true, 3},
+            {"[1234567.890]  -> wl_surface#12.attach(wl_buffer#9, 0, 0)", "attach", true, 12},
+            {"[1234567.890] {Default Queue}  -> wl_surface#12.commit()", "commit", true, 12},
+            {"[1234567.890] {Default Queue}  -> wl_surface#12.damage_buffer(0, 0, 64, 64)", "commit", false, 0},
+            {"[1234567.890] {Default Queue} wl_surface#12.enter(wl_output#5)", "enter", false, 0},
+            {"[1234567.890]  -> wl_compositor#4.create_surface(new id wl_surface#12)", "commit", false, 0},
+    };
+    for (const auto &c : cases) {
+        unsigned id = 0;
+        if (debug_surface_request(c.line, c.request, &id) != c.match || (c.match && id != c.id)) {
+            fprintf(stderr, "WAYLAND_DEBUG parser fails on \"%s\"\n", c.line);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Fork to the first wl_surface.commit with a buffer attached, 0 on failure */
+static uint64_t exec_run(char **argv) {
+    int pipe_fds[2];
+    if (pipe(pipe_fds) < 0)
+        return 0;
+    uint64_t start = monotonic_ns();
+    pid_t child = fork();
+    if (child < 0) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return 0;
+    }
+    if (child == 0) {
+        setenv("WAYLAND_DEBUG", "client", 1);
+        dup2(pipe_fds[1], STDERR_FILENO);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    close(pipe_fds[1]);
+
+    /* Surfaces with a buffer attached since their last commit */
+    unsigned attached[64];
+    uint32_t attached_count = 0;
+    uint64_t result = 0;
+    char buffer[8192];
+    size_t used = 0;
+    while (!result) {
+        struct pollfd fd = {pipe_fds[0], POLLIN, 0};
+        int64_t left_ms = PROFILE_EXEC_TIMEOUT_MS - (int64_t) ((monotonic_ns() - start) / 1000000);
+        if (left_ms <= 0 || poll(&fd, 1, (int) left_ms) <= 0)
+            break;
+        ssize_t n = read(pipe_fds[0], buffer + used, sizeof(buffer) - 1 - used);
+        if (n <= 0)
+            break;
+        uint64_t now = monotonic_ns();
+        used += (size_t) n;
+        buffer[used] = '\0';
+
+        char *line = buffer, *newline;
+        while (!result && (newline = strchr(line, '\n'))) {
+            *newline = '\0';
+            unsigned id;
+            if (debug_surface_request(line, "attach", &id) && !strstr(line, "(nil") && attached_count < 64) {
+                attached[attached_count++] = id;
+            } else if (debug_surface_request(line, "commit", &id)) {
+                for (uint32_t i = 0; i < attached_count; ++i) {
+                    if (attached[i] == id)
+                        result = now - start;
+                }
+            }
+            line = newline + 1;
+        }
+        /* Keep the partial line, drop an overlong one */
+        used = buffer + used - line;
+        memmove(buffer, line, used);
+        if (used == sizeof(buffer) - 1)
+            used = 0;
+    }
+    close(pipe_fds[0]);
+    kill(child, SIGTERM);
+    waitpid(child, NULL, 0);
+    return result;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--runs N] [--exec PROGRAM [ARGS...]]\n", name);
+    fprintf(stderr, "  --runs  repeat the startup N times and print percentiles (default 1)\n");
+    fprintf(stderr, "  --exec  time PROGRAM from fork to its first committed buffer instead\n");
+}
 
 int
 main(int argc, char *argv[])
 {
-    struct wl_display *display = wl_display_connect(NULL);
-    struct wl_registry *registry = wl_display_get_registry(display);
-    wl_registry_add_listener(registry, &registry_listener, NULL);
-    wl_display_roundtrip(display);
+    int runs = 1;
+    char **exec_argv = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc && (runs = atoi(argv[++i])) > 0)
+            continue;
+        if (strcmp(argv[i], "--exec") == 0 && i + 1 < argc) {
+            exec_argv = argv + i + 1;
+            break;
+        }
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (exec_argv && !debug_surface_request_check())
+        return 1;
+
+    struct profile profile = {};
+    profile.runs = (uint32_t) runs;
+    for (int run = 0; run < runs; ++run) {
+        if (exec_argv) {
+            uint64_t ns = exec_run(exec_argv);
+            if (!ns) {
+                fprintf(stderr, "%s did not commit a buffer within %d ms\n", exec_argv[0],
+                        PROFILE_EXEC_TIMEOUT_MS);
+                return 1;
+            }
+            profile_add(&profile, "first committed buffer", ns);
+        } else if (!profile_run(&profile, run == 0)) {
+            return 1;
+        }
+    }
+    profile_print(&profile);
     return 0;
-}
\ No newline at end of file
+}
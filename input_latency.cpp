@@ -0,0 +1,177 @@
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include "input_latency.h"
+
+static uint64_t clock_us(clockid_t clock_id) {
+    struct timespec ts{};
+    clock_gettime(clock_id, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void histogram_add(struct latency_histogram *histogram, uint64_t us) {
+    uint32_t bucket = 0;
+    while (bucket + 1 < LATENCY_HISTOGRAM_BUCKETS && (us >> (bucket + 1)) != 0)
+        ++bucket;
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    histogram->sum_us += us;
+    if (us > histogram->max_us)
+        histogram->max_us = us;
+}
+
+/* Upper bound of the bucket holding the given fraction of samples */
+static uint64_t histogram_percentile(const struct latency_histogram *histogram, double fraction) {
+    uint64_t target = (uint64_t) (histogram->count * fraction);
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; ++i) {
+        seen += histogram->buckets[i];
+        if (seen > target)
+            return (uint64_t) 2 << i;
+    }
+    return histogram->max_us;
+}
+
+static void histogram_print(const char *name, const struct latency_histogram *histogram) {
+    if (histogram->count == 0) {
+        fprintf(stderr, "%-20s no samples\n", name);
+        return;
+    }
+    fprintf(stderr, "%-20s n=%llu mean=%.1fus p50<%lluus p99<%lluus max=%lluus\n", name,
+            (unsigned long long) histogram->count,
+            (double) histogram->sum_us / histogram->count,
+            (unsigned long long) histogram_percentile(histogram, 0.5),
+            (unsigned long long) histogram_percentile(histogram, 0.99),
+            (unsigned long long) histogram->max_us);
+    for (uint32_t i = 0; i < LATENCY_HISTOGRAM_BUCKETS; ++i) {
+        if (histogram->buckets[i] == 0)
+            continue;
+        int width = (int) (histogram->buckets[i] * 50 / histogram->count);
+        fprintf(stderr, "  %8llu us | %-50.*s %llu\n", (unsigned long long) 1 << i, width,
+                "##################################################",
+                (unsigned long long) histogram->buckets[i]);
+    }
+}
+
+void input_latency_init(struct input_latency *latency) {
+    memset(latency, 0, sizeof(*latency));
+    latency->clock_id = CLOCK_MONOTONIC;
+}
+
+static void wp_presentation_clock_id(void *data, struct wp_presentation *wp_presentation,
+                                     uint32_t clk_id) {
+    struct input_latency *latency = static_cast<struct input_latency *>(data);
+    latency->clock_id = clk_id;
+}
+
+static const struct wp_presentation_listener wp_presentation_listener = {
+        .clock_id = wp_presentation_clock_id,
+};
+
+void input_latency_set_presentation(struct input_latency *latency,
+                                    struct wp_presentation *presentation) {
+    latency->presentation = presentation;
+    if (presentation)
+        wp_presentation_add_listener(presentation, &wp_presentation_listener, latency);
+}
+
+void input_latency_event(struct input_latency *latency, uint32_t time) {
+    uint64_t now = clock_us(latency->clock_id);
+
+    /* Event times are in milliseconds and wrap around every ~49 days */
+    uint32_t elapsed_ms = (uint32_t) (now / 1000) - time;
+    uint64_t event_us = 0;
+    if (elapsed_ms < 10000) {
+        uint64_t elapsed_us = (uint64_t) elapsed_ms * 1000 + now % 1000;
+        histogram_add(&latency->to_client, elapsed_us);
+        event_us = now - elapsed_us;
+    }
+
+    if (latency->pending == LATENCY_MAX_PENDING) {
+        latency->dropped++;
+        return;
+    }
+    latency->pending_us[latency->pending] = now;
+    latency->pending_event_us[latency->pending] = event_us;
+    latency->pending++;
+}
+
+static void feedback_release(struct latency_feedback *feedback) {
+    wp_presentation_feedback_destroy(feedback->feedback);
+    feedback->feedback = NULL;
+}
+
+static void wp_presentation_feedback_sync_output(void *data,
+                                                 struct wp_presentation_feedback *wp_presentation_feedback,
+                                                 struct wl_output *output) {
+    /* This space deliberately left blank */
+}
+
+static void wp_presentation_feedback_presented(void *data,
+                                               struct wp_presentation_feedback *wp_presentation_feedback,
+                                               uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+                                               uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo,
+                                               uint32_t flags) {
+    struct latency_feedback *feedback = static_cast<struct latency_feedback *>(data);
+    struct input_latency *latency = feedback->latency;
+    uint64_t present_us = ((((uint64_t) tv_sec_hi << 32) | tv_sec_lo) * 1000000) + tv_nsec / 1000;
+
+    if (present_us >= feedback->commit_us)
+        histogram_add(&latency->to_present, present_us - feedback->commit_us);
+    if (feedback->oldest_event_us != 0 && present_us >= feedback->oldest_event_us)
+        histogram_add(&latency->total, present_us - feedback->oldest_event_us);
+    feedback_release(feedback);
+}
+
+static void wp_presentation_feedback_discarded(void *data,
+                                               struct wp_presentation_feedback *wp_presentation_feedback) {
+    struct latency_feedback *feedback = static_cast<struct latency_feedback *>(data);
+    feedback_release(feedback);
+}
+
+static const struct wp_presentation_feedback_listener wp_presentation_feedback_listener = {
+        .sync_output = wp_presentation_feedback_sync_output,
+        .presented = wp_presentation_feedback_presented,
+        .discarded = wp_presentation_feedback_discarded,
+};
+
+void input_latency_commit(struct input_latency *latency, struct wl_surface *surface) {
+    uint64_t now = clock_us(latency->clock_id);
+
+    uint64_t oldest_event_us = 0;
+    for (uint32_t i = 0; i < latency->pending; ++i) {
+        histogram_add(&latency->processing, now - latency->pending_us[i]);
+        uint64_t event_us = latency->pending_event_us[i];
+        if (event_us != 0 && (oldest_event_us == 0 || event_us < oldest_event_us))
+            oldest_event_us = event_us;
+    }
+    latency->pending = 0;
+
+    if (!latency->presentation)
+        return;
+    for (uint32_t i = 0; i < LATENCY_MAX_FEEDBACK; ++i) {
+        struct latency_feedback *feedback = &latency->feedback[i];
+        if (feedback->feedback)
+            continue;
+        feedback->latency = latency;
+        feedback->commit_us = now;
+        feedback->oldest_event_us = oldest_event_us;
+        feedback->feedback = wp_presentation_feedback(latency->presentation, surface);
+        wp_presentation_feedback_add_listener(feedback->feedback,
+                                              &wp_presentation_feedback_listener, feedback);
+        return;
+    }
+    /* Every slot is waiting on the compositor, skip feedback for this commit */
+}
+
+void input_latency_report(const struct input_latency *latency) {
+    fprintf(stderr, "input latency (%s):\n",
+            latency->presentation ? "with presentation feedback" : "no wp_presentation");
+    histogram_print("compositor->client", &latency->to_client);
+    histogram_print("client processing", &latency->processing);
+    histogram_print("commit->present", &latency->to_present);
+    histogram_print("input->present", &latency->total);
+    if (latency->dropped)
+        fprintf(stderr, "%llu events not tracked, too many pending\n",
+                (unsigned long long) latency->dropped);
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <wayland-client.h>
+#include "presentation-time-client-protocol.h"
+
+/*
+ * Input-to-screen latency instrumentation
+ *
+ * Every input event is tagged with its compositor timestamp and the local
+ * time it was received. The next wl_surface_commit is taken to be the first
+ * one reflecting it, and when wp_presentation is bound that commit is
+ * followed up to the moment it reached the screen. Each stage feeds a log2
+ * histogram:
+ *
+ *   compositor->client  event timestamp to receipt (millisecond precision)
+ *   client processing   receipt to the commit reflecting the event
+ *   commit->present     commit to presentation feedback
+ *   input->present      event timestamp to presentation, oldest event only
+ *
+ * Event timestamps have an undefined base. Compositors use CLOCK_MONOTONIC in
+ * practice, so local times are taken from CLOCK_MONOTONIC, or from the clock
+ * announced by wp_presentation.
+ */
+
+#define LATENCY_HISTOGRAM_BUCKETS 24    /* Up to 2^24 us, about 16 s */
+#define LATENCY_MAX_PENDING 256
+#define LATENCY_MAX_FEEDBACK 16
+
+struct latency_histogram {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+    uint64_t buckets[LATENCY_HISTOGRAM_BUCKETS];
+};
+
+struct latency_feedback {
+    struct input_latency *latency;
+    struct wp_presentation_feedback *feedback;
+    uint64_t commit_us;
+    uint64_t oldest_event_us;
+};
+
+struct input_latency {
+    struct wp_presentation *presentation;
+    uint32_t clock_id;
+    /* Events not yet reflected by a commit, event time is 0 if unknown */
+    uint64_t pending_us[LATENCY_MAX_PENDING];
+    uint64_t pending_event_us[LATENCY_MAX_PENDING];
+    uint32_t pending;
+    uint64_t dropped;
+    struct latency_feedback feedback[LATENCY_MAX_FEEDBACK];
+    struct latency_histogram to_client;
+    struct latency_histogram processing;
+    struct latency_histogram to_present;
+    struct latency_histogram total;
+};
+
+void input_latency_init(struct input_latency *latency);
+/* Binds presentation feedback, `presentation` may be NULL */
+void input_latency_set_presentation(struct input_latency *latency,
+                                    struct wp_presentation *presentation);
+/* Call from each input listener with the event's timestamp */
+void input_latency_event(struct input_latency *latency, uint32_t time);
+/* Call right before the wl_surface_commit that presents new content */
+void input_latency_commit(struct input_latency *latency, struct wl_surface *surface);
+void input_latency_report(const struct input_latency *latency);
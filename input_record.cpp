@@ -0,0 +1,526 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "input_record.h"
+
+/* Event opcodes, in protocol order */
+enum {
+    POINTER_ENTER, POINTER_LEAVE, POINTER_MOTION, POINTER_BUTTON, POINTER_AXIS,
+    POINTER_FRAME, POINTER_AXIS_SOURCE, POINTER_AXIS_STOP, POINTER_AXIS_DISCRETE,
+};
+enum {
+    KEYBOARD_KEYMAP, KEYBOARD_ENTER, KEYBOARD_LEAVE, KEYBOARD_KEY,
+    KEYBOARD_MODIFIERS, KEYBOARD_REPEAT_INFO,
+};
+enum {
+    TOUCH_DOWN, TOUCH_UP, TOUCH_MOTION, TOUCH_FRAME, TOUCH_CANCEL,
+    TOUCH_SHAPE, TOUCH_ORIENTATION,
+};
+
+#define INPUT_RECORD_MAX_ARGS (UINT16_MAX / sizeof(uint32_t))
+#define INPUT_REPLAY_BATCH 256
+
+static uint64_t monotonic_us() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Recording */
+struct input_recorder {
+    FILE *file;
+    const char *path;
+    struct input_listeners target;
+    uint64_t last_us;
+    uint64_t records;
+};
+
+static void record_event(struct input_recorder *recorder, uint8_t interface,
+                         uint8_t opcode, const uint32_t *args, size_t count) {
+    uint64_t now = monotonic_us();
+    struct input_record_header header{};
+    header.interface = interface;
+    header.opcode = opcode;
+    header.size = count * sizeof(uint32_t);
+    header.delta_us = recorder->last_us != 0 ? now - recorder->last_us : 0;
+    recorder->last_us = now;
+
+    fwrite(&header, sizeof(header), 1, recorder->file);
+    if (count > 0)
+        fwrite(args, sizeof(uint32_t), count, recorder->file);
+    recorder->records++;
+}
+
+#define FORWARD(device, event, ...)                                                  \
+    if (recorder->target.device && recorder->target.device->event)                 \
+        recorder->target.device->event(recorder->target.data, __VA_ARGS__)
+
+static void record_pointer_enter(void *data, struct wl_pointer *wl_pointer,
+                                 uint32_t serial, struct wl_surface *surface,
+                                 wl_fixed_t surface_x, wl_fixed_t surface_y) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {serial, (uint32_t) surface_x, (uint32_t) surface_y};
+    record_event(recorder, INPUT_RECORD_POINTER, POINTER_ENTER, args, 3);
+    FORWARD(pointer, enter, wl_pointer, serial, surface, surface_x, surface_y);
+}
+
+static void record_pointer_leave(void *data, struct wl_pointer *wl_pointer,
+                                 uint32_t serial, struct wl_surface *surface) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {serial};
+    record_event(recorder, INPUT_RECORD_POINTER, POINTER_LEAVE, args, 1);
+    FORWARD(pointer, leave, wl_pointer, serial, surface);
+}
+
+static void record_pointer_motion(void *data, struct wl_pointer *wl_pointer, uint32_t time,
+                                  wl_fixed_t surface_x, wl_fixed_t surface_y) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {time, (uint32_t) surface_x, (uint32_t) surface_y};
+    record_event(recorder, INPUT_RECORD_POINTER, POINTER_MOTION, args, 3);
+    FORWARD(pointer, motion, wl_pointer, time, surface_x, surface_y);
+}
+
+static void record_pointer_button(void *data, struct wl_pointer *wl_pointer, uint32_t serial,
+                                  uint32_t time, uint32_t button, uint32_t state) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {serial, time, button, state};
+    record_event(recorder, INPUT_RECORD_POINTER, POINTER_BUTTON, args, 4);
+    FORWARD(pointer, button, wl_pointer, serial, time, button, state);
+}
+
+static void record_pointer_axis(void *data, struct wl_pointer *wl_pointer, uint32_t time,
+                                uint32_t axis, wl_fixed_t value) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {time, axis, (uint32_t) value};
+    record_event(recorder, INPUT_RECORD_POINTER, POINTER_AXIS, args, 3);
+    FORWARD(pointer, axis, wl_pointer, time, axis, value);
+}
+
+static void record_pointer_frame(void *data, struct wl_pointer *wl_pointer) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    record_event(recorder, INPUT_RECORD_POINTER, POINTER_FRAME, NULL, 0);
+    FORWARD(pointer, frame, wl_pointer);
+}
+
+static void record_pointer_axis_source(void *data, struct wl_pointer *wl_pointer,
+                                       uint32_t axis_source) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {axis_source};
+    record_event(recorder, INPUT_RECORD_POINTER, POINTER_AXIS_SOURCE, args, 1);
+    FORWARD(pointer, axis_source, wl_pointer, axis_source);
+}
+
+static void record_pointer_axis_stop(void *data, struct wl_pointer *wl_pointer,
+                                     uint32_t time, uint32_t axis) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {time, axis};
+    record_event(recorder, INPUT_RECORD_POINTER, POINTER_AXIS_STOP, args, 2);
+    FORWARD(pointer, axis_stop, wl_pointer, time, axis);
+}
+
+static void record_pointer_axis_discrete(void *data, struct wl_pointer *wl_pointer,
+                                         uint32_t axis, int32_t discrete) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {axis, (uint32_t) discrete};
+    record_event(recorder, INPUT_RECORD_POINTER, POINTER_AXIS_DISCRETE, args, 2);
+    FORWARD(pointer, axis_discrete, wl_pointer, axis, discrete);
+}
+
+static const struct wl_pointer_listener record_pointer_listener = {
+        .enter = record_pointer_enter,
+        .leave = record_pointer_leave,
+        .motion = record_pointer_motion,
+        .button = record_pointer_button,
+        .axis = record_pointer_axis,
+        .frame = record_pointer_frame,
+        .axis_source = record_pointer_axis_source,
+        .axis_stop = record_pointer_axis_stop,
+        .axis_discrete = record_pointer_axis_discrete,
+};
+
+static void record_keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard,
+                                   uint32_t format, int32_t fd, uint32_t size) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    /* The keymap text is stored right after its record */
+    uint32_t args[] = {format, size};
+    record_event(recorder, INPUT_RECORD_KEYBOARD, KEYBOARD_KEYMAP, args, 2);
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+        fwrite(map, 1, size, recorder->file);
+        munmap(map, size);
+    } else {
+        /* Keep the file parseable even without the keymap contents */
+        for (uint32_t i = 0; i < size; ++i)
+            fputc(0, recorder->file);
+    }
+    FORWARD(keyboard, keymap, wl_keyboard, format, fd, size);
+}
+
+static void record_keyboard_enter(void *data, struct wl_keyboard *wl_keyboard,
+                                  uint32_t serial, struct wl_surface *surface,
+                                  struct wl_array *keys) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[INPUT_RECORD_MAX_ARGS];
+    size_t count = 0;
+    args[count++] = serial;
+    args[count++] = 0;
+    uint32_t *key;
+    wl_array_for_each(key, keys) {
+        if (count == INPUT_RECORD_MAX_ARGS)
+            break;
+        args[count++] = *key;
+    }
+    args[1] = count - 2;
+    record_event(recorder, INPUT_RECORD_KEYBOARD, KEYBOARD_ENTER, args, count);
+    FORWARD(keyboard, enter, wl_keyboard, serial, surface, keys);
+}
+
+static void record_keyboard_leave(void *data, struct wl_keyboard *wl_keyboard,
+                                  uint32_t serial, struct wl_surface *surface) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {serial};
+    record_event(recorder, INPUT_RECORD_KEYBOARD, KEYBOARD_LEAVE, args, 1);
+    FORWARD(keyboard, leave, wl_keyboard, serial, surface);
+}
+
+static void record_keyboard_key(void *data, struct wl_keyboard *wl_keyboard,
+                                uint32_t serial, uint32_t time, uint32_t key, uint32_t state) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {serial, time, key, state};
+    record_event(recorder, INPUT_RECORD_KEYBOARD, KEYBOARD_KEY, args, 4);
+    FORWARD(keyboard, key, wl_keyboard, serial, time, key, state);
+}
+
+static void record_keyboard_modifiers(void *data, struct wl_keyboard *wl_keyboard,
+                                      uint32_t serial, uint32_t mods_depressed,
+                                      uint32_t mods_latched, uint32_t mods_locked,
+                                      uint32_t group) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {serial, mods_depressed, mods_latched, mods_locked, group};
+    record_event(recorder, INPUT_RECORD_KEYBOARD, KEYBOARD_MODIFIERS, args, 5);
+    FORWARD(keyboard, modifiers, wl_keyboard, serial,
+            mods_depressed, mods_latched, mods_locked, group);
+}
+
+static void record_keyboard_repeat_info(void *data, struct wl_keyboard *wl_keyboard,
+                                        int32_t rate, int32_t delay) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {(uint32_t) rate, (uint32_t) delay};
+    record_event(recorder, INPUT_RECORD_KEYBOARD, KEYBOARD_REPEAT_INFO, args, 2);
+    FORWARD(keyboard, repeat_info, wl_keyboard, rate, delay);
+}
+
+static const struct wl_keyboard_listener record_keyboard_listener = {
+        .keymap = record_keyboard_keymap,
+        .enter = record_keyboard_enter,
+        .leave = record_keyboard_leave,
+        .key = record_keyboard_key,
+        .modifiers = record_keyboard_modifiers,
+        .repeat_info = record_keyboard_repeat_info,
+};
+
+static void record_touch_down(void *data, struct wl_touch *wl_touch, uint32_t serial,
+                              uint32_t time, struct wl_surface *surface, int32_t id,
+                              wl_fixed_t x, wl_fixed_t y) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {serial, time, (uint32_t) id, (uint32_t) x, (uint32_t) y};
+    record_event(recorder, INPUT_RECORD_TOUCH, TOUCH_DOWN, args, 5);
+    FORWARD(touch, down, wl_touch, serial, time, surface, id, x, y);
+}
+
+static void record_touch_up(void *data, struct wl_touch *wl_touch, uint32_t serial,
+                            uint32_t time, int32_t id) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {serial, time, (uint32_t) id};
+    record_event(recorder, INPUT_RECORD_TOUCH, TOUCH_UP, args, 3);
+    FORWARD(touch, up, wl_touch, serial, time, id);
+}
+
+static void record_touch_motion(void *data, struct wl_touch *wl_touch, uint32_t time,
+                                int32_t id, wl_fixed_t x, wl_fixed_t y) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {time, (uint32_t) id, (uint32_t) x, (uint32_t) y};
+    record_event(recorder, INPUT_RECORD_TOUCH, TOUCH_MOTION, args, 4);
+    FORWARD(touch, motion, wl_touch, time, id, x, y);
+}
+
+static void record_touch_frame(void *data, struct wl_touch *wl_touch) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    record_event(recorder, INPUT_RECORD_TOUCH, TOUCH_FRAME, NULL, 0);
+    FORWARD(touch, frame, wl_touch);
+}
+
+static void record_touch_cancel(void *data, struct wl_touch *wl_touch) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    record_event(recorder, INPUT_RECORD_TOUCH, TOUCH_CANCEL, NULL, 0);
+    FORWARD(touch, cancel, wl_touch);
+}
+
+static void record_touch_shape(void *data, struct wl_touch *wl_touch,
+                               int32_t id, wl_fixed_t major, wl_fixed_t minor) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {(uint32_t) id, (uint32_t) major, (uint32_t) minor};
+    record_event(recorder, INPUT_RECORD_TOUCH, TOUCH_SHAPE, args, 3);
+    FORWARD(touch, shape, wl_touch, id, major, minor);
+}
+
+static void record_touch_orientation(void *data, struct wl_touch *wl_touch,
+                                     int32_t id, wl_fixed_t orientation) {
+    struct input_recorder *recorder = static_cast<struct input_recorder *>(data);
+    uint32_t args[] = {(uint32_t) id, (uint32_t) orientation};
+    record_event(recorder, INPUT_RECORD_TOUCH, TOUCH_ORIENTATION, args, 2);
+    FORWARD(touch, orientation, wl_touch, id, orientation);
+}
+
+static const struct wl_touch_listener record_touch_listener = {
+        .down = record_touch_down,
+        .up = record_touch_up,
+        .motion = record_touch_motion,
+        .frame = record_touch_frame,
+        .cancel = record_touch_cancel,
+        .shape = record_touch_shape,
+        .orientation = record_touch_orientation,
+};
+
+#undef FORWARD
+
+struct input_recorder *input_recorder_create(const char *path,
+                                             const struct input_listeners *target) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Unable to open %s for recording: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    uint32_t version = INPUT_RECORD_VERSION;
+    fwrite(input_record_magic, sizeof(input_record_magic), 1, file);
+    fwrite(&version, sizeof(version), 1, file);
+
+    struct input_recorder *recorder =
+            static_cast<struct input_recorder *>(calloc(1, sizeof(*recorder)));
+    recorder->file = file;
+    recorder->path = path;
+    recorder->target = *target;
+    return recorder;
+}
+
+void input_recorder_destroy(struct input_recorder *recorder) {
+    fclose(recorder->file);
+    fprintf(stderr, "recorded %llu events to %s\n",
+            (unsigned long long) recorder->records, recorder->path);
+    free(recorder);
+}
+
+void input_recorder_add_pointer_listener(struct input_recorder *recorder,
+                                         struct wl_pointer *wl_pointer) {
+    wl_pointer_add_listener(wl_pointer, &record_pointer_listener, recorder);
+}
+
+void input_recorder_add_keyboard_listener(struct input_recorder *recorder,
+                                          struct wl_keyboard *wl_keyboard) {
+    wl_keyboard_add_listener(wl_keyboard, &record_keyboard_listener, recorder);
+}
+
+void input_recorder_add_touch_listener(struct input_recorder *recorder,
+                                       struct wl_touch *wl_touch) {
+    wl_touch_add_listener(wl_touch, &record_touch_listener, recorder);
+}
+
+/* Replay */
+struct input_replay {
+    struct input_listeners target;
+    struct wl_surface *surface;
+    bool realtime;
+    /* The whole recording, so replay never touches the disk */
+    uint8_t *data;
+    size_t size;
+    size_t offset;
+    /* Recorded time of the last delivered event, and when replay started */
+    uint64_t clock_us;
+    uint64_t start_us;
+    uint64_t events;
+    uint32_t args[INPUT_RECORD_MAX_ARGS];
+};
+
+struct input_replay *input_replay_create(const char *path,
+                                         const struct input_listeners *target,
+                                         struct wl_surface *surface, bool realtime) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Unable to open %s for replay: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *data = static_cast<uint8_t *>(malloc(size > 0 ? size : 1));
+    uint32_t version = 0;
+    if (size < 8 || fread(data, 1, size, file) != (size_t) size
+            || memcmp(data, input_record_magic, sizeof(input_record_magic)) != 0
+            || (memcpy(&version, data + 4, sizeof(version)), version) != INPUT_RECORD_VERSION) {
+        fprintf(stderr, "%s is not an input recording\n", path);
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    struct input_replay *replay =
+            static_cast<struct input_replay *>(calloc(1, sizeof(*replay)));
+    replay->target = *target;
+    replay->surface = surface;
+    replay->realtime = realtime;
+    replay->data = data;
+    replay->size = size;
+    replay->offset = 8;
+    return replay;
+}
+
+void input_replay_destroy(struct input_replay *replay) {
+    double elapsed = (monotonic_us() - replay->start_us) / 1000.0;
+    if (replay->start_us == 0)
+        elapsed = 0;
+    fprintf(stderr, "replayed %llu events in %.3f ms (%.0f events/s)\n",
+            (unsigned long long) replay->events, elapsed,
+            elapsed > 0 ? replay->events * 1000.0 / elapsed : 0.0);
+    free(replay->data);
+    free(replay);
+}
+
+static bool replay_peek(struct input_replay *replay, struct input_record_header *header) {
+    if (replay->offset + sizeof(*header) > replay->size)
+        return false;
+    memcpy(header, replay->data + replay->offset, sizeof(*header));
+    /* Payload is whole words that must fit into input_replay.args */
+    if (header->size > sizeof(replay->args) || header->size % sizeof(uint32_t) != 0)
+        return false;
+    return replay->offset + sizeof(*header) + header->size <= replay->size;
+}
+
+int input_replay_timeout(struct input_replay *replay) {
+    struct input_record_header header;
+    if (!replay_peek(replay, &header))
+        return -1;
+    if (!replay->realtime || replay->start_us == 0)
+        return 0;
+    uint64_t due = replay->start_us + replay->clock_us + header.delta_us;
+    uint64_t now = monotonic_us();
+    return due > now ? (int) ((due - now + 999) / 1000) : 0;
+}
+
+static int replay_keymap_fd(const uint8_t *keymap, uint32_t size) {
+    int fd = memfd_create("input-replay-keymap", MFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (write(fd, keymap, size) != (ssize_t) size) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+#define REPLAY(device, event, ...)                                                   \
+    if (replay->target.device && replay->target.device->event)                     \
+        replay->target.device->event(replay->target.data, __VA_ARGS__)
+
+static void replay_event(struct input_replay *replay, const struct input_record_header *header,
+                         const uint32_t *a, const uint8_t *extra) {
+    struct wl_pointer *wl_pointer = NULL;
+    struct wl_keyboard *wl_keyboard = NULL;
+    struct wl_touch *wl_touch = NULL;
+    struct wl_surface *surface = replay->surface;
+
+    switch (header->interface) {
+    case INPUT_RECORD_POINTER:
+        switch (header->opcode) {
+        case POINTER_ENTER: REPLAY(pointer, enter, wl_pointer, a[0], surface, a[1], a[2]); break;
+        case POINTER_LEAVE: REPLAY(pointer, leave, wl_pointer, a[0], surface); break;
+        case POINTER_MOTION: REPLAY(pointer, motion, wl_pointer, a[0], a[1], a[2]); break;
+        case POINTER_BUTTON: REPLAY(pointer, button, wl_pointer, a[0], a[1], a[2], a[3]); break;
+        case POINTER_AXIS: REPLAY(pointer, axis, wl_pointer, a[0], a[1], a[2]); break;
+        case POINTER_FRAME: REPLAY(pointer, frame, wl_pointer); break;
+        case POINTER_AXIS_SOURCE: REPLAY(pointer, axis_source, wl_pointer, a[0]); break;
+        case POINTER_AXIS_STOP: REPLAY(pointer, axis_stop, wl_pointer, a[0], a[1]); break;
+        case POINTER_AXIS_DISCRETE: REPLAY(pointer, axis_discrete, wl_pointer, a[0], a[1]); break;
+        }
+        break;
+    case INPUT_RECORD_KEYBOARD:
+        switch (header->opcode) {
+        case KEYBOARD_KEYMAP: {
+            int fd = replay_keymap_fd(extra, a[1]);
+            if (fd >= 0 && replay->target.keyboard && replay->target.keyboard->keymap)
+                replay->target.keyboard->keymap(replay->target.data, wl_keyboard, a[0], fd, a[1]);
+            else if (fd >= 0)
+                close(fd);
+            break;
+        }
+        case KEYBOARD_ENTER: {
+            /* Serial and key count followed by the keys, all within the record */
+            if (2 * sizeof(uint32_t) + (uint64_t) a[1] * sizeof(uint32_t) > header->size)
+                break;
+            struct wl_array keys;
+            keys.size = keys.alloc = a[1] * sizeof(uint32_t);
+            keys.data = const_cast<uint32_t *>(&a[2]);
+            REPLAY(keyboard, enter, wl_keyboard, a[0], surface, &keys);
+            break;
+        }
+        case KEYBOARD_LEAVE: REPLAY(keyboard, leave, wl_keyboard, a[0], surface); break;
+        case KEYBOARD_KEY: REPLAY(keyboard, key, wl_keyboard, a[0], a[1], a[2], a[3]); break;
+        case KEYBOARD_MODIFIERS: REPLAY(keyboard, modifiers, wl_keyboard, a[0], a[1], a[2], a[3], a[4]); break;
+        case KEYBOARD_REPEAT_INFO: REPLAY(keyboard, repeat_info, wl_keyboard, a[0], a[1]); break;
+        }
+        break;
+    case INPUT_RECORD_TOUCH:
+        switch (header->opcode) {
+        case TOUCH_DOWN: REPLAY(touch, down, wl_touch, a[0], a[1], surface, a[2], a[3], a[4]); break;
+        case TOUCH_UP: REPLAY(touch, up, wl_touch, a[0], a[1], a[2]); break;
+        case TOUCH_MOTION: REPLAY(touch, motion, wl_touch, a[0], a[1], a[2], a[3]); break;
+        case TOUCH_FRAME: REPLAY(touch, frame, wl_touch); break;
+        case TOUCH_CANCEL: REPLAY(touch, cancel, wl_touch); break;
+        case TOUCH_SHAPE: REPLAY(touch, shape, wl_touch, a[0], a[1], a[2]); break;
+        case TOUCH_ORIENTATION: REPLAY(touch, orientation, wl_touch, a[0], a[1]); break;
+        }
+        break;
+    }
+}
+
+#undef REPLAY
+
+bool input_replay_dispatch(struct input_replay *replay) {
+    if (replay->start_us == 0)
+        replay->start_us = monotonic_us();
+
+    struct input_record_header header;
+    for (int batch = 0; replay_peek(replay, &header); ++batch) {
+        if (replay->realtime) {
+            uint64_t due = replay->start_us + replay->clock_us + header.delta_us;
+            if (due > monotonic_us())
+                break;
+        } else if (batch == INPUT_REPLAY_BATCH) {
+            break;
+        }
+
+        const uint8_t *payload = replay->data + replay->offset + sizeof(header);
+        const uint8_t *extra = payload + header.size;
+        memset(replay->args, 0, 8 * sizeof(uint32_t));
+        memcpy(replay->args, payload, header.size);
+        replay->offset += sizeof(header) + header.size;
+        if (header.interface == INPUT_RECORD_KEYBOARD && header.opcode == KEYBOARD_KEYMAP) {
+            if (replay->offset + replay->args[1] > replay->size) {
+                replay->offset = replay->size;
+                break;
+            }
+            replay->offset += replay->args[1];
+        }
+
+        replay->clock_us += header.delta_us;
+        replay_event(replay, &header, replay->args, extra);
+        replay->events++;
+    }
+    return replay_peek(replay, &header);
+}
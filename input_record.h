@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <wayland-client.h>
+#include "input_record_format.h"
+
+/*
+ * Seat event recording and replay
+ *
+ * A recorder sits between a wl_pointer/wl_keyboard/wl_touch and the sample's
+ * own listeners: every event is appended to a file and then forwarded
+ * unchanged. A replayer reads such a file back and calls the very same
+ * listener functions, either paced by the recorded arrival times or as fast
+ * as possible, so input-heavy runs can be repeated without a human. The file
+ * format is described in input_record_format.h.
+ */
+
+/* The listeners events are forwarded to (recording) or replayed into */
+struct input_listeners {
+    const struct wl_pointer_listener *pointer;
+    const struct wl_keyboard_listener *keyboard;
+    const struct wl_touch_listener *touch;
+    void *data;
+};
+
+struct input_recorder;
+struct input_replay;
+
+struct input_recorder *input_recorder_create(const char *path,
+                                             const struct input_listeners *target);
+void input_recorder_destroy(struct input_recorder *recorder);
+void input_recorder_add_pointer_listener(struct input_recorder *recorder,
+                                         struct wl_pointer *wl_pointer);
+void input_recorder_add_keyboard_listener(struct input_recorder *recorder,
+                                          struct wl_keyboard *wl_keyboard);
+void input_recorder_add_touch_listener(struct input_recorder *recorder,
+                                       struct wl_touch *wl_touch);
+
+/*
+ * `surface` is passed wherever an event carries a wl_surface. With
+ * `realtime` unset, events are replayed back to back in batches.
+ */
+struct input_replay *input_replay_create(const char *path,
+                                         const struct input_listeners *target,
+                                         struct wl_surface *surface, bool realtime);
+void input_replay_destroy(struct input_replay *replay);
+/* Milliseconds until the next event is due, or -1 once the replay is over */
+int input_replay_timeout(struct input_replay *replay);
+/* Delivers every due event, returns false once the replay is over */
+bool input_replay_dispatch(struct input_replay *replay);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Seat event recording file format, shared by input_record.cpp and the
+ * headless server's synthetic seat
+ *
+ * File layout: the magic "WLIR", a uint32_t version, then one record per
+ * event. Each record is an input_record_header followed by `size` bytes of
+ * uint32_t arguments in protocol order. Object arguments are not stored,
+ * wl_array arguments are stored as a count followed by the elements, and the
+ * keymap record is followed by the keymap text itself.
+ */
+
+#define INPUT_RECORD_VERSION 1
+
+enum input_record_interface {
+    INPUT_RECORD_POINTER = 0,
+    INPUT_RECORD_KEYBOARD = 1,
+    INPUT_RECORD_TOUCH = 2,
+};
+
+struct input_record_header {
+    uint8_t interface;          /* enum input_record_interface */
+    uint8_t opcode;             /* Event opcode within the interface */
+    uint16_t size;              /* Argument bytes that follow */
+    uint32_t delta_us;          /* Arrival time since the previous record */
+};
+
+static const char input_record_magic[4] = {'W', 'L', 'I', 'R'};
@@ -7,8 +7,16 @@
 #include <unistd.h>
 #include <wayland-client.h>
 #include <cstdio>
+#include <csignal>
+#include <poll.h>
 #include <xkbcommon/xkbcommon.h>
+#include <atomic>
+#include <linux/input-event-codes.h>
 #include "xdg-shell-client-protocol.h"
+#include "input_record.h"
+#include "input_latency.h"
+#include "pointer_cursor.h"
+#include "clipboard.h"
 
 /* Shared memory support code */
 static void randname(char *buf) {
@@ -76,6 +84,83 @@ struct pointer_event {
     uint32_t axis_source;
 };
 
+/* Pollable input state */
+struct input_snapshot {
+    uint64_t keys[4];           /* One bit per evdev keycode 0..255 */
+    uint32_t buttons;           /* One bit per (button - BTN_MOUSE) */
+    wl_fixed_t pointer_x, pointer_y;
+    uint32_t mods_depressed, mods_latched, mods_locked, group;
+};
+
+#define INPUT_SNAPSHOT_WORDS (sizeof(struct input_snapshot) / sizeof(uint32_t))
+
+/*
+ * The dispatch thread edits `pending` and publishes it under a seqlock, so
+ * any other thread can poll a consistent copy without taking a lock.
+ */
+struct input_state {
+    struct input_snapshot pending;
+    std::atomic<uint32_t> seq;
+    std::atomic<uint32_t> published[INPUT_SNAPSHOT_WORDS];
+};
+
+static void input_state_publish(struct input_state *input) {
+    uint32_t words[INPUT_SNAPSHOT_WORDS];
+    memcpy(words, &input->pending, sizeof(words));
+
+    uint32_t seq = input->seq.load(std::memory_order_relaxed);
+    input->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < INPUT_SNAPSHOT_WORDS; ++i) {
+        input->published[i].store(words[i], std::memory_order_relaxed);
+    }
+    input->seq.store(seq + 2, std::memory_order_release);
+}
+
+static void input_state_read(const struct input_state *input,
+                             struct input_snapshot *snapshot) {
+    uint32_t words[INPUT_SNAPSHOT_WORDS];
+    uint32_t begin, end;
+    do {
+        begin = input->seq.load(std::memory_order_acquire);
+        for (size_t i = 0; i < INPUT_SNAPSHOT_WORDS; ++i) {
+            words[i] = input->published[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        end = input->seq.load(std::memory_order_relaxed);
+    } while ((begin & 1) || begin != end);
+    memcpy(snapshot, words, sizeof(words));
+}
+
+static void input_snapshot_set_key(struct input_snapshot *snapshot,
+                                   uint32_t key, bool down) {
+    if (key >= 256)
+        return;
+    uint64_t bit = UINT64_C(1) << (key % 64);
+    if (down)
+        snapshot->keys[key / 64] |= bit;
+    else
+        snapshot->keys[key / 64] &= ~bit;
+}
+
+static bool input_snapshot_key_down(const struct input_snapshot *snapshot,
+                                    uint32_t key) {
+    if (key >= 256)
+        return false;
+    return snapshot->keys[key / 64] & (UINT64_C(1) << (key % 64));
+}
+
+static void input_snapshot_set_button(struct input_snapshot *snapshot,
+                                      uint32_t button, bool down) {
+    if (button < BTN_MOUSE || button >= BTN_MOUSE + 32)
+        return;
+    uint32_t bit = 1u << (button - BTN_MOUSE);
+    if (down)
+        snapshot->buttons |= bit;
+    else
+        snapshot->buttons &= ~bit;
+}
+
 /* Wayland code */
 struct client_state {
     /* Globals */
@@ -85,6 +170,10 @@ struct client_state {
     struct wl_compositor *wl_compositor;
     struct xdg_wm_base *xdg_wm_base;
     struct wl_seat *wl_seat;
+    struct wp_presentation *wp_presentation;
+    struct wp_cursor_shape_manager_v1 *cursor_shape_manager;
+    struct wl_data_device_manager *wl_data_device_manager;
+    struct zwp_primary_selection_device_manager_v1 *primary_selection_manager;
     /* Objects */
     struct wl_surface *wl_surface;
     struct xdg_surface *xdg_surface;
@@ -92,11 +181,20 @@ struct client_state {
     struct wl_keyboard *wl_keyboard;
     struct wl_pointer *wl_pointer;
     struct wl_touch *wl_touch;
+    struct input_recorder *recorder;
+    struct pointer_cursor *cursor;
+    struct clipboard *clipboard;
     /* State */
     float offset;
     uint32_t last_frame;
+    bool replaying;
+    /* Ctrl+C offers this file, Ctrl+V pastes into this one */
+    const char *copy_path;
+    const char *paste_path;
 
     struct pointer_event pointer_event;
+    struct input_latency latency;
+    struct input_state input;
     struct xkb_state *xkb_state;
     struct xkb_context *xkb_context;
     struct xkb_keymap *xkb_keymap;
@@ -166,6 +264,7 @@ static void xdg_surface_configure(void *data,
 
     struct wl_buffer *buffer = draw_frame(state);
     wl_surface_attach(state->wl_surface, buffer, 0, 0);
+    input_latency_commit(&state->latency, state->wl_surface);
     wl_surface_commit(state->wl_surface);
 }
 
@@ -192,16 +291,22 @@ wl_surface_frame_done(void *data, struct wl_callback *cb, uint32_t time) {
     cb = wl_surface_frame(state->wl_surface);
     wl_callback_add_listener(cb, &wl_surface_frame_listener, state);
 
-    /* Update scroll amount at 24 pixels per second */
+    /* Poll the input state once per frame */
+    struct input_snapshot input;
+    input_state_read(&state->input, &input);
+
+    /* Update scroll amount at 24 pixels per second, faster while W is held */
     if (state->last_frame != 0) {
         int elapsed = time - state->last_frame;
-        state->offset += elapsed / 1000.0 * 24;
+        int speed = input_snapshot_key_down(&input, KEY_W) ? 96 : 24;
+        state->offset += elapsed / 1000.0 * speed;
     }
 
     /* Submit a frame for this event */
     struct wl_buffer *buffer = draw_frame(state);
     wl_surface_attach(state->wl_surface, buffer, 0, 0);
     wl_surface_damage_buffer(state->wl_surface, 0, 0, INT32_MAX, INT32_MAX);
+    input_latency_commit(&state->latency, state->wl_surface);
     wl_surface_commit(state->wl_surface);
 
     state->last_frame = time;
@@ -230,6 +335,7 @@ static void wl_pointer_motion(void *data, struct wl_pointer *wl_pointer, uint32_
     struct client_state *client_state = static_cast<struct client_state *>(data);
     client_state->pointer_event.event_mask |= POINTER_EVENT_MOTION;
     client_state->pointer_event.time = time;
+    input_latency_event(&client_state->latency, time);
     client_state->pointer_event.surface_x = surface_x,
             client_state->pointer_event.surface_y = surface_y;
 }
@@ -239,6 +345,7 @@ static void wl_pointer_button(void *data, struct wl_pointer *wl_pointer, uint32_
     struct client_state *client_state = static_cast<struct client_state *>(data);
     client_state->pointer_event.event_mask |= POINTER_EVENT_BUTTON;
     client_state->pointer_event.time = time;
+    input_latency_event(&client_state->latency, time);
     client_state->pointer_event.serial = serial;
     client_state->pointer_event.button = button,
             client_state->pointer_event.state = state;
@@ -250,6 +357,7 @@ wl_pointer_axis(void *data, struct wl_pointer *wl_pointer, uint32_t time,
     struct client_state *client_state = static_cast<struct client_state *>(data);
     client_state->pointer_event.event_mask |= POINTER_EVENT_AXIS;
     client_state->pointer_event.time = time;
+    input_latency_event(&client_state->latency, time);
     client_state->pointer_event.axes[axis].valid = true;
     client_state->pointer_event.axes[axis].value = value;
 }
@@ -265,6 +373,7 @@ static void wl_pointer_axis_stop(void *data, struct wl_pointer *wl_pointer,
                                  uint32_t time, uint32_t axis) {
     struct client_state *client_state = static_cast<struct client_state *>(data);
     client_state->pointer_event.time = time;
+    input_latency_event(&client_state->latency, time);
     client_state->pointer_event.event_mask |= POINTER_EVENT_AXIS_STOP;
     client_state->pointer_event.axes[axis].valid = true;
 }
@@ -281,6 +390,26 @@ static void
 wl_pointer_frame(void *data, struct wl_pointer *wl_pointer) {
     struct client_state *client_state = static_cast<struct client_state *>(data);
     struct pointer_event *event = &client_state->pointer_event;
+    struct input_snapshot *input = &client_state->input.pending;
+    /* The compositor forgets the cursor on leave, set it again on every enter */
+    if ((event->event_mask & POINTER_EVENT_ENTER) && client_state->cursor && client_state->wl_pointer) {
+        pointer_cursor_set(client_state->cursor, client_state->wl_pointer, event->serial,
+                           POINTER_CURSOR_DEFAULT);
+    }
+    if (event->event_mask & (POINTER_EVENT_ENTER | POINTER_EVENT_MOTION)) {
+        input->pointer_x = event->surface_x;
+        input->pointer_y = event->surface_y;
+    }
+    if (event->event_mask & POINTER_EVENT_BUTTON) {
+        input_snapshot_set_button(input, event->button,
+                                  event->state == WL_POINTER_BUTTON_STATE_PRESSED);
+    }
+    if (event->event_mask & POINTER_EVENT_LEAVE) {
+        /* Releases outside the surface are never reported */
+        input->buttons = 0;
+    }
+    input_state_publish(&client_state->input);
+
     fprintf(stderr, "pointer frame @ %d: ", event->time);
 
     if (event->event_mask & POINTER_EVENT_ENTER) {
@@ -388,6 +517,7 @@ static void wl_keyboard_enter(void *data, struct wl_keyboard *wl_keyboard,
     fprintf(stderr, "keyboard enter; keys pressed are:\n");
     uint32_t *key;
     wl_array_for_each(key, keys) {
+        input_snapshot_set_key(&client_state->input.pending, *key, true);
         char buf[128];
         xkb_keysym_t sym = xkb_state_key_get_one_sym(
                 client_state->xkb_state, *key + 8);
@@ -397,11 +527,50 @@ static void wl_keyboard_enter(void *data, struct wl_keyboard *wl_keyboard,
                                *key + 8, buf, sizeof(buf));
         fprintf(stderr, "utf8: '%s'\n", buf);
     }
+    input_state_publish(&client_state->input);
+}
+
+static void clipboard_copy_key(struct client_state *state, enum clipboard_selection selection,
+                               uint32_t serial) {
+    int fd;
+    if (state->copy_path) {
+        fd = open(state->copy_path, O_RDONLY | O_CLOEXEC);
+    } else {
+        static const char text[] = "Hello from key_events\n";
+        fd = memfd_create("copy", MFD_CLOEXEC);
+        if (fd >= 0 && write(fd, text, sizeof(text) - 1) != sizeof(text) - 1) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0) {
+        fprintf(stderr, "clipboard: cannot open copy source: %s\n", strerror(errno));
+        return;
+    }
+    clipboard_copy(state->clipboard, selection, fd, serial);
+}
+
+static void clipboard_paste_key(struct client_state *state, enum clipboard_selection selection) {
+    int fd;
+    if (state->paste_path)
+        fd = open(state->paste_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    else
+        fd = memfd_create("paste", MFD_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "clipboard: cannot open paste target: %s\n", strerror(errno));
+        return;
+    }
+    clipboard_paste(state->clipboard, selection, fd);
 }
 
 static void wl_keyboard_key(void *data, struct wl_keyboard *wl_keyboard,
                             uint32_t serial, uint32_t time, uint32_t key, uint32_t state) {
     struct client_state *client_state = static_cast<struct client_state *>(data);
+    input_latency_event(&client_state->latency, time);
+    input_snapshot_set_key(&client_state->input.pending, key,
+                           state == WL_KEYBOARD_KEY_STATE_PRESSED);
+    input_state_publish(&client_state->input);
+
     char buf[128];
     uint32_t keycode = key + 8;
     xkb_keysym_t sym = xkb_state_key_get_one_sym(
@@ -413,10 +582,29 @@ static void wl_keyboard_key(void *data, struct wl_keyboard *wl_keyboard,
     xkb_state_key_get_utf8(client_state->xkb_state, keycode,
                            buf, sizeof(buf));
     fprintf(stderr, "utf8: '%s'\n", buf);
+
+    if (state == WL_KEYBOARD_KEY_STATE_PRESSED && client_state->clipboard
+            && xkb_state_mod_name_is_active(client_state->xkb_state, XKB_MOD_NAME_CTRL,
+                                            XKB_STATE_MODS_EFFECTIVE) > 0) {
+        /* Shift picks the primary selection instead of the clipboard */
+        enum clipboard_selection selection =
+                xkb_state_mod_name_is_active(client_state->xkb_state, XKB_MOD_NAME_SHIFT,
+                                             XKB_STATE_MODS_EFFECTIVE) > 0 ?
+                CLIPBOARD_SELECTION_PRIMARY : CLIPBOARD_SELECTION_CLIPBOARD;
+        if (sym == XKB_KEY_c || sym == XKB_KEY_C)
+            clipboard_copy_key(client_state, selection, serial);
+        else if (sym == XKB_KEY_v || sym == XKB_KEY_V)
+            clipboard_paste_key(client_state, selection);
+    }
 }
 
 static void wl_keyboard_leave(void *data, struct wl_keyboard *wl_keyboard,
                               uint32_t serial, struct wl_surface *surface) {
+    struct client_state *client_state = static_cast<struct client_state *>(data);
+    /* Keys released while unfocused are never reported */
+    memset(client_state->input.pending.keys, 0,
+           sizeof(client_state->input.pending.keys));
+    input_state_publish(&client_state->input);
     fprintf(stderr, "keyboard leave\n");
 }
 
@@ -427,6 +615,13 @@ static void wl_keyboard_modifiers(void *data, struct wl_keyboard *wl_keyboard,
     struct client_state *client_state = static_cast<struct client_state *>(data);
     xkb_state_update_mask(client_state->xkb_state,
                           mods_depressed, mods_latched, mods_locked, 0, 0, group);
+
+    struct input_snapshot *input = &client_state->input.pending;
+    input->mods_depressed = mods_depressed;
+    input->mods_latched = mods_latched;
+    input->mods_locked = mods_locked;
+    input->group = group;
+    input_state_publish(&client_state->input);
 }
 
 static void wl_keyboard_repeat_info(void *data, struct wl_keyboard *wl_keyboard,
@@ -445,22 +640,34 @@ static const struct wl_keyboard_listener wl_keyboard_listener = {
 
 static void wl_seat_capabilities(void *data, struct wl_seat *wl_seat, uint32_t capabilities) {
     struct client_state *state = static_cast<client_state *>(data);
+    if (state->replaying) {
+        /* Input comes from the recording instead */
+        return;
+    }
 
     bool have_pointer = capabilities & WL_SEAT_CAPABILITY_POINTER;
 
     if (have_pointer && state->wl_pointer == NULL) {
         state->wl_pointer = wl_seat_get_pointer(state->wl_seat);
-        wl_pointer_add_listener(state->wl_pointer,
-                                &wl_pointer_listener, state);
+        if (state->recorder)
+            input_recorder_add_pointer_listener(state->recorder, state->wl_pointer);
+        else
+            wl_pointer_add_listener(state->wl_pointer,
+                                    &wl_pointer_listener, state);
     } else if (!have_pointer && state->wl_pointer != NULL) {
+        if (state->cursor)
+            pointer_cursor_forget(state->cursor, state->wl_pointer);
         wl_pointer_release(state->wl_pointer);
         state->wl_pointer = NULL;
     }
     bool have_keyboard = capabilities & WL_SEAT_CAPABILITY_KEYBOARD;
     if (have_keyboard && state->wl_keyboard == NULL) {
         state->wl_keyboard = wl_seat_get_keyboard(state->wl_seat);
-        wl_keyboard_add_listener(state->wl_keyboard,
-                                 &wl_keyboard_listener, state);
+        if (state->recorder)
+            input_recorder_add_keyboard_listener(state->recorder, state->wl_keyboard);
+        else
+            wl_keyboard_add_listener(state->wl_keyboard,
+                                     &wl_keyboard_listener, state);
     } else if (!have_keyboard && state->wl_keyboard != NULL) {
         wl_keyboard_release(state->wl_keyboard);
         state->wl_keyboard = NULL;
@@ -494,6 +701,19 @@ static void registry_global(void *data, struct wl_registry *wl_registry,
         state->wl_seat = static_cast<wl_seat *>(wl_registry_bind(
                 wl_registry, name, &wl_seat_interface, 5/*7*/));
         wl_seat_add_listener(state->wl_seat, &wl_seat_listener, state);
+    } else if (strcmp(interface, wp_presentation_interface.name) == 0) {
+        state->wp_presentation = static_cast<wp_presentation *>(wl_registry_bind(
+                wl_registry, name, &wp_presentation_interface, 1));
+        input_latency_set_presentation(&state->latency, state->wp_presentation);
+    } else if (strcmp(interface, wp_cursor_shape_manager_v1_interface.name) == 0) {
+        state->cursor_shape_manager = static_cast<wp_cursor_shape_manager_v1 *>(wl_registry_bind(
+                wl_registry, name, &wp_cursor_shape_manager_v1_interface, 1));
+    } else if (strcmp(interface, wl_data_device_manager_interface.name) == 0) {
+        state->wl_data_device_manager = static_cast<wl_data_device_manager *>(wl_registry_bind(
+                wl_registry, name, &wl_data_device_manager_interface, 3));
+    } else if (strcmp(interface, zwp_primary_selection_device_manager_v1_interface.name) == 0) {
+        state->primary_selection_manager = static_cast<zwp_primary_selection_device_manager_v1 *>(
+                wl_registry_bind(wl_registry, name, &zwp_primary_selection_device_manager_v1_interface, 1));
     }
     
 }
@@ -508,13 +728,56 @@ static const struct wl_registry_listener wl_registry_listener = {
         .global_remove = registry_global_remove,
 };
 
+static volatile sig_atomic_t running = 1;
+
+static void handle_signal(int signum) {
+    running = 0;
+}
+
 int main(int argc, char *argv[]) {
+    const char *record_path = NULL, *replay_path = NULL;
+    bool realtime = true;
+    const char *copy_path = NULL, *paste_path = NULL;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--fast") == 0) {
+            realtime = false;
+        } else if (strcmp(argv[i], "--copy") == 0 && i + 1 < argc) {
+            copy_path = argv[++i];
+        } else if (strcmp(argv[i], "--paste-to") == 0 && i + 1 < argc) {
+            paste_path = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--record FILE | --replay FILE [--fast]]"
+                            " [--copy FILE] [--paste-to FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
     struct client_state state = {0};
+    struct input_listeners listeners = {&wl_pointer_listener, &wl_keyboard_listener, NULL, &state};
+    if (record_path) {
+        state.recorder = input_recorder_create(record_path, &listeners);
+        if (!state.recorder)
+            return 1;
+    }
+    state.replaying = replay_path != NULL;
+    state.copy_path = copy_path;
+    state.paste_path = paste_path;
+    input_latency_init(&state.latency);
     state.wl_display = wl_display_connect(NULL);
     state.wl_registry = wl_display_get_registry(state.wl_display);
     state.xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
     wl_registry_add_listener(state.wl_registry, &wl_registry_listener, &state);
     wl_display_roundtrip(state.wl_display);
+    state.cursor = pointer_cursor_create(state.wl_compositor, state.wl_shm,
+                                         state.cursor_shape_manager);
+    if (state.wl_data_device_manager && state.wl_seat) {
+        state.clipboard = clipboard_create(state.wl_seat, state.wl_data_device_manager,
+                                           state.primary_selection_manager);
+    }
 
     state.wl_surface = wl_compositor_create_surface(state.wl_compositor);
     state.xdg_surface = xdg_wm_base_get_xdg_surface(
@@ -527,8 +790,55 @@ int main(int argc, char *argv[]) {
     struct wl_callback *cb = wl_surface_frame(state.wl_surface);
     wl_callback_add_listener(cb, &wl_surface_frame_listener, &state);
 
-    while (wl_display_dispatch(state.wl_display)) {
-        /* This space deliberately left blank */
+    struct input_replay *replay = NULL;
+    if (replay_path) {
+        replay = input_replay_create(replay_path, &listeners, state.wl_surface, realtime);
+        if (!replay)
+            return 1;
+    }
+
+    /* Stop cleanly on a signal so the recording is complete */
+    struct sigaction sa = {};
+    sa.sa_handler = handle_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    /* A paste target closing early must fail the transfer, not kill us */
+    signal(SIGPIPE, SIG_IGN);
+
+    while (running) {
+        if (replay && !input_replay_dispatch(replay))
+            break;
+        while (wl_display_prepare_read(state.wl_display) != 0)
+            wl_display_dispatch_pending(state.wl_display);
+        wl_display_flush(state.wl_display);
+
+        /* The display first, then whatever clipboard transfers are running */
+        struct pollfd fds[1 + CLIPBOARD_MAX_TRANSFERS];
+        fds[0] = {wl_display_get_fd(state.wl_display), POLLIN, 0};
+        int count = 1;
+        if (state.clipboard)
+            count += clipboard_poll_fds(state.clipboard, &fds[1], CLIPBOARD_MAX_TRANSFERS);
+        int timeout = replay ? input_replay_timeout(replay) : -1;
+        if (poll(fds, count, timeout) > 0 && (fds[0].revents & POLLIN)) {
+            if (wl_display_read_events(state.wl_display) < 0)
+                break;
+        } else {
+            wl_display_cancel_read(state.wl_display);
+        }
+        if (wl_display_dispatch_pending(state.wl_display) < 0)
+            break;
+        if (state.clipboard)
+            clipboard_dispatch(state.clipboard, &fds[1], count - 1);
     }
+
+    input_latency_report(&state.latency);
+    if (replay)
+        input_replay_destroy(replay);
+    if (state.recorder)
+        input_recorder_destroy(state.recorder);
+    if (state.cursor)
+        pointer_cursor_destroy(state.cursor);
+    if (state.clipboard)
+        clipboard_destroy(state.clipboard);
     return 0;
 }
\ No newline at end of file
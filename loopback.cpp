@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include <wayland-server.h>
+
+/*
+ * Protocol layer microbenchmark
+ *
+ * A minimal server runs on its own thread and talks to a client in the same
+ * process over a socketpair, through wl_client_create on one end and
+ * wl_display_connect_to_fd on the other, so the numbers contain libwayland
+ * and the kernel socket and nothing else.
+ *
+ *   roundtrip  wl_display_roundtrip latency
+ *   requests   wl_surface attach/damage/commit triplets per second, marshalled,
+ *              sent, demarshalled and dispatched to empty server handlers
+ *   events     wl_output.mode bursts; the events wait in their own queue until
+ *              the whole burst is read, so dispatching them times only the
+ *              client's demarshalled closure lookup and listener calls
+ */
+
+/* Server */
+struct loopback_server {
+    struct wl_display *display;
+    struct wl_list outputs;         /* wl_output resources */
+    uint32_t burst;                 /* Mode events per wl_surface.frame */
+    uint64_t commits;
+    pthread_t thread;
+};
+
+static void unlink_resource(struct wl_resource *resource) {
+    wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void destroy_resource(struct wl_client *client, struct wl_resource *resource) {
+    wl_resource_destroy(resource);
+}
+
+static void surface_attach(struct wl_client *client, struct wl_resource *resource, struct wl_resource *buffer,
+                           int32_t x, int32_t y) {
+}
+
+static void surface_damage(struct wl_client *client, struct wl_resource *resource, int32_t x, int32_t y,
+                           int32_t width, int32_t height) {
+}
+
+/* Answers at once, after the burst of mode events on every bound output */
+static void surface_frame(struct wl_client *client, struct wl_resource *resource, uint32_t callback) {
+    struct loopback_server *server = static_cast<struct loopback_server *>(wl_resource_get_user_data(resource));
+    struct wl_resource *output;
+    wl_resource_for_each(output, &server->outputs) {
+        for (uint32_t i = 0; i < server->burst; ++i)
+            wl_output_send_mode(output, WL_OUTPUT_MODE_CURRENT, 640, 480, 60000);
+    }
+    struct wl_resource *done = wl_resource_create(client, &wl_callback_interface, 1, callback);
+    if (!done) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_callback_send_done(done, 0);
+    wl_resource_destroy(done);
+}
+
+static void surface_set_region(struct wl_client *client, struct wl_resource *resource,
+                               struct wl_resource *region) {
+}
+
+static void surface_commit(struct wl_client *client, struct wl_resource *resource) {
+    static_cast<struct loopback_server *>(wl_resource_get_user_data(resource))->commits++;
+}
+
+static void surface_set_int(struct wl_client *client, struct wl_resource *resource, int32_t value) {
+}
+
+static const struct wl_surface_interface surface_implementation = {
+        .destroy = destroy_resource,
+        .attach = surface_attach,
+        .damage = surface_damage,
+        .frame = surface_frame,
+        .set_opaque_region = surface_set_region,
+        .set_input_region = surface_set_region,
+        .commit = surface_commit,
+        .set_buffer_transform = surface_set_int,
+        .set_buffer_scale = surface_set_int,
+        .damage_buffer = surface_damage,
+};
+
+static void region_box(struct wl_client *client, struct wl_resource *resource, int32_t x, int32_t y,
+                       int32_t width, int32_t height) {
+}
+
+static const struct wl_region_interface region_implementation = {
+        .destroy = destroy_resource,
+        .add = region_box,
+        .subtract = region_box,
+};
+
+static void compositor_create_surface(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct wl_resource *surface = wl_resource_create(client, &wl_surface_interface,
+                                                     wl_resource_get_version(resource), id);
+    if (!surface) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(surface, &surface_implementation, wl_resource_get_user_data(resource), NULL);
+}
+
+static void compositor_create_region(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct wl_resource *region = wl_resource_create(client, &wl_region_interface, 1, id);
+    if (!region) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(region, &region_implementation, NULL, NULL);
+}
+
+static const struct wl_compositor_interface compositor_implementation = {
+        .create_surface = compositor_create_surface,
+        .create_region = compositor_create_region,
+};
+
+static void compositor_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *resource = wl_resource_create(client, &wl_compositor_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &compositor_implementation, data, NULL);
+}
+
+static const struct wl_output_interface output_implementation = {
+        .release = destroy_resource,
+};
+
+static void output_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct loopback_server *server = static_cast<struct loopback_server *>(data);
+    struct wl_resource *resource = wl_resource_create(client, &wl_output_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &output_implementation, server, unlink_resource);
+    wl_list_insert(&server->outputs, wl_resource_get_link(resource));
+}
+
+static void *server_main(void *data) {
+    wl_display_run(static_cast<struct loopback_server *>(data)->display);
+    return NULL;
+}
+
+/* Client */
+struct loopback_client {
+    struct wl_display *display;
+    struct wl_registry *registry;
+    struct wl_compositor *compositor;
+    struct wl_shm *shm;
+    struct wl_output *output;
+    struct wl_event_queue *output_queue;
+    struct wl_surface *surface;
+    struct wl_buffer *buffer;
+    uint64_t modes;
+    bool done;
+};
+
+static uint64_t monotonic_ns() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void output_geometry(void *data, struct wl_output *wl_output, int32_t x, int32_t y, int32_t physical_width,
+                            int32_t physical_height, int32_t subpixel, const char *make, const char *model,
+                            int32_t transform) {
+}
+
+static void output_mode(void *data, struct wl_output *wl_output, uint32_t flags, int32_t width, int32_t height,
+                        int32_t refresh) {
+    static_cast<struct loopback_client *>(data)->modes++;
+}
+
+static void output_done(void *data, struct wl_output *wl_output) {
+}
+
+static void output_scale(void *data, struct wl_output *wl_output, int32_t factor) {
+}
+
+static const struct wl_output_listener output_listener = {
+        .geometry = output_geometry,
+        .mode = output_mode,
+        .done = output_done,
+        .scale = output_scale,
+};
+
+static void frame_done(void *data, struct wl_callback *callback, uint32_t time) {
+    static_cast<struct loopback_client *>(data)->done = true;
+    wl_callback_destroy(callback);
+}
+
+static const struct wl_callback_listener frame_listener = {
+        .done = frame_done,
+};
+
+static void registry_global(void *data, struct wl_registry *registry, uint32_t name, const char *interface,
+                            uint32_t version) {
+    struct loopback_client *client = static_cast<struct loopback_client *>(data);
+    if (strcmp(interface, wl_compositor_interface.name) == 0) {
+        client->compositor = static_cast<wl_compositor *>(wl_registry_bind(registry, name,
+                                                                           &wl_compositor_interface, 4));
+    } else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        client->shm = static_cast<wl_shm *>(wl_registry_bind(registry, name, &wl_shm_interface, 1));
+    } else if (strcmp(interface, wl_output_interface.name) == 0) {
+        client->output = static_cast<wl_output *>(wl_registry_bind(registry, name, &wl_output_interface, 2));
+        wl_output_add_listener(client->output, &output_listener, client);
+    }
+}
+
+static void registry_global_remove(void *data, struct wl_registry *registry, uint32_t name) {
+}
+
+static const struct wl_registry_listener registry_listener = {
+        .global = registry_global,
+        .global_remove = registry_global_remove,
+};
+
+/* Flushes everything, waiting for room in the socket when the server falls behind */
+static bool flush_all(struct wl_display *display) {
+    while (wl_display_flush(display) < 0) {
+        if (errno != EAGAIN)
+            return false;
+        struct pollfd fd = {wl_display_get_fd(display), POLLOUT, 0};
+        poll(&fd, 1, -1);
+    }
+    return true;
+}
+
+static struct wl_buffer *create_buffer(struct wl_shm *shm) {
+    int fd = memfd_create("loopback", MFD_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, 64 * 64 * 4) < 0) {
+        close(fd);
+        return NULL;
+    }
+    struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, 64 * 64 * 4);
+    struct wl_buffer *buffer = wl_shm_pool_create_buffer(pool, 0, 64, 64, 64 * 4, WL_SHM_FORMAT_XRGB8888);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+    return buffer;
+}
+
+static uint64_t percentile(const uint64_t *sorted, uint32_t count, double p) {
+    uint32_t index = (uint32_t) (p * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+static void bench_roundtrip(struct loopback_client *client, uint32_t count) {
+    uint64_t *samples = static_cast<uint64_t *>(malloc(count * sizeof(*samples)));
+    if (!samples)
+        return;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t start = monotonic_ns();
+        wl_display_roundtrip(client->display);
+        samples[i] = monotonic_ns() - start;
+    }
+    std::sort(samples, samples + count);
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < count; ++i)
+        total += samples[i];
+    printf("roundtrip: %u, %.2f us mean, %.2f us p50, %.2f us p99, %.2f us max\n", count,
+           total / 1000.0 / count, percentile(samples, count, 0.5) / 1000.0,
+           percentile(samples, count, 0.99) / 1000.0, samples[count - 1] / 1000.0);
+    free(samples);
+}
+
+static void bench_requests(struct loopback_client *client, struct loopback_server *server, uint32_t count) {
+    /* Flushing every few hundred triplets keeps the client's buffer from growing without bound */
+    const uint32_t batch = 256;
+    uint64_t marshal_ns = 0;
+    uint64_t commits_before = server->commits;
+    uint64_t start = monotonic_ns();
+    for (uint32_t done = 0; done < count;) {
+        uint32_t n = count - done < batch ? count - done : batch;
+        uint64_t marshal_start = monotonic_ns();
+        for (uint32_t i = 0; i < n; ++i) {
+            wl_surface_attach(client->surface, client->buffer, 0, 0);
+            wl_surface_damage_buffer(client->surface, 0, 0, 64, 64);
+            wl_surface_commit(client->surface);
+        }
+        marshal_ns += monotonic_ns() - marshal_start;
+        if (!flush_all(client->display))
+            return;
+        done += n;
+    }
+    wl_display_roundtrip(client->display);
+    uint64_t elapsed = monotonic_ns() - start;
+    /* The roundtrip's sync was handled after every commit, so reading the count now is ordered */
+    uint64_t commits = server->commits - commits_before;
+    printf("requests: %u triplets, %.0f per second end to end, %.1f ns marshalling each, %llu commits seen\n",
+           count, count / (elapsed / 1e9), (double) marshal_ns / count, (unsigned long long) commits);
+}
+
+static void bench_events(struct loopback_client *client, uint32_t bursts, uint32_t burst) {
+    uint64_t dispatch_ns = 0, events = 0;
+    uint64_t start = monotonic_ns();
+    for (uint32_t i = 0; i < bursts; ++i) {
+        client->done = false;
+        struct wl_callback *callback = wl_surface_frame(client->surface);
+        wl_callback_add_listener(callback, &frame_listener, client);
+        flush_all(client->display);
+        /* The done event comes after the burst, so the whole burst is queued by then */
+        while (!client->done)
+            if (wl_display_dispatch(client->display) < 0)
+                return;
+
+        uint64_t before = client->modes;
+        uint64_t dispatch_start = monotonic_ns();
+        wl_display_dispatch_queue_pending(client->display, client->output_queue);
+        dispatch_ns += monotonic_ns() - dispatch_start;
+        events += client->modes - before;
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+    printf("events: %u bursts of %u, %.0f per second end to end, %.1f ns dispatching each\n", bursts, burst,
+           events / (elapsed / 1e9), events ? (double) dispatch_ns / events : 0.0);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--roundtrips N] [--triplets N] [--bursts N] [--burst N]\n", name);
+    fprintf(stderr, "  --roundtrips  wl_display_roundtrip calls (default 10000)\n");
+    fprintf(stderr, "  --triplets    attach/damage/commit triplets (default 1000000)\n");
+    fprintf(stderr, "  --bursts      wl_output.mode bursts (default 1000)\n");
+    fprintf(stderr, "  --burst       events per burst (default 1000)\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    int roundtrips = 10000, triplets = 1000000, bursts = 1000, burst = 1000;
+    for (int i = 1; i < argc; i += 2) {
+        int *value = NULL;
+        if (strcmp(argv[i], "--roundtrips") == 0)
+            value = &roundtrips;
+        else if (strcmp(argv[i], "--triplets") == 0)
+            value = &triplets;
+        else if (strcmp(argv[i], "--bursts") == 0)
+            value = &bursts;
+        else if (strcmp(argv[i], "--burst") == 0)
+            value = &burst;
+        if (!value || i + 1 >= argc || (*value = atoi(argv[i + 1])) <= 0) {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        fprintf(stderr, "Unable to create a socketpair: %s\n", strerror(errno));
+        return 1;
+    }
+
+    struct loopback_server server = {};
+    server.display = wl_display_create();
+    if (!server.display) {
+        fprintf(stderr, "Unable to create Wayland display.\n");
+        return 1;
+    }
+    server.burst = (uint32_t) burst;
+    wl_list_init(&server.outputs);
+    wl_display_init_shm(server.display);
+    wl_global_create(server.display, &wl_compositor_interface, 4, &server, compositor_bind);
+    wl_global_create(server.display, &wl_output_interface, 2, &server, output_bind);
+    if (!wl_client_create(server.display, fds[0])) {
+        fprintf(stderr, "Unable to create the server side client.\n");
+        return 1;
+    }
+    if (pthread_create(&server.thread, NULL, server_main, &server) != 0) {
+        fprintf(stderr, "Unable to start the server thread.\n");
+        return 1;
+    }
+
+    struct loopback_client client = {};
+    client.display = wl_display_connect_to_fd(fds[1]);
+    if (!client.display) {
+        fprintf(stderr, "Unable to connect to the loopback display.\n");
+        return 1;
+    }
+    client.registry = wl_display_get_registry(client.display);
+    wl_registry_add_listener(client.registry, &registry_listener, &client);
+    wl_display_roundtrip(client.display);
+    /* The initial mode and done events are dispatched before the output moves to its own queue */
+    wl_display_roundtrip(client.display);
+    if (!client.compositor || !client.shm || !client.output) {
+        fprintf(stderr, "The loopback server is missing globals.\n");
+        return 1;
+    }
+    client.output_queue = wl_display_create_queue(client.display);
+    wl_proxy_set_queue(reinterpret_cast<struct wl_proxy *>(client.output), client.output_queue);
+    client.surface = wl_compositor_create_surface(client.compositor);
+    client.buffer = create_buffer(client.shm);
+    if (!client.buffer) {
+        fprintf(stderr, "Unable to create the buffer.\n");
+        return 1;
+    }
+    wl_display_roundtrip(client.display);
+
+    bench_roundtrip(&client, (uint32_t) roundtrips);
+    bench_requests(&client, &server, (uint32_t) triplets);
+    bench_events(&client, (uint32_t) bursts, (uint32_t) burst);
+
+    wl_buffer_destroy(client.buffer);
+    wl_surface_destroy(client.surface);
+    wl_output_destroy(client.output);
+    wl_event_queue_destroy(client.output_queue);
+    wl_compositor_destroy(client.compositor);
+    wl_shm_destroy(client.shm);
+    wl_registry_destroy(client.registry);
+    wl_display_roundtrip(client.display);
+    wl_display_disconnect(client.display);
+
+    wl_display_terminate(server.display);
+    pthread_join(server.thread, NULL);
+    wl_display_destroy(server.display);
+    return 0;
+}
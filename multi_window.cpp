@@ -0,0 +1,575 @@
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include "xdg-shell-client-protocol.h"
+
+/*
+ * Many surfaces from one connection, one shm pool and one render thread
+ *
+ * Toplevels and desynchronized subsurfaces each run their own frame callback
+ * loop. All buffers come out of a single wl_shm_pool that grows on demand.
+ * A fired callback queues its surface for the render worker, which is the
+ * only thread that draws; the main thread keeps every Wayland call and
+ * commits what the worker hands back through an eventfd.
+ */
+
+#define MW_BUFFERS 2
+#define MW_POOL_ALIGN 64
+
+struct mw_pool {
+    struct wl_shm_pool *wl_shm_pool;
+    int fd;
+    uint8_t *data;
+    size_t size;
+    size_t used;
+};
+
+struct mw_surface;
+
+struct mw_buffer {
+    struct mw_surface *surface;
+    struct wl_buffer *wl_buffer;
+    size_t offset;                  /* In the pool, the mapping may move as it grows */
+    bool busy;                      /* Rendering or held by the compositor */
+};
+
+struct mw_surface {
+    struct mw_state *state;
+    uint32_t index;
+    struct wl_surface *wl_surface;
+    struct xdg_surface *xdg_surface;
+    struct xdg_toplevel *xdg_toplevel;
+    struct wl_subsurface *wl_subsurface;
+    struct mw_buffer buffers[MW_BUFFERS];
+    bool configured;
+    bool waiting;                   /* Callback fired while both buffers were busy */
+
+    /* Worker queue */
+    struct mw_surface *next;
+    struct mw_buffer *job;
+
+    uint32_t frame;
+    uint64_t frames;                /* Since the last report */
+    uint64_t total_frames;
+};
+
+struct mw_queue {
+    struct mw_surface *head, *tail;
+};
+
+struct mw_state {
+    struct wl_display *wl_display;
+    struct wl_registry *wl_registry;
+    struct wl_shm *wl_shm;
+    struct wl_compositor *wl_compositor;
+    struct wl_subcompositor *wl_subcompositor;
+    struct xdg_wm_base *xdg_wm_base;
+
+    struct mw_pool pool;
+    struct mw_surface *surfaces;
+    uint32_t surface_count;
+    uint32_t toplevel_count;
+    int32_t width, height;
+
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct mw_queue jobs;           /* To the worker */
+    struct mw_queue done;           /* Back to the main thread */
+    int done_fd;                    /* eventfd */
+    bool quit;
+};
+
+static volatile sig_atomic_t interrupted;
+
+static uint64_t monotonic_ns() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Shared memory support code */
+static void randname(char *buf) {
+    struct timespec ts{};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    long r = ts.tv_nsec;
+    for (int i = 0; i < 6; ++i) {
+        buf[i] = 'A' + (r & 15) + (r & 16) * 2;
+        r >>= 5;
+    }
+}
+
+static int create_shm_file() {
+    int retries = 100;
+    do {
+        char name[] = "/wl_shm-XXXXXX";
+        randname(name + sizeof(name) - 7);
+        --retries;
+        int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0) {
+            shm_unlink(name);
+            return fd;
+        }
+    } while (retries > 0 && errno == EEXIST);
+    return -1;
+}
+
+static bool resize_shm_file(int fd, size_t size) {
+    int ret;
+    do {
+        ret = ftruncate(fd, (off_t) size);
+    } while (ret < 0 && errno == EINTR);
+    return ret == 0;
+}
+
+static bool pool_init(struct mw_pool *pool, struct wl_shm *wl_shm, size_t size) {
+    pool->fd = create_shm_file();
+    if (pool->fd < 0)
+        return false;
+    if (!resize_shm_file(pool->fd, size)) {
+        close(pool->fd);
+        return false;
+    }
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, pool->fd, 0);
+    if (data == MAP_FAILED) {
+        close(pool->fd);
+        return false;
+    }
+    pool->data = static_cast<uint8_t *>(data);
+    pool->size = size;
+    pool->used = 0;
+    pool->wl_shm_pool = wl_shm_create_pool(wl_shm, pool->fd, (int32_t) size);
+    return true;
+}
+
+/* Offset of `size` fresh bytes, doubling the pool when it runs out. Not while the worker runs */
+static bool pool_alloc(struct mw_pool *pool, size_t size, size_t *offset) {
+    size_t start = (pool->used + MW_POOL_ALIGN - 1) & ~(size_t) (MW_POOL_ALIGN - 1);
+    if (start + size > pool->size) {
+        size_t grown = pool->size;
+        while (start + size > grown)
+            grown *= 2;
+        if (grown > INT32_MAX || !resize_shm_file(pool->fd, grown))
+            return false;
+        void *data = mremap(pool->data, pool->size, grown, MREMAP_MAYMOVE);
+        if (data == MAP_FAILED)
+            return false;
+        pool->data = static_cast<uint8_t *>(data);
+        pool->size = grown;
+        wl_shm_pool_resize(pool->wl_shm_pool, (int32_t) grown);
+    }
+    *offset = start;
+    pool->used = start + size;
+    return true;
+}
+
+static void pool_fini(struct mw_pool *pool) {
+    if (pool->wl_shm_pool)
+        wl_shm_pool_destroy(pool->wl_shm_pool);
+    if (pool->data)
+        munmap(pool->data, pool->size);
+    if (pool->fd >= 0)
+        close(pool->fd);
+}
+
+/* Render worker */
+static void queue_push(struct mw_queue *queue, struct mw_surface *surface) {
+    surface->next = NULL;
+    if (queue->tail)
+        queue->tail->next = surface;
+    else
+        queue->head = surface;
+    queue->tail = surface;
+}
+
+static struct mw_surface *queue_take_all(struct mw_queue *queue) {
+    struct mw_surface *head = queue->head;
+    queue->head = queue->tail = NULL;
+    return head;
+}
+
+static void render(struct mw_surface *surface, uint32_t *pixels) {
+    /* A stripe per surface sweeping across a tint that tells them apart */
+    int32_t width = surface->state->width, height = surface->state->height;
+    uint32_t tint = 0xff000000 | (surface->index * 0x3f1d27u & 0x7f7f7f);
+    int32_t stripe = (int32_t) (surface->frame % (uint32_t) width);
+    for (int32_t y = 0; y < height; ++y) {
+        uint32_t *row = pixels + (size_t) y * width;
+        for (int32_t x = 0; x < width; ++x)
+            row[x] = x >= stripe && x < stripe + 4 ? 0xffffffff : tint;
+    }
+    surface->frame++;
+}
+
+static void *worker_main(void *data) {
+    struct mw_state *state = static_cast<struct mw_state *>(data);
+    pthread_mutex_lock(&state->lock);
+    for (;;) {
+        while (!state->quit && !state->jobs.head)
+            pthread_cond_wait(&state->wake, &state->lock);
+        if (state->quit)
+            break;
+        struct mw_surface *surface = queue_take_all(&state->jobs);
+        pthread_mutex_unlock(&state->lock);
+
+        struct mw_surface *finished = surface;
+        for (; surface; surface = surface->next)
+            render(surface, reinterpret_cast<uint32_t *>(state->pool.data + surface->job->offset));
+
+        pthread_mutex_lock(&state->lock);
+        while (finished) {
+            struct mw_surface *next = finished->next;
+            queue_push(&state->done, finished);
+            finished = next;
+        }
+        uint64_t one = 1;
+        if (write(state->done_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            break;
+    }
+    pthread_mutex_unlock(&state->lock);
+    return NULL;
+}
+
+/* Main thread */
+static void surface_request_render(struct mw_surface *surface) {
+    struct mw_buffer *buffer = NULL;
+    for (int i = 0; i < MW_BUFFERS; ++i) {
+        if (!surface->buffers[i].busy) {
+            buffer = &surface->buffers[i];
+            break;
+        }
+    }
+    if (!buffer) {
+        surface->waiting = true;
+        return;
+    }
+    buffer->busy = true;
+    surface->job = buffer;
+
+    struct mw_state *state = surface->state;
+    pthread_mutex_lock(&state->lock);
+    queue_push(&state->jobs, surface);
+    pthread_cond_signal(&state->wake);
+    pthread_mutex_unlock(&state->lock);
+}
+
+static void buffer_release(void *data, struct wl_buffer *wl_buffer) {
+    struct mw_buffer *buffer = static_cast<struct mw_buffer *>(data);
+    buffer->busy = false;
+    if (buffer->surface->waiting) {
+        buffer->surface->waiting = false;
+        surface_request_render(buffer->surface);
+    }
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+        .release = buffer_release,
+};
+
+static void frame_done(void *data, struct wl_callback *callback, uint32_t time) {
+    wl_callback_destroy(callback);
+    struct mw_surface *surface = static_cast<struct mw_surface *>(data);
+    surface->frames++;
+    surface->total_frames++;
+    surface_request_render(surface);
+}
+
+static const struct wl_callback_listener frame_listener = {
+        .done = frame_done,
+};
+
+/* Commits whatever the worker has finished */
+static void commit_finished(struct mw_state *state) {
+    uint64_t count;
+    if (read(state->done_fd, &count, sizeof(count)) < 0)
+        return;
+    pthread_mutex_lock(&state->lock);
+    struct mw_surface *surface = queue_take_all(&state->done);
+    pthread_mutex_unlock(&state->lock);
+
+    while (surface) {
+        struct mw_surface *next = surface->next;
+        struct wl_callback *callback = wl_surface_frame(surface->wl_surface);
+        wl_callback_add_listener(callback, &frame_listener, surface);
+        wl_surface_attach(surface->wl_surface, surface->job->wl_buffer, 0, 0);
+        wl_surface_damage_buffer(surface->wl_surface, 0, 0, INT32_MAX, INT32_MAX);
+        wl_surface_commit(surface->wl_surface);
+        surface->job = NULL;
+        surface = next;
+    }
+}
+
+static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface, uint32_t serial) {
+    struct mw_surface *surface = static_cast<struct mw_surface *>(data);
+    xdg_surface_ack_configure(xdg_surface, serial);
+    if (surface->configured)
+        return;
+    surface->configured = true;
+    surface_request_render(surface);
+
+    /* Subsurfaces of this toplevel start drawing along with it */
+    struct mw_state *state = surface->state;
+    for (uint32_t i = state->toplevel_count; i < state->surface_count; ++i) {
+        struct mw_surface *child = &state->surfaces[i];
+        if (!child->configured && i % state->toplevel_count == surface->index) {
+            child->configured = true;
+            surface_request_render(child);
+        }
+    }
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+        .configure = xdg_surface_configure,
+};
+
+static void xdg_wm_base_ping(void *data, struct xdg_wm_base *xdg_wm_base, uint32_t serial) {
+    xdg_wm_base_pong(xdg_wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener xdg_wm_base_listener = {
+        .ping = xdg_wm_base_ping,
+};
+
+static void registry_global(void *data, struct wl_registry *wl_registry, uint32_t name, const char *interface,
+                            uint32_t version) {
+    struct mw_state *state = static_cast<struct mw_state *>(data);
+    if (strcmp(interface, wl_shm_interface.name) == 0) {
+        state->wl_shm = static_cast<wl_shm *>(wl_registry_bind(wl_registry, name, &wl_shm_interface, 1));
+    } else if (strcmp(interface, wl_compositor_interface.name) == 0) {
+        state->wl_compositor = static_cast<wl_compositor *>(wl_registry_bind(
+                wl_registry, name, &wl_compositor_interface, 4));
+    } else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+        state->wl_subcompositor = static_cast<wl_subcompositor *>(wl_registry_bind(
+                wl_registry, name, &wl_subcompositor_interface, 1));
+    } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+        state->xdg_wm_base = static_cast<xdg_wm_base *>(wl_registry_bind(
+                wl_registry, name, &xdg_wm_base_interface, 1));
+        xdg_wm_base_add_listener(state->xdg_wm_base, &xdg_wm_base_listener, state);
+    }
+}
+
+static void registry_global_remove(void *data, struct wl_registry *wl_registry, uint32_t name) {
+    /* This space deliberately left blank */
+}
+
+static const struct wl_registry_listener registry_listener = {
+        .global = registry_global,
+        .global_remove = registry_global_remove,
+};
+
+static bool surface_init(struct mw_state *state, struct mw_surface *surface, uint32_t index) {
+    surface->state = state;
+    surface->index = index;
+    int32_t stride = state->width * 4;
+    size_t size = (size_t) stride * state->height;
+    for (int i = 0; i < MW_BUFFERS; ++i) {
+        struct mw_buffer *buffer = &surface->buffers[i];
+        if (!pool_alloc(&state->pool, size, &buffer->offset))
+            return false;
+        buffer->surface = surface;
+        buffer->wl_buffer = wl_shm_pool_create_buffer(state->pool.wl_shm_pool, (int32_t) buffer->offset,
+                                                      state->width, state->height, stride,
+                                                      WL_SHM_FORMAT_XRGB8888);
+        wl_buffer_add_listener(buffer->wl_buffer, &buffer_listener, buffer);
+    }
+
+    surface->wl_surface = wl_compositor_create_surface(state->wl_compositor);
+    if (index < state->toplevel_count) {
+        surface->xdg_surface = xdg_wm_base_get_xdg_surface(state->xdg_wm_base, surface->wl_surface);
+        xdg_surface_add_listener(surface->xdg_surface, &xdg_surface_listener, surface);
+        surface->xdg_toplevel = xdg_surface_get_toplevel(surface->xdg_surface);
+        char title[32];
+        snprintf(title, sizeof(title), "multi_window %u", index);
+        xdg_toplevel_set_title(surface->xdg_toplevel, title);
+    } else {
+        /* Subsurfaces go round the toplevels, on a 4x4 grid over each */
+        struct mw_surface *parent = &state->surfaces[index % state->toplevel_count];
+        uint32_t cell = (index - state->toplevel_count) / state->toplevel_count % 16;
+        surface->wl_subsurface = wl_subcompositor_get_subsurface(state->wl_subcompositor, surface->wl_surface,
+                                                                 parent->wl_surface);
+        wl_subsurface_set_position(surface->wl_subsurface, (int32_t) (cell % 4) * state->width / 4,
+                                   (int32_t) (cell / 4) * state->height / 4);
+        wl_subsurface_set_desync(surface->wl_subsurface);
+    }
+    return true;
+}
+
+static void surface_fini(struct mw_surface *surface) {
+    for (int i = 0; i < MW_BUFFERS; ++i) {
+        if (surface->buffers[i].wl_buffer)
+            wl_buffer_destroy(surface->buffers[i].wl_buffer);
+    }
+    if (surface->wl_subsurface)
+        wl_subsurface_destroy(surface->wl_subsurface);
+    if (surface->xdg_toplevel)
+        xdg_toplevel_destroy(surface->xdg_toplevel);
+    if (surface->xdg_surface)
+        xdg_surface_destroy(surface->xdg_surface);
+    if (surface->wl_surface)
+        wl_surface_destroy(surface->wl_surface);
+}
+
+static void report(struct mw_state *state, double seconds) {
+    double min = 0, max = 0, sum = 0;
+    for (uint32_t i = 0; i < state->surface_count; ++i) {
+        double fps = state->surfaces[i].frames / seconds;
+        if (i == 0 || fps < min)
+            min = fps;
+        if (i == 0 || fps > max)
+            max = fps;
+        sum += fps;
+        state->surfaces[i].frames = 0;
+    }
+    fprintf(stderr, "%u surfaces: %.1f fps mean, %.1f min, %.1f max\n", state->surface_count,
+            sum / state->surface_count, min, max);
+}
+
+static void handle_signal(int signal_number) {
+    interrupted = 1;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--toplevels N] [--subsurfaces N] [--size WIDTHxHEIGHT] [--seconds S]\n", name);
+    fprintf(stderr, "  --toplevels    xdg_toplevel windows (default 4)\n");
+    fprintf(stderr, "  --subsurfaces  desynchronized subsurfaces spread over the toplevels (default 0)\n");
+    fprintf(stderr, "  --size         size of every surface (default 64x64)\n");
+    fprintf(stderr, "  --seconds      run time, 0 until interrupted (default 10)\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct mw_state state = {};
+    state.width = 64;
+    state.height = 64;
+    state.pool.fd = -1;
+    int toplevels = 4, subsurfaces = 0;
+    double seconds = 10;
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--toplevels") == 0 && (toplevels = atoi(argv[i + 1])) > 0)
+            continue;
+        if (strcmp(argv[i], "--subsurfaces") == 0 && (subsurfaces = atoi(argv[i + 1])) >= 0)
+            continue;
+        if (strcmp(argv[i], "--seconds") == 0 && (seconds = atof(argv[i + 1])) >= 0)
+            continue;
+        if (strcmp(argv[i], "--size") == 0 && sscanf(argv[i + 1], "%dx%d", &state.width, &state.height) == 2
+                && state.width > 0 && state.height > 0)
+            continue;
+        usage(argv[0]);
+        return 1;
+    }
+
+    state.wl_display = wl_display_connect(NULL);
+    if (!state.wl_display) {
+        fprintf(stderr, "Failed to connect to Wayland display.\n");
+        return 1;
+    }
+    state.wl_registry = wl_display_get_registry(state.wl_display);
+    wl_registry_add_listener(state.wl_registry, &registry_listener, &state);
+    wl_display_roundtrip(state.wl_display);
+    if (!state.wl_shm || !state.wl_compositor || !state.xdg_wm_base) {
+        fprintf(stderr, "The compositor lacks wl_shm, wl_compositor or xdg_wm_base.\n");
+        return 1;
+    }
+    if (subsurfaces > 0 && !state.wl_subcompositor) {
+        fprintf(stderr, "No wl_subcompositor, running without subsurfaces.\n");
+        subsurfaces = 0;
+    }
+
+    state.toplevel_count = (uint32_t) toplevels;
+    state.surface_count = (uint32_t) (toplevels + subsurfaces);
+    state.surfaces = static_cast<struct mw_surface *>(calloc(state.surface_count, sizeof(*state.surfaces)));
+    size_t buffer_size = (size_t) state.width * state.height * 4;
+    if (!state.surfaces || !pool_init(&state.pool, state.wl_shm, buffer_size * MW_BUFFERS)) {
+        fprintf(stderr, "Unable to allocate the surfaces.\n");
+        return 1;
+    }
+    /* Every buffer exists before the worker starts, so the pool never moves under it */
+    for (uint32_t i = 0; i < state.surface_count; ++i) {
+        if (!surface_init(&state, &state.surfaces[i], i)) {
+            fprintf(stderr, "Unable to grow the shm pool for surface %u.\n", i);
+            return 1;
+        }
+    }
+    for (uint32_t i = 0; i < state.toplevel_count; ++i)
+        wl_surface_commit(state.surfaces[i].wl_surface);
+
+    state.done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    pthread_mutex_init(&state.lock, NULL);
+    pthread_cond_init(&state.wake, NULL);
+    if (state.done_fd < 0 || pthread_create(&state.worker, NULL, worker_main, &state) != 0) {
+        fprintf(stderr, "Unable to start the render worker.\n");
+        return 1;
+    }
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    fprintf(stderr, "%u toplevels, %d subsurfaces of %dx%d in one %zu KiB pool\n", state.toplevel_count,
+            subsurfaces, state.width, state.height, state.pool.size / 1024);
+
+    uint64_t start = monotonic_ns(), last_report = start;
+    uint64_t end = seconds > 0 ? start + (uint64_t) (seconds * 1e9) : UINT64_MAX;
+    while (!interrupted) {
+        wl_display_dispatch_pending(state.wl_display);
+        wl_display_flush(state.wl_display);
+
+        uint64_t now = monotonic_ns();
+        if (now >= end)
+            break;
+        if (now - last_report >= 1000000000) {
+            report(&state, (now - last_report) / 1e9);
+            last_report = now;
+        }
+        struct pollfd fds[2] = {
+                {wl_display_get_fd(state.wl_display), POLLIN, 0},
+                {state.done_fd, POLLIN, 0},
+        };
+        if (poll(fds, 2, 100) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if ((fds[0].revents & (POLLIN | POLLERR | POLLHUP)) && wl_display_dispatch(state.wl_display) < 0) {
+            fprintf(stderr, "Lost the connection to the compositor.\n");
+            break;
+        }
+        if (fds[1].revents & POLLIN)
+            commit_finished(&state);
+    }
+
+    pthread_mutex_lock(&state.lock);
+    state.quit = true;
+    pthread_cond_signal(&state.wake);
+    pthread_mutex_unlock(&state.lock);
+    pthread_join(state.worker, NULL);
+
+    double elapsed = (monotonic_ns() - start) / 1e9;
+    for (uint32_t i = 0; i < state.surface_count; ++i) {
+        const struct mw_surface *surface = &state.surfaces[i];
+        printf("surface %u %s: %.1f fps\n", i, surface->xdg_toplevel ? "toplevel" : "subsurface",
+               surface->total_frames / elapsed);
+    }
+
+    for (uint32_t i = state.surface_count; i-- > 0;)
+        surface_fini(&state.surfaces[i]);
+    pool_fini(&state.pool);
+    free(state.surfaces);
+    close(state.done_fd);
+    pthread_cond_destroy(&state.wake);
+    pthread_mutex_destroy(&state.lock);
+    wl_display_disconnect(state.wl_display);
+    return 0;
+}
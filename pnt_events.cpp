@@ -1,12 +1,23 @@
 #include <cerrno>
+#include <cmath>
 #include <fcntl.h>
 #include <cstring>
+#include <cstdlib>
 #include <sys/mman.h>
 #include <ctime>
 #include <unistd.h>
 #include <wayland-client.h>
 #include <cstdio>
+#include <csignal>
+#include <poll.h>
+#include <linux/input-event-codes.h>
 #include "xdg-shell-client-protocol.h"
+#include "input_record.h"
+#include "input_latency.h"
+#include "pointer_cursor.h"
+#include "relative-pointer-unstable-v1-client-protocol.h"
+#include "pointer-constraints-unstable-v1-client-protocol.h"
+#include "widget_layer.h"
 
 /* Shared memory support code */
 static void randname(char *buf) {
@@ -58,6 +69,7 @@ enum pointer_event_mask {
     POINTER_EVENT_AXIS_SOURCE = 1 << 5,
     POINTER_EVENT_AXIS_STOP = 1 << 6,
     POINTER_EVENT_AXIS_DISCRETE = 1 << 7,
+    POINTER_EVENT_RELATIVE_MOTION = 1 << 8,
 };
 
 struct pointer_event {
@@ -72,6 +84,131 @@ struct pointer_event {
         int32_t discrete;
     } axes[2];
     uint32_t axis_source;
+    /* Sum of the relative motion events in this frame */
+    uint64_t utime;
+    double dx, dy;
+    double dx_unaccel, dy_unaccel;
+};
+
+#define TOUCH_MAX_POINTS 10
+
+/* Touch contacts in structure-of-arrays form, slots [0, count) are live */
+struct touch_points {
+    uint32_t count;
+    int32_t id[TOUCH_MAX_POINTS];
+    wl_fixed_t x[TOUCH_MAX_POINTS], y[TOUCH_MAX_POINTS];
+    uint32_t down_time[TOUCH_MAX_POINTS];
+    uint32_t time[TOUCH_MAX_POINTS];
+};
+
+enum touch_delta_mask {
+    TOUCH_DELTA_DOWN = 1 << 0,
+    TOUCH_DELTA_MOTION = 1 << 1,
+    TOUCH_DELTA_UP = 1 << 2,
+    TOUCH_DELTA_CANCEL = 1 << 3,
+};
+
+/* Per-frame contact changes, for gesture recognizers */
+struct touch_deltas {
+    uint32_t count;
+    int32_t id[TOUCH_MAX_POINTS];
+    uint32_t mask[TOUCH_MAX_POINTS];
+    wl_fixed_t dx[TOUCH_MAX_POINTS], dy[TOUCH_MAX_POINTS];
+};
+
+/*
+ * Vertical scroll engine: axis events only accumulate, the frame callback
+ * turns them into one offset per frame, predicted for when that frame is
+ * shown. Finger scrolling keeps its momentum after axis_stop.
+ */
+#define SCROLL_WHEEL_EASE_MS 60.0
+#define SCROLL_FRICTION_MS 325.0
+#define SCROLL_MIN_VELOCITY 0.02        /* Pixels per millisecond */
+
+struct scroll_engine {
+    uint32_t source;
+    /* Sum of every axis value received so far, plus momentum */
+    double target;
+    /* Pixels per millisecond, smoothed over recent axis events */
+    double velocity;
+    uint32_t last_sample;
+    bool kinetic;
+    /* Offset shown by the previous frame, and the frame pacing */
+    double shown;
+    uint32_t last_frame;
+    double frame_interval;
+};
+
+static void scroll_engine_axis(struct scroll_engine *scroll, uint32_t time, double value) {
+    scroll->kinetic = false;
+    scroll->target += value;
+    if (scroll->source == WL_POINTER_AXIS_SOURCE_WHEEL
+            || scroll->source == WL_POINTER_AXIS_SOURCE_WHEEL_TILT) {
+        scroll->velocity = 0;
+    } else if (scroll->last_sample != 0 && time != scroll->last_sample) {
+        double sample = value / (double) (time - scroll->last_sample);
+        scroll->velocity = scroll->velocity * 0.6 + sample * 0.4;
+    }
+    scroll->last_sample = time;
+}
+
+static void scroll_engine_stop(struct scroll_engine *scroll, uint32_t time) {
+    scroll->last_sample = 0;
+    scroll->kinetic = scroll->source == WL_POINTER_AXIS_SOURCE_FINGER
+            && fabs(scroll->velocity) > SCROLL_MIN_VELOCITY;
+    if (!scroll->kinetic)
+        scroll->velocity = 0;
+}
+
+/* Returns how far the content moves in the frame started at `time` */
+static double scroll_engine_frame(struct scroll_engine *scroll, uint32_t time) {
+    if (scroll->last_frame == 0) {
+        scroll->last_frame = time;
+        scroll->frame_interval = 16.0;
+        return 0;
+    }
+    double elapsed = time - scroll->last_frame;
+    scroll->last_frame = time;
+    if (elapsed <= 0)
+        return 0;
+    scroll->frame_interval = scroll->frame_interval * 0.9 + elapsed * 0.1;
+
+    if (scroll->kinetic) {
+        scroll->target += scroll->velocity * elapsed;
+        scroll->velocity *= exp(-elapsed / SCROLL_FRICTION_MS);
+        if (fabs(scroll->velocity) < SCROLL_MIN_VELOCITY) {
+            scroll->kinetic = false;
+            scroll->velocity = 0;
+        }
+    }
+
+    double shown;
+    if (scroll->last_sample != 0 && scroll->velocity != 0) {
+        /* Continuous scrolling: extrapolate to when this frame is presented */
+        double ahead = time + scroll->frame_interval - scroll->last_sample;
+        ahead = fmax(0.0, fmin(ahead, 2 * scroll->frame_interval));
+        shown = scroll->target + scroll->velocity * ahead;
+    } else if (scroll->source == WL_POINTER_AXIS_SOURCE_WHEEL
+               || scroll->source == WL_POINTER_AXIS_SOURCE_WHEEL_TILT) {
+        /* Wheel steps: ease toward the target instead of jumping */
+        shown = scroll->target + (scroll->shown - scroll->target)
+                                 * exp(-elapsed / SCROLL_WHEEL_EASE_MS);
+    } else {
+        shown = scroll->target;
+    }
+
+    double delta = shown - scroll->shown;
+    scroll->shown = shown;
+    return delta;
+}
+
+struct touch_state {
+    /* Built up by down/up/motion, made current on wl_touch.frame */
+    struct touch_points pending;
+    struct touch_deltas pending_deltas;
+    /* State as of the last wl_touch.frame */
+    struct touch_points current;
+    struct touch_deltas deltas;
 };
 
 /* Wayland code */
@@ -83,6 +220,10 @@ struct client_state {
     struct wl_compositor *wl_compositor;
     struct xdg_wm_base *xdg_wm_base;
     struct wl_seat *wl_seat;
+    struct wp_presentation *wp_presentation;
+    struct wp_cursor_shape_manager_v1 *cursor_shape_manager;
+    struct zwp_relative_pointer_manager_v1 *relative_pointer_manager;
+    struct zwp_pointer_constraints_v1 *pointer_constraints;
     /* Objects */
     struct wl_surface *wl_surface;
     struct xdg_surface *xdg_surface;
@@ -90,11 +231,26 @@ struct client_state {
     struct wl_keyboard *wl_keyboard;
     struct wl_pointer *wl_pointer;
     struct wl_touch *wl_touch;
+    struct zwp_relative_pointer_v1 *relative_pointer;
+    struct zwp_locked_pointer_v1 *locked_pointer;
+    struct input_recorder *recorder;
+    struct pointer_cursor *cursor;
+    struct widget_layer *widgets;
     /* State */
     float offset;
     uint32_t last_frame;
+    bool replaying;
+    /* Pointer position, driven by unaccelerated deltas while locked */
+    bool lock_pointer;
+    bool pointer_locked;
+    /* Serial of the last wl_pointer.enter, 0 while the pointer is outside */
+    uint32_t pointer_serial;
+    double pointer_x, pointer_y;
 
     struct pointer_event pointer_event;
+    struct input_latency latency;
+    struct touch_state touch;
+    struct scroll_engine scroll;
 };
 
 static void
@@ -107,6 +263,35 @@ static const struct wl_buffer_listener wl_buffer_listener = {
         .release = wl_buffer_release,
 };
 
+#define WIDGET_DASHBOARD_LAYERS 3
+
+/*
+ * Lays `count` tiles out over the surface, each a bit larger than its slot so
+ * neighbours overlap and the z-order decides which one is hit
+ */
+static struct widget_layer *create_dashboard(int32_t width, int32_t height, uint32_t count) {
+    struct widget_layer *layer = widget_layer_create(width, height);
+    if (!layer)
+        return NULL;
+    uint32_t columns = (uint32_t) ceil(sqrt(count * (double) width / height));
+    uint32_t rows = (count + columns - 1) / columns;
+    double slot_w = (double) width / columns, slot_h = (double) height / rows;
+    for (uint32_t i = 0; i < count; ++i) {
+        struct widget widget = {};
+        widget.x = (int32_t) ((i % columns) * slot_w);
+        widget.y = (int32_t) ((i / columns) * slot_h);
+        widget.width = (int32_t) ceil(slot_w * 1.25);
+        widget.height = (int32_t) ceil(slot_h * 1.25);
+        widget.z = (int32_t) (i * 7 % WIDGET_DASHBOARD_LAYERS);
+        widget.color = 0x204080 + (i * 0x050301 & 0x3F3F3F);
+        if (widget_layer_add(layer, &widget) == WIDGET_NONE) {
+            widget_layer_destroy(layer);
+            return NULL;
+        }
+    }
+    return layer;
+}
+
 static struct wl_buffer *draw_frame(struct client_state *state) {
     const int width = 640, height = 480;
     int stride = width * 4;
@@ -141,6 +326,25 @@ static struct wl_buffer *draw_frame(struct client_state *state) {
         }
     }
 
+    /* Widgets on top, bottom to top so the z-order matches hit testing */
+    struct widget_layer *layer = state->widgets;
+    for (int32_t z = 0; layer && z < WIDGET_DASHBOARD_LAYERS; ++z) {
+        for (uint32_t i = 0; i < layer->count; ++i) {
+            const struct widget *widget = &layer->widgets[i];
+            if (widget->z != z)
+                continue;
+            uint32_t color = widget->color;
+            if (i == layer->pressed)
+                color = (color >> 1) & 0xFF7F7F7F;
+            else if (i == layer->hovered)
+                color = 0xFFFFFFFF;
+            for (int y = widget->y; y < widget->y + widget->height && y < height; ++y) {
+                for (int x = widget->x; x < widget->x + widget->width && x < width; ++x)
+                    data[y * width + x] = color | 0xFF000000;
+            }
+        }
+    }
+
     munmap(data, size);
     wl_buffer_add_listener(buffer, &wl_buffer_listener, NULL);
     return buffer;
@@ -161,6 +365,7 @@ static void xdg_surface_configure(void *data,
 
     struct wl_buffer *buffer = draw_frame(state);
     wl_surface_attach(state->wl_surface, buffer, 0, 0);
+    input_latency_commit(&state->latency, state->wl_surface);
     wl_surface_commit(state->wl_surface);
 }
 
@@ -192,16 +397,59 @@ wl_surface_frame_done(void *data, struct wl_callback *cb, uint32_t time) {
         int elapsed = time - state->last_frame;
         state->offset += elapsed / 1000.0 * 24;
     }
+    /* Plus whatever the pointer scrolled since the last frame */
+    state->offset += scroll_engine_frame(&state->scroll, time);
 
     /* Submit a frame for this event */
     struct wl_buffer *buffer = draw_frame(state);
     wl_surface_attach(state->wl_surface, buffer, 0, 0);
     wl_surface_damage_buffer(state->wl_surface, 0, 0, INT32_MAX, INT32_MAX);
+    input_latency_commit(&state->latency, state->wl_surface);
     wl_surface_commit(state->wl_surface);
 
     state->last_frame = time;
 }
 
+static void zwp_locked_pointer_v1_locked(void *data,
+                                         struct zwp_locked_pointer_v1 *zwp_locked_pointer_v1) {
+    struct client_state *client_state = static_cast<struct client_state *>(data);
+    client_state->pointer_locked = true;
+    fprintf(stderr, "pointer locked\n");
+}
+
+static void zwp_locked_pointer_v1_unlocked(void *data,
+                                           struct zwp_locked_pointer_v1 *zwp_locked_pointer_v1) {
+    struct client_state *client_state = static_cast<struct client_state *>(data);
+    client_state->pointer_locked = false;
+    fprintf(stderr, "pointer unlocked\n");
+}
+
+static const struct zwp_locked_pointer_v1_listener zwp_locked_pointer_v1_listener = {
+        .locked = zwp_locked_pointer_v1_locked,
+        .unlocked = zwp_locked_pointer_v1_unlocked,
+};
+
+static void zwp_relative_pointer_v1_relative_motion(void *data,
+                                                    struct zwp_relative_pointer_v1 *zwp_relative_pointer_v1,
+                                                    uint32_t utime_hi, uint32_t utime_lo,
+                                                    wl_fixed_t dx, wl_fixed_t dy,
+                                                    wl_fixed_t dx_unaccel, wl_fixed_t dy_unaccel) {
+    struct client_state *client_state = static_cast<struct client_state *>(data);
+    struct pointer_event *event = &client_state->pointer_event;
+    /* Sent within the wl_pointer frame, so several can add up before it ends */
+    event->event_mask |= POINTER_EVENT_RELATIVE_MOTION;
+    event->utime = ((uint64_t) utime_hi << 32) | utime_lo;
+    event->dx += wl_fixed_to_double(dx);
+    event->dy += wl_fixed_to_double(dy);
+    event->dx_unaccel += wl_fixed_to_double(dx_unaccel);
+    event->dy_unaccel += wl_fixed_to_double(dy_unaccel);
+    input_latency_event(&client_state->latency, (uint32_t) (event->utime / 1000));
+}
+
+static const struct zwp_relative_pointer_v1_listener zwp_relative_pointer_v1_listener = {
+        .relative_motion = zwp_relative_pointer_v1_relative_motion,
+};
+
 static void
 wl_pointer_enter(void *data, struct wl_pointer *wl_pointer,
                  uint32_t serial, struct wl_surface *surface,
@@ -211,6 +459,17 @@ wl_pointer_enter(void *data, struct wl_pointer *wl_pointer,
     client_state->pointer_event.serial = serial;
     client_state->pointer_event.surface_x = surface_x,
             client_state->pointer_event.surface_y = surface_y;
+
+    /* Replayed events carry no proxies, there is nothing to lock */
+    if (client_state->lock_pointer && client_state->pointer_constraints
+            && !client_state->replaying && wl_pointer
+            && !client_state->locked_pointer) {
+        client_state->locked_pointer = zwp_pointer_constraints_v1_lock_pointer(
+                client_state->pointer_constraints, surface, wl_pointer, NULL,
+                ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_PERSISTENT);
+        zwp_locked_pointer_v1_add_listener(client_state->locked_pointer,
+                                           &zwp_locked_pointer_v1_listener, client_state);
+    }
 }
 
 static void wl_pointer_leave(void *data, struct wl_pointer *wl_pointer,
@@ -225,6 +484,7 @@ static void wl_pointer_motion(void *data, struct wl_pointer *wl_pointer, uint32_
     struct client_state *client_state = static_cast<struct client_state *>(data);
     client_state->pointer_event.event_mask |= POINTER_EVENT_MOTION;
     client_state->pointer_event.time = time;
+    input_latency_event(&client_state->latency, time);
     client_state->pointer_event.surface_x = surface_x,
             client_state->pointer_event.surface_y = surface_y;
 }
@@ -234,6 +494,7 @@ static void wl_pointer_button(void *data, struct wl_pointer *wl_pointer, uint32_
     struct client_state *client_state = static_cast<struct client_state *>(data);
     client_state->pointer_event.event_mask |= POINTER_EVENT_BUTTON;
     client_state->pointer_event.time = time;
+    input_latency_event(&client_state->latency, time);
     client_state->pointer_event.serial = serial;
     client_state->pointer_event.button = button,
             client_state->pointer_event.state = state;
@@ -245,6 +506,7 @@ wl_pointer_axis(void *data, struct wl_pointer *wl_pointer, uint32_t time,
     struct client_state *client_state = static_cast<struct client_state *>(data);
     client_state->pointer_event.event_mask |= POINTER_EVENT_AXIS;
     client_state->pointer_event.time = time;
+    input_latency_event(&client_state->latency, time);
     client_state->pointer_event.axes[axis].valid = true;
     client_state->pointer_event.axes[axis].value = value;
 }
@@ -260,6 +522,7 @@ static void wl_pointer_axis_stop(void *data, struct wl_pointer *wl_pointer,
                                  uint32_t time, uint32_t axis) {
     struct client_state *client_state = static_cast<struct client_state *>(data);
     client_state->pointer_event.time = time;
+    input_latency_event(&client_state->latency, time);
     client_state->pointer_event.event_mask |= POINTER_EVENT_AXIS_STOP;
     client_state->pointer_event.axes[axis].valid = true;
 }
@@ -276,6 +539,70 @@ static void
 wl_pointer_frame(void *data, struct wl_pointer *wl_pointer) {
     struct client_state *client_state = static_cast<struct client_state *>(data);
     struct pointer_event *event = &client_state->pointer_event;
+
+    /* Feed the vertical axis to the scroll engine, the frame callback draws it */
+    struct scroll_engine *scroll = &client_state->scroll;
+    if (event->event_mask & POINTER_EVENT_AXIS_SOURCE)
+        scroll->source = event->axis_source;
+    if (event->axes[WL_POINTER_AXIS_VERTICAL_SCROLL].valid) {
+        if ((event->event_mask & POINTER_EVENT_AXIS)
+                && event->axes[WL_POINTER_AXIS_VERTICAL_SCROLL].value != 0) {
+            scroll_engine_axis(scroll, event->time, wl_fixed_to_double(
+                    event->axes[WL_POINTER_AXIS_VERTICAL_SCROLL].value));
+        }
+        if (event->event_mask & POINTER_EVENT_AXIS_STOP)
+            scroll_engine_stop(scroll, event->time);
+    }
+
+    /*
+     * Absolute motion stops while the pointer is locked, the position then
+     * follows the raw device deltas instead, at full resolution
+     */
+    bool moved = false;
+    if (event->event_mask & (POINTER_EVENT_ENTER | POINTER_EVENT_MOTION)) {
+        client_state->pointer_x = wl_fixed_to_double(event->surface_x);
+        client_state->pointer_y = wl_fixed_to_double(event->surface_y);
+        moved = true;
+    }
+    if ((event->event_mask & POINTER_EVENT_RELATIVE_MOTION) && client_state->pointer_locked) {
+        client_state->pointer_x = fmin(fmax(client_state->pointer_x + event->dx_unaccel, 0), 639);
+        client_state->pointer_y = fmin(fmax(client_state->pointer_y + event->dy_unaccel, 0), 479);
+        /* Where the cursor reappears once unlocked, applied on the next commit */
+        zwp_locked_pointer_v1_set_cursor_position_hint(client_state->locked_pointer,
+                                                       wl_fixed_from_double(client_state->pointer_x),
+                                                       wl_fixed_from_double(client_state->pointer_y));
+        moved = true;
+    }
+
+    /* Resolve hover and click targets against the widget layer */
+    struct widget_update update = WIDGET_UPDATE_INIT;
+    if (client_state->widgets) {
+        struct widget_layer *layer = client_state->widgets;
+        if (event->event_mask & POINTER_EVENT_LEAVE)
+            widget_layer_leave(layer, &update);
+        if (moved)
+            widget_layer_motion(layer, client_state->pointer_x, client_state->pointer_y, &update);
+        if ((event->event_mask & POINTER_EVENT_BUTTON) && event->button == BTN_LEFT) {
+            widget_layer_button(layer, event->state == WL_POINTER_BUTTON_STATE_PRESSED,
+                                &update);
+        }
+    }
+
+    /* The compositor forgets the cursor on leave, set it again on every enter */
+    if (event->event_mask & POINTER_EVENT_ENTER)
+        client_state->pointer_serial = event->serial;
+    if (event->event_mask & POINTER_EVENT_LEAVE)
+        client_state->pointer_serial = 0;
+    if (client_state->pointer_serial != 0 && client_state->cursor && client_state->wl_pointer) {
+        enum pointer_cursor_shape shape = POINTER_CURSOR_DEFAULT;
+        if (client_state->widgets && client_state->widgets->pressed != WIDGET_NONE)
+            shape = POINTER_CURSOR_GRABBING;
+        else if (client_state->widgets && client_state->widgets->hovered != WIDGET_NONE)
+            shape = POINTER_CURSOR_POINTER;
+        pointer_cursor_set(client_state->cursor, client_state->wl_pointer,
+                           client_state->pointer_serial, shape);
+    }
+
     fprintf(stderr, "pointer frame @ %d: ", event->time);
 
     if (event->event_mask & POINTER_EVENT_ENTER) {
@@ -294,6 +621,12 @@ wl_pointer_frame(void *data, struct wl_pointer *wl_pointer) {
                 wl_fixed_to_double(event->surface_y));
     }
 
+    if (event->event_mask & POINTER_EVENT_RELATIVE_MOTION) {
+        fprintf(stderr, "relative %f, %f unaccelerated %f, %f @ %llu us ",
+                event->dx, event->dy, event->dx_unaccel, event->dy_unaccel,
+                (unsigned long long) event->utime);
+    }
+
     if (event->event_mask & POINTER_EVENT_BUTTON) {
         char *state = const_cast<char *>(event->state == WL_POINTER_BUTTON_STATE_RELEASED ?
                                          "released" : "pressed");
@@ -338,6 +671,15 @@ wl_pointer_frame(void *data, struct wl_pointer *wl_pointer) {
         }
     }
 
+    if (update.count > 0) {
+        fprintf(stderr, "invalidates");
+        for (uint32_t i = 0; i < update.count; ++i)
+            fprintf(stderr, " #%u", update.invalidated[i]);
+        fprintf(stderr, " ");
+    }
+    if (update.clicked != WIDGET_NONE)
+        fprintf(stderr, "clicked #%u ", update.clicked);
+
     fprintf(stderr, "\n");
     memset(event, 0, sizeof(*event));
 }
@@ -354,19 +696,197 @@ static const struct wl_pointer_listener wl_pointer_listener = {
         .axis_discrete = wl_pointer_axis_discrete,
 };
 
+static int touch_points_find(const struct touch_points *points, int32_t id) {
+    for (uint32_t i = 0; i < points->count; ++i) {
+        if (points->id[i] == id)
+            return i;
+    }
+    return -1;
+}
+
+static int touch_deltas_get(struct touch_deltas *deltas, int32_t id) {
+    for (uint32_t i = 0; i < deltas->count; ++i) {
+        if (deltas->id[i] == id)
+            return i;
+    }
+    if (deltas->count == TOUCH_MAX_POINTS)
+        return -1;
+    uint32_t i = deltas->count++;
+    deltas->id[i] = id;
+    deltas->mask[i] = 0;
+    deltas->dx[i] = deltas->dy[i] = 0;
+    return i;
+}
+
+static void wl_touch_down(void *data, struct wl_touch *wl_touch, uint32_t serial,
+                          uint32_t time, struct wl_surface *surface, int32_t id,
+                          wl_fixed_t x, wl_fixed_t y) {
+    struct client_state *client_state = static_cast<struct client_state *>(data);
+    struct touch_points *points = &client_state->touch.pending;
+    input_latency_event(&client_state->latency, time);
+    if (points->count == TOUCH_MAX_POINTS || touch_points_find(points, id) >= 0)
+        return;
+    uint32_t i = points->count++;
+    points->id[i] = id;
+    points->x[i] = x, points->y[i] = y;
+    points->down_time[i] = points->time[i] = time;
+
+    int d = touch_deltas_get(&client_state->touch.pending_deltas, id);
+    if (d >= 0)
+        client_state->touch.pending_deltas.mask[d] |= TOUCH_DELTA_DOWN;
+}
+
+static void wl_touch_up(void *data, struct wl_touch *wl_touch, uint32_t serial,
+                        uint32_t time, int32_t id) {
+    struct client_state *client_state = static_cast<struct client_state *>(data);
+    struct touch_points *points = &client_state->touch.pending;
+    input_latency_event(&client_state->latency, time);
+    int i = touch_points_find(points, id);
+    if (i < 0)
+        return;
+    /* Keep the arrays dense by moving the last contact into the hole */
+    uint32_t last = --points->count;
+    points->id[i] = points->id[last];
+    points->x[i] = points->x[last], points->y[i] = points->y[last];
+    points->down_time[i] = points->down_time[last];
+    points->time[i] = points->time[last];
+
+    int d = touch_deltas_get(&client_state->touch.pending_deltas, id);
+    if (d >= 0)
+        client_state->touch.pending_deltas.mask[d] |= TOUCH_DELTA_UP;
+}
+
+static void wl_touch_motion(void *data, struct wl_touch *wl_touch, uint32_t time,
+                            int32_t id, wl_fixed_t x, wl_fixed_t y) {
+    struct client_state *client_state = static_cast<struct client_state *>(data);
+    struct touch_points *points = &client_state->touch.pending;
+    input_latency_event(&client_state->latency, time);
+    int i = touch_points_find(points, id);
+    if (i < 0)
+        return;
+
+    struct touch_deltas *deltas = &client_state->touch.pending_deltas;
+    int d = touch_deltas_get(deltas, id);
+    if (d >= 0) {
+        deltas->mask[d] |= TOUCH_DELTA_MOTION;
+        deltas->dx[d] += x - points->x[i];
+        deltas->dy[d] += y - points->y[i];
+    }
+    points->x[i] = x, points->y[i] = y;
+    points->time[i] = time;
+}
+
+static void wl_touch_frame(void *data, struct wl_touch *wl_touch) {
+    struct client_state *client_state = static_cast<struct client_state *>(data);
+    struct touch_state *touch = &client_state->touch;
+    touch->current = touch->pending;
+    touch->deltas = touch->pending_deltas;
+    touch->pending_deltas.count = 0;
+
+    /* A single contact dragging vertically scrolls the checkerboard */
+    if (touch->current.count == 1 && touch->deltas.count == 1
+            && (touch->deltas.mask[0] & TOUCH_DELTA_MOTION)) {
+        client_state->offset -= wl_fixed_to_double(touch->deltas.dy[0]);
+    }
+
+    fprintf(stderr, "touch frame: %u contacts", touch->current.count);
+    for (uint32_t i = 0; i < touch->deltas.count; ++i) {
+        fprintf(stderr, ", id %d%s%s%s", touch->deltas.id[i],
+                touch->deltas.mask[i] & TOUCH_DELTA_DOWN ? " down" : "",
+                touch->deltas.mask[i] & TOUCH_DELTA_MOTION ? " motion" : "",
+                touch->deltas.mask[i] & TOUCH_DELTA_UP ? " up" : "");
+    }
+    fprintf(stderr, "\n");
+}
+
+static void wl_touch_cancel(void *data, struct wl_touch *wl_touch) {
+    /* The compositor took over the sequence, every contact ends now */
+    struct client_state *client_state = static_cast<struct client_state *>(data);
+    struct touch_state *touch = &client_state->touch;
+    struct touch_deltas *deltas = &touch->deltas;
+    deltas->count = touch->current.count;
+    for (uint32_t i = 0; i < deltas->count; ++i) {
+        deltas->id[i] = touch->current.id[i];
+        deltas->mask[i] = TOUCH_DELTA_UP | TOUCH_DELTA_CANCEL;
+        deltas->dx[i] = deltas->dy[i] = 0;
+    }
+    touch->current.count = 0;
+    touch->pending.count = 0;
+    touch->pending_deltas.count = 0;
+    fprintf(stderr, "touch cancel\n");
+}
+
+static void wl_touch_shape(void *data, struct wl_touch *wl_touch,
+                           int32_t id, wl_fixed_t major, wl_fixed_t minor) {
+    /* Contact shape is not tracked */
+}
+
+static void wl_touch_orientation(void *data, struct wl_touch *wl_touch,
+                                 int32_t id, wl_fixed_t orientation) {
+    /* Contact orientation is not tracked */
+}
+
+static const struct wl_touch_listener wl_touch_listener = {
+        .down = wl_touch_down,
+        .up = wl_touch_up,
+        .motion = wl_touch_motion,
+        .frame = wl_touch_frame,
+        .cancel = wl_touch_cancel,
+        .shape = wl_touch_shape,
+        .orientation = wl_touch_orientation,
+};
+
 static void wl_seat_capabilities(void *data, struct wl_seat *wl_seat, uint32_t capabilities) {
     struct client_state *state = static_cast<client_state *>(data);
+    if (state->replaying) {
+        /* Input comes from the recording instead */
+        return;
+    }
 
     bool have_pointer = capabilities & WL_SEAT_CAPABILITY_POINTER;
 
     if (have_pointer && state->wl_pointer == NULL) {
         state->wl_pointer = wl_seat_get_pointer(state->wl_seat);
-        wl_pointer_add_listener(state->wl_pointer,
-                                &wl_pointer_listener, state);
+        if (state->recorder)
+            input_recorder_add_pointer_listener(state->recorder, state->wl_pointer);
+        else
+            wl_pointer_add_listener(state->wl_pointer,
+                                    &wl_pointer_listener, state);
+        if (state->relative_pointer_manager) {
+            state->relative_pointer = zwp_relative_pointer_manager_v1_get_relative_pointer(
+                    state->relative_pointer_manager, state->wl_pointer);
+            zwp_relative_pointer_v1_add_listener(state->relative_pointer,
+                                                 &zwp_relative_pointer_v1_listener, state);
+        }
     } else if (!have_pointer && state->wl_pointer != NULL) {
+        if (state->locked_pointer) {
+            zwp_locked_pointer_v1_destroy(state->locked_pointer);
+            state->locked_pointer = NULL;
+            state->pointer_locked = false;
+        }
+        if (state->relative_pointer) {
+            zwp_relative_pointer_v1_destroy(state->relative_pointer);
+            state->relative_pointer = NULL;
+        }
+        if (state->cursor)
+            pointer_cursor_forget(state->cursor, state->wl_pointer);
         wl_pointer_release(state->wl_pointer);
         state->wl_pointer = NULL;
     }
+
+    bool have_touch = capabilities & WL_SEAT_CAPABILITY_TOUCH;
+
+    if (have_touch && state->wl_touch == NULL) {
+        state->wl_touch = wl_seat_get_touch(state->wl_seat);
+        if (state->recorder)
+            input_recorder_add_touch_listener(state->recorder, state->wl_touch);
+        else
+            wl_touch_add_listener(state->wl_touch,
+                                  &wl_touch_listener, state);
+    } else if (!have_touch && state->wl_touch != NULL) {
+        wl_touch_release(state->wl_touch);
+        state->wl_touch = NULL;
+    }
 }
 
 static void wl_seat_name(void *data, struct wl_seat *wl_seat, const char *name) {
@@ -396,6 +916,19 @@ static void registry_global(void *data, struct wl_registry *wl_registry,
         state->wl_seat = static_cast<wl_seat *>(wl_registry_bind(
                 wl_registry, name, &wl_seat_interface, 5/*7*/));
         wl_seat_add_listener(state->wl_seat, &wl_seat_listener, state);
+    } else if (strcmp(interface, wp_presentation_interface.name) == 0) {
+        state->wp_presentation = static_cast<wp_presentation *>(wl_registry_bind(
+                wl_registry, name, &wp_presentation_interface, 1));
+        input_latency_set_presentation(&state->latency, state->wp_presentation);
+    } else if (strcmp(interface, wp_cursor_shape_manager_v1_interface.name) == 0) {
+        state->cursor_shape_manager = static_cast<wp_cursor_shape_manager_v1 *>(wl_registry_bind(
+                wl_registry, name, &wp_cursor_shape_manager_v1_interface, 1));
+    } else if (strcmp(interface, zwp_relative_pointer_manager_v1_interface.name) == 0) {
+        state->relative_pointer_manager = static_cast<zwp_relative_pointer_manager_v1 *>(
+                wl_registry_bind(wl_registry, name, &zwp_relative_pointer_manager_v1_interface, 1));
+    } else if (strcmp(interface, zwp_pointer_constraints_v1_interface.name) == 0) {
+        state->pointer_constraints = static_cast<zwp_pointer_constraints_v1 *>(
+                wl_registry_bind(wl_registry, name, &zwp_pointer_constraints_v1_interface, 1));
     }
 }
 
@@ -409,12 +942,55 @@ static const struct wl_registry_listener wl_registry_listener = {
         .global_remove = registry_global_remove,
 };
 
+static volatile sig_atomic_t running = 1;
+
+static void handle_signal(int signum) {
+    running = 0;
+}
+
 int main(int argc, char *argv[]) {
+    const char *record_path = NULL, *replay_path = NULL;
+    bool realtime = true;
+    uint32_t widget_count = 100;
+    bool lock_pointer = false;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--fast") == 0) {
+            realtime = false;
+        } else if (strcmp(argv[i], "--lock") == 0) {
+            lock_pointer = true;
+        } else if (strcmp(argv[i], "--widgets") == 0 && i + 1 < argc) {
+            widget_count = (uint32_t) strtoul(argv[++i], NULL, 10);
+        } else {
+            fprintf(stderr, "usage: %s [--record FILE | --replay FILE [--fast]] [--widgets N] [--lock]\n", argv[0]);
+            return 1;
+        }
+    }
+
     struct client_state state = {0};
+    struct input_listeners listeners = {&wl_pointer_listener, NULL, &wl_touch_listener, &state};
+    if (record_path) {
+        state.recorder = input_recorder_create(record_path, &listeners);
+        if (!state.recorder)
+            return 1;
+    }
+    state.replaying = replay_path != NULL;
+    state.lock_pointer = lock_pointer;
+    if (widget_count > 0) {
+        state.widgets = create_dashboard(640, 480, widget_count);
+        if (!state.widgets)
+            return 1;
+    }
+    input_latency_init(&state.latency);
     state.wl_display = wl_display_connect(NULL);
     state.wl_registry = wl_display_get_registry(state.wl_display);
     wl_registry_add_listener(state.wl_registry, &wl_registry_listener, &state);
     wl_display_roundtrip(state.wl_display);
+    state.cursor = pointer_cursor_create(state.wl_compositor, state.wl_shm,
+                                         state.cursor_shape_manager);
 
     state.wl_surface = wl_compositor_create_surface(state.wl_compositor);
     state.xdg_surface = xdg_wm_base_get_xdg_surface(
@@ -427,9 +1003,47 @@ int main(int argc, char *argv[]) {
     struct wl_callback *cb = wl_surface_frame(state.wl_surface);
     wl_callback_add_listener(cb, &wl_surface_frame_listener, &state);
 
-    while (wl_display_dispatch(state.wl_display)) {
-        /* This space deliberately left blank */
+    struct input_replay *replay = NULL;
+    if (replay_path) {
+        replay = input_replay_create(replay_path, &listeners, state.wl_surface, realtime);
+        if (!replay)
+            return 1;
+    }
+
+    /* Stop cleanly on a signal so the recording is complete */
+    struct sigaction sa = {};
+    sa.sa_handler = handle_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    while (running) {
+        if (replay && !input_replay_dispatch(replay))
+            break;
+        while (wl_display_prepare_read(state.wl_display) != 0)
+            wl_display_dispatch_pending(state.wl_display);
+        wl_display_flush(state.wl_display);
+
+        struct pollfd pfd = {wl_display_get_fd(state.wl_display), POLLIN, 0};
+        int timeout = replay ? input_replay_timeout(replay) : -1;
+        if (poll(&pfd, 1, timeout) > 0) {
+            if (wl_display_read_events(state.wl_display) < 0)
+                break;
+        } else {
+            wl_display_cancel_read(state.wl_display);
+        }
+        if (wl_display_dispatch_pending(state.wl_display) < 0)
+            break;
     }
 
+    input_latency_report(&state.latency);
+    if (replay)
+        input_replay_destroy(replay);
+    if (state.recorder)
+        input_recorder_destroy(state.recorder);
+    if (state.cursor)
+        pointer_cursor_destroy(state.cursor);
+    if (state.widgets)
+        widget_layer_destroy(state.widgets);
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,129 @@
+#include <cstdio>
+#include <cstdlib>
+#include <wayland-cursor.h>
+#include "pointer_cursor.h"
+
+#define POINTER_CURSOR_DEFAULT_SIZE 24
+
+/* Shape for the protocol, and cursor names to look up in the theme */
+static const struct {
+    uint32_t shape;
+    const char *names[3];
+} pointer_cursor_shapes[POINTER_CURSOR_SHAPES] = {
+        [POINTER_CURSOR_DEFAULT] = {WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_DEFAULT,
+                                    {"default", "left_ptr", NULL}},
+        [POINTER_CURSOR_POINTER] = {WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_POINTER,
+                                    {"pointer", "hand2", "hand1"}},
+        [POINTER_CURSOR_TEXT] = {WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_TEXT,
+                                 {"text", "xterm", NULL}},
+        [POINTER_CURSOR_GRABBING] = {WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_GRABBING,
+                                     {"grabbing", "closedhand", "fleur"}},
+        [POINTER_CURSOR_CROSSHAIR] = {WP_CURSOR_SHAPE_DEVICE_V1_SHAPE_CROSSHAIR,
+                                      {"crosshair", "cross", NULL}},
+};
+
+struct pointer_cursor {
+    /* Server-side shapes */
+    struct wp_cursor_shape_manager_v1 *shape_manager;
+    struct wp_cursor_shape_device_v1 *shape_device;
+    struct wl_pointer *pointer;
+    /* Client-side fallback, the buffers belong to the theme */
+    struct wl_cursor_theme *theme;
+    struct wl_cursor_image *images[POINTER_CURSOR_SHAPES];
+    struct wl_surface *surface;
+    int attached;
+    /* What the compositor was last told, to skip repeated requests */
+    uint32_t serial;
+    int shape;
+};
+
+struct pointer_cursor *pointer_cursor_create(struct wl_compositor *compositor,
+                                             struct wl_shm *shm,
+                                             struct wp_cursor_shape_manager_v1 *shape_manager) {
+    struct pointer_cursor *cursor =
+            static_cast<struct pointer_cursor *>(calloc(1, sizeof(*cursor)));
+    if (!cursor)
+        return NULL;
+    cursor->shape_manager = shape_manager;
+    cursor->attached = -1;
+    cursor->shape = -1;
+    if (shape_manager)
+        return cursor;
+
+    const char *size_env = getenv("XCURSOR_SIZE");
+    int size = size_env ? atoi(size_env) : 0;
+    cursor->theme = wl_cursor_theme_load(getenv("XCURSOR_THEME"),
+                                         size > 0 ? size : POINTER_CURSOR_DEFAULT_SIZE, shm);
+    if (!cursor->theme) {
+        fprintf(stderr, "no cursor theme, keeping the compositor's cursor\n");
+        return cursor;
+    }
+    for (int i = 0; i < POINTER_CURSOR_SHAPES; ++i) {
+        for (int n = 0; n < 3 && pointer_cursor_shapes[i].names[n]; ++n) {
+            struct wl_cursor *wl_cursor =
+                    wl_cursor_theme_get_cursor(cursor->theme, pointer_cursor_shapes[i].names[n]);
+            if (wl_cursor && wl_cursor->image_count > 0) {
+                cursor->images[i] = wl_cursor->images[0];
+                break;
+            }
+        }
+        if (!cursor->images[i])
+            cursor->images[i] = cursor->images[POINTER_CURSOR_DEFAULT];
+    }
+    cursor->surface = wl_compositor_create_surface(compositor);
+    return cursor;
+}
+
+void pointer_cursor_destroy(struct pointer_cursor *cursor) {
+    if (cursor->shape_device)
+        wp_cursor_shape_device_v1_destroy(cursor->shape_device);
+    if (cursor->surface)
+        wl_surface_destroy(cursor->surface);
+    if (cursor->theme)
+        wl_cursor_theme_destroy(cursor->theme);
+    free(cursor);
+}
+
+void pointer_cursor_set(struct pointer_cursor *cursor, struct wl_pointer *pointer,
+                        uint32_t serial, enum pointer_cursor_shape shape) {
+    if (pointer != cursor->pointer) {
+        pointer_cursor_forget(cursor, cursor->pointer);
+        cursor->pointer = pointer;
+    }
+    if (serial == cursor->serial && (int) shape == cursor->shape)
+        return;
+    cursor->serial = serial;
+    cursor->shape = shape;
+
+    if (cursor->shape_manager) {
+        if (!cursor->shape_device)
+            cursor->shape_device = wp_cursor_shape_manager_v1_get_pointer(cursor->shape_manager, pointer);
+        wp_cursor_shape_device_v1_set_shape(cursor->shape_device, serial,
+                                            pointer_cursor_shapes[shape].shape);
+        return;
+    }
+
+    struct wl_cursor_image *image = cursor->images[shape];
+    if (!image)
+        return;
+    if (cursor->attached != (int) shape) {
+        /* Only the surface changes, the buffer was uploaded with the theme */
+        wl_surface_attach(cursor->surface, wl_cursor_image_get_buffer(image), 0, 0);
+        wl_surface_damage_buffer(cursor->surface, 0, 0, INT32_MAX, INT32_MAX);
+        wl_surface_commit(cursor->surface);
+        cursor->attached = shape;
+    }
+    wl_pointer_set_cursor(pointer, serial, cursor->surface,
+                          (int32_t) image->hotspot_x, (int32_t) image->hotspot_y);
+}
+
+void pointer_cursor_forget(struct pointer_cursor *cursor, struct wl_pointer *pointer) {
+    if (!pointer || pointer != cursor->pointer)
+        return;
+    if (cursor->shape_device) {
+        wp_cursor_shape_device_v1_destroy(cursor->shape_device);
+        cursor->shape_device = NULL;
+    }
+    cursor->pointer = NULL;
+    cursor->shape = -1;
+}
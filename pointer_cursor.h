@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <wayland-client.h>
+#include "cursor-shape-v1-client-protocol.h"
+
+/*
+ * Pointer cursor management
+ *
+ * With wp_cursor_shape_v1 the compositor draws its own cursor and the client
+ * only names a shape. Without it the cursor theme is loaded once through
+ * wayland-cursor: every shape keeps the wl_buffer of its image for the whole
+ * run and a single cursor surface gets the buffer re-attached only when the
+ * shape changes, so re-entering the window never uploads pixels again.
+ * Animated cursors show their first frame.
+ */
+
+enum pointer_cursor_shape {
+    POINTER_CURSOR_DEFAULT,
+    POINTER_CURSOR_POINTER,
+    POINTER_CURSOR_TEXT,
+    POINTER_CURSOR_GRABBING,
+    POINTER_CURSOR_CROSSHAIR,
+    POINTER_CURSOR_SHAPES,
+};
+
+struct pointer_cursor;
+
+/* `shape_manager` may be NULL, the cursor theme is used then */
+struct pointer_cursor *pointer_cursor_create(struct wl_compositor *compositor,
+                                             struct wl_shm *shm,
+                                             struct wp_cursor_shape_manager_v1 *shape_manager);
+void pointer_cursor_destroy(struct pointer_cursor *cursor);
+/* `serial` is the one of the latest wl_pointer.enter, repeated calls are cheap */
+void pointer_cursor_set(struct pointer_cursor *cursor, struct wl_pointer *pointer,
+                        uint32_t serial, enum pointer_cursor_shape shape);
+/* Call before the wl_pointer is released */
+void pointer_cursor_forget(struct pointer_cursor *cursor, struct wl_pointer *pointer);
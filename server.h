@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stdint.h>
+#include <wayland-server.h>
+#include "server_accounting.h"
+#include "server_capture.h"
+#include "server_composite.h"
+#include "server_region.h"
+#include "server_scene.h"
+
+/*
+ * Headless compositor state, shared by the display_create.cpp modules
+ *
+ * Surfaces keep a private copy of their last committed SHM buffer, which is
+ * released right away, and every output composites the mapped surfaces into
+ * its own XRGB8888 image on each virtual vblank.
+ *
+ * Vblanks either follow CLOCK_MONOTONIC on a fixed grid per output, or, in
+ * virtual time mode, a private timeline that only moves once every client
+ * that was sent a frame callback has committed again.
+ */
+
+#define SERVER_MAX_OUTPUTS 8
+#define SERVER_MAX_INPUTS 8
+#define SERVER_MIN_REFRESH_MHZ 30000
+#define SERVER_MAX_REFRESH_MHZ 240000
+
+struct server;
+
+struct server_output {
+    struct server *server;
+    struct wl_global *global;
+    struct wl_list resources;
+    struct wl_list link;
+    int32_t x, y;
+    int32_t width, height;
+    int32_t refresh_mhz;
+    uint32_t index;                 /* Bit in server_surface::outputs */
+    uint32_t *pixels;
+    struct wl_event_source *vblank; /* Unused in virtual time mode */
+    uint64_t period_ns;
+    uint64_t msc;                   /* Vblank counter, the presentation sequence */
+    /* Next vblank, in nanoseconds on the monotonic or the virtual timeline */
+    uint64_t next_vblank_ns;
+
+    struct server_scene scene;
+    struct server_capture *capture; /* NULL unless --capture */
+};
+
+enum server_surface_role {
+    SERVER_ROLE_NONE,
+    SERVER_ROLE_XDG_TOPLEVEL,
+    SERVER_ROLE_XDG_POPUP,
+    SERVER_ROLE_CURSOR,
+};
+
+struct server_surface_state {
+    struct wl_resource *buffer;
+    struct wl_listener buffer_destroy;
+    bool attached;
+    int32_t dx, dy;
+    int32_t scale;
+    /* Damage in surface and in buffer coordinates, merged on commit */
+    struct server_region damage;
+    struct server_region buffer_damage;
+    struct server_region opaque;
+    bool opaque_set;
+    struct wl_list frame_callbacks;
+    struct wl_list feedbacks;       /* wp_presentation_feedback resources */
+};
+
+struct server_surface {
+    struct server *server;
+    struct wl_resource *resource;
+    struct wl_list link;            /* server::surfaces, bottom to top */
+    struct server_surface_state pending;
+
+    /* Committed content */
+    uint32_t *pixels;
+    int32_t buffer_width, buffer_height;
+    int32_t scale;
+    bool has_alpha;
+    struct server_region opaque;
+    struct wl_list frame_callbacks;
+    struct wl_list feedbacks;
+    /* Frame done was sent and no commit has answered it yet */
+    bool awaiting_commit;
+
+    /* Outputs the surface is on, the first one drives its frame callbacks */
+    uint32_t outputs;
+    struct server_output *output;
+
+    /* Placement, in output coordinates */
+    enum server_surface_role role;
+    struct wl_resource *role_resource;
+    struct wl_resource *xdg_surface;
+    int32_t x, y;
+    bool configured;
+    bool mapped;
+    uint32_t configure_serial;
+};
+
+struct server_seat {
+    struct wl_global *global;
+    struct wl_list resources;
+    struct wl_list pointers;
+    struct wl_list keyboards;
+    struct wl_list touches;
+    struct server_surface *focus;
+    bool touch;                     /* Advertise touch for synthetic input */
+    int keymap_fd;
+    uint32_t keymap_size;
+};
+
+struct server {
+    struct wl_display *display;
+    struct wl_event_loop *loop;
+    struct wl_list surfaces;
+    struct wl_list outputs;
+    struct server_seat seat;
+    uint32_t toplevels;
+
+    struct server_compositor *compositor;
+    struct wl_list inputs;                      /* server_input::link */
+    struct wl_global *presentation;
+    struct server_accounting *accounting;       /* NULL unless --client-stats */
+    bool stats;                                 /* Log every composited frame */
+    bool virtual_time;
+    uint64_t virtual_now_ns;
+    struct wl_event_source *virtual_tick;       /* Pending idle advance */
+    struct wl_event_source *virtual_watchdog;
+};
+
+static inline int32_t server_surface_width(const struct server_surface *surface) {
+    return surface->buffer_width / surface->scale;
+}
+
+static inline int32_t server_surface_height(const struct server_surface *surface) {
+    return surface->buffer_height / surface->scale;
+}
+
+/* server_output.cpp */
+struct server_output *server_output_create(struct server *server, int32_t width, int32_t height,
+                                           int32_t refresh_mhz);
+void server_output_destroy(struct server_output *output);
+void server_clock_init(struct server *server, bool virtual_time);
+void server_clock_fini(struct server *server);
+void server_clock_surface_committed(struct server_surface *surface);
+void server_clock_surface_destroyed(struct server *server);
+void server_presentation_init(struct server *server);
+void server_feedbacks_discard(struct wl_list *feedbacks);
+void server_surface_update_outputs(struct server_surface *surface);
+/* Marks the whole surface, at its current place and size, for recomposition */
+void server_surface_damage(struct server_surface *surface);
+/* `damage` in surface coordinates */
+void server_surface_damage_region(struct server_surface *surface, const struct server_region *damage);
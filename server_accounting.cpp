@@ -0,0 +1,339 @@
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <unistd.h>
+#include "server_accounting.h"
+
+/* Messages listed per client in a dump */
+#define SERVER_ACCOUNTING_TOP 12
+
+enum server_accounting_direction {
+    SERVER_ACCOUNTING_REQUEST,
+    SERVER_ACCOUNTING_EVENT,
+};
+
+struct server_accounting_entry {
+    const char *interface;          /* NULL for a free slot */
+    const char *name;
+    uint32_t opcode;
+    enum server_accounting_direction direction;
+    uint64_t count;
+    uint64_t bytes;
+    uint64_t handler_ns;            /* Requests only */
+    uint64_t handler_max_ns;
+};
+
+struct server_accounting_client {
+    struct server_accounting *accounting;
+    struct wl_client *client;
+    struct wl_listener destroy;
+    struct wl_list link;
+    pid_t pid;
+    uint64_t connected_ns;
+
+    /* Open addressing on interface and opcode, never more than half full */
+    struct server_accounting_entry *entries;
+    uint32_t capacity;
+    uint32_t used;
+
+    uint64_t requests, events;
+    uint64_t request_bytes, event_bytes;
+    uint64_t fds;
+    uint64_t commits;
+    uint64_t shm_bytes;
+    uint64_t handler_ns;
+    uint64_t dumped_ns;             /* Time and commit count at the last dump */
+    uint64_t dumped_commits;
+};
+
+struct server_accounting {
+    struct wl_display *display;
+    struct wl_event_loop *loop;
+    struct wl_protocol_logger *logger;
+    struct wl_listener client_created;
+    struct wl_list clients;
+
+    /* The request whose handler is running */
+    struct server_accounting_client *running_client;
+    struct server_accounting_entry *running;
+    uint64_t running_start_ns;
+    struct wl_event_source *idle;
+};
+
+static uint64_t monotonic_ns() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void client_destroy(struct wl_listener *listener, void *data);
+
+static struct server_accounting_client *client_get(struct wl_client *client) {
+    struct wl_listener *listener = wl_client_get_destroy_listener(client, client_destroy);
+    if (!listener)
+        return NULL;
+    struct server_accounting_client *stats;
+    return wl_container_of(listener, stats, destroy);
+}
+
+static uint32_t entry_hash(const char *interface, uint32_t opcode, enum server_accounting_direction direction) {
+    uintptr_t key = (uintptr_t) interface ^ ((uintptr_t) opcode << 1 | direction);
+    key *= 0x9e3779b97f4a7c15ull;
+    return (uint32_t) (key >> 32);
+}
+
+static struct server_accounting_entry *entry_slot(struct server_accounting_entry *entries, uint32_t capacity,
+                                                  const char *interface, uint32_t opcode,
+                                                  enum server_accounting_direction direction) {
+    uint32_t i = entry_hash(interface, opcode, direction) & (capacity - 1);
+    for (;;) {
+        struct server_accounting_entry *entry = &entries[i];
+        if (!entry->interface || (entry->interface == interface && entry->opcode == opcode
+                                  && entry->direction == direction))
+            return entry;
+        i = (i + 1) & (capacity - 1);
+    }
+}
+
+static struct server_accounting_entry *client_entry(struct server_accounting_client *stats, const char *interface,
+                                                    uint32_t opcode, enum server_accounting_direction direction,
+                                                    const char *name) {
+    if (2 * (stats->used + 1) > stats->capacity) {
+        uint32_t capacity = stats->capacity ? stats->capacity * 2 : 64;
+        struct server_accounting_entry *entries =
+                static_cast<struct server_accounting_entry *>(calloc(capacity, sizeof(*entries)));
+        if (!entries)
+            return NULL;
+        for (uint32_t i = 0; i < stats->capacity; ++i) {
+            const struct server_accounting_entry *old = &stats->entries[i];
+            if (old->interface)
+                *entry_slot(entries, capacity, old->interface, old->opcode, old->direction) = *old;
+        }
+        /* The running entry moved */
+        struct server_accounting *accounting = stats->accounting;
+        if (accounting->running_client == stats)
+            accounting->running = entry_slot(entries, capacity, accounting->running->interface,
+                                             accounting->running->opcode, accounting->running->direction);
+        free(stats->entries);
+        stats->entries = entries;
+        stats->capacity = capacity;
+    }
+    struct server_accounting_entry *entry = entry_slot(stats->entries, stats->capacity, interface, opcode, direction);
+    if (!entry->interface) {
+        entry->interface = interface;
+        entry->name = name;
+        entry->opcode = opcode;
+        entry->direction = direction;
+        stats->used++;
+    }
+    return entry;
+}
+
+/* Size of the message on the wire, file descriptors travel beside it */
+static uint32_t wire_size(const struct wl_message *message, const union wl_argument *args, int count,
+                          uint64_t *fds) {
+    uint32_t size = 8;
+    int i = 0;
+    for (const char *c = message->signature; *c && i < count; ++c) {
+        switch (*c) {
+        case 's':
+            size += 4;
+            if (args[i].s)
+                size += ((uint32_t) strlen(args[i].s) + 1 + 3) & ~3u;
+            break;
+        case 'a':
+            size += 4;
+            if (args[i].a)
+                size += ((uint32_t) args[i].a->size + 3) & ~3u;
+            break;
+        case 'h':
+            (*fds)++;
+            break;
+        case 'i':
+        case 'u':
+        case 'f':
+        case 'o':
+        case 'n':
+            size += 4;
+            break;
+        default:
+            /* Version digits and '?' */
+            continue;
+        }
+        i++;
+    }
+    return size;
+}
+
+void server_accounting_mark(struct server_accounting *accounting) {
+    if (!accounting->running)
+        return;
+    uint64_t elapsed = monotonic_ns() - accounting->running_start_ns;
+    struct server_accounting_entry *entry = accounting->running;
+    entry->handler_ns += elapsed;
+    if (elapsed > entry->handler_max_ns)
+        entry->handler_max_ns = elapsed;
+    accounting->running_client->handler_ns += elapsed;
+    accounting->running = NULL;
+    accounting->running_client = NULL;
+}
+
+static void accounting_idle(void *data) {
+    struct server_accounting *accounting = static_cast<struct server_accounting *>(data);
+    accounting->idle = NULL;
+    server_accounting_mark(accounting);
+}
+
+static void protocol_logger(void *data, enum wl_protocol_logger_type type,
+                            const struct wl_protocol_logger_message *message) {
+    struct server_accounting *accounting = static_cast<struct server_accounting *>(data);
+    bool request = type == WL_PROTOCOL_LOGGER_REQUEST;
+    if (request)
+        server_accounting_mark(accounting);
+
+    struct server_accounting_client *stats = client_get(wl_resource_get_client(message->resource));
+    if (!stats)
+        return;
+    struct server_accounting_entry *entry =
+            client_entry(stats, wl_resource_get_class(message->resource), (uint32_t) message->message_opcode,
+                         request ? SERVER_ACCOUNTING_REQUEST : SERVER_ACCOUNTING_EVENT, message->message->name);
+    if (!entry)
+        return;
+
+    uint32_t size = wire_size(message->message, message->arguments, message->arguments_count, &stats->fds);
+    entry->count++;
+    entry->bytes += size;
+    if (request) {
+        stats->requests++;
+        stats->request_bytes += size;
+        accounting->running_client = stats;
+        accounting->running = entry;
+        accounting->running_start_ns = monotonic_ns();
+        if (!accounting->idle)
+            accounting->idle = wl_event_loop_add_idle(accounting->loop, accounting_idle, accounting);
+    } else {
+        stats->events++;
+        stats->event_bytes += size;
+    }
+}
+
+static void client_print(struct server_accounting_client *stats, FILE *out, uint64_t now);
+
+static void client_destroy(struct wl_listener *listener, void *data) {
+    struct server_accounting_client *stats = wl_container_of(listener, stats, destroy);
+    struct server_accounting *accounting = stats->accounting;
+    if (accounting->running_client == stats)
+        server_accounting_mark(accounting);
+    fprintf(stderr, "client %d disconnected\n", (int) stats->pid);
+    client_print(stats, stderr, monotonic_ns());
+    wl_list_remove(&stats->destroy.link);
+    wl_list_remove(&stats->link);
+    free(stats->entries);
+    free(stats);
+}
+
+static void client_created(struct wl_listener *listener, void *data) {
+    struct server_accounting *accounting = wl_container_of(listener, accounting, client_created);
+    struct wl_client *client = static_cast<struct wl_client *>(data);
+    struct server_accounting_client *stats =
+            static_cast<struct server_accounting_client *>(calloc(1, sizeof(*stats)));
+    if (!stats)
+        return;
+    stats->accounting = accounting;
+    stats->client = client;
+    wl_client_get_credentials(client, &stats->pid, NULL, NULL);
+    stats->connected_ns = stats->dumped_ns = monotonic_ns();
+    stats->destroy.notify = client_destroy;
+    wl_client_add_destroy_listener(client, &stats->destroy);
+    wl_list_insert(accounting->clients.prev, &stats->link);
+}
+
+void server_accounting_commit(struct server_accounting *accounting, struct wl_client *client, uint64_t shm_bytes) {
+    struct server_accounting_client *stats = client_get(client);
+    if (!stats)
+        return;
+    stats->commits++;
+    stats->shm_bytes += shm_bytes;
+}
+
+static int entry_compare(const void *a, const void *b) {
+    const struct server_accounting_entry *x = *static_cast<const struct server_accounting_entry *const *>(a);
+    const struct server_accounting_entry *y = *static_cast<const struct server_accounting_entry *const *>(b);
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return 0;
+}
+
+static void client_print(struct server_accounting_client *stats, FILE *out, uint64_t now) {
+    double seconds = (now - stats->connected_ns) / 1e9;
+    double window = (now - stats->dumped_ns) / 1e9;
+    fprintf(out, "client %d: %.1f s, %llu requests %llu bytes, %llu events %llu bytes, %llu fds\n",
+            (int) stats->pid, seconds, (unsigned long long) stats->requests,
+            (unsigned long long) stats->request_bytes, (unsigned long long) stats->events,
+            (unsigned long long) stats->event_bytes, (unsigned long long) stats->fds);
+    fprintf(out, "  %llu commits, %.1f/s overall, %.1f/s since the last dump, %.1f MiB of shm copied, "
+                 "%.1f ms in handlers\n",
+            (unsigned long long) stats->commits, seconds > 0 ? stats->commits / seconds : 0.0,
+            window > 0 ? (stats->commits - stats->dumped_commits) / window : 0.0,
+            stats->shm_bytes / (1024.0 * 1024.0), stats->handler_ns / 1e6);
+    stats->dumped_ns = now;
+    stats->dumped_commits = stats->commits;
+
+    struct server_accounting_entry **sorted =
+            static_cast<struct server_accounting_entry **>(malloc((stats->used + 1) * sizeof(*sorted)));
+    if (!sorted)
+        return;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < stats->capacity; ++i) {
+        if (stats->entries[i].interface)
+            sorted[count++] = &stats->entries[i];
+    }
+    qsort(sorted, count, sizeof(sorted[0]), entry_compare);
+    for (uint32_t i = 0; i < count && i < SERVER_ACCOUNTING_TOP; ++i) {
+        const struct server_accounting_entry *entry = sorted[i];
+        fprintf(out, "  %s %s.%s: %llu, %llu bytes", entry->direction == SERVER_ACCOUNTING_REQUEST ? "->" : "<-",
+                entry->interface, entry->name, (unsigned long long) entry->count,
+                (unsigned long long) entry->bytes);
+        if (entry->direction == SERVER_ACCOUNTING_REQUEST)
+            fprintf(out, ", %.1f us mean, %.1f us max", entry->handler_ns / 1000.0 / entry->count,
+                    entry->handler_max_ns / 1000.0);
+        fprintf(out, "\n");
+    }
+    free(sorted);
+}
+
+void server_accounting_dump(struct server_accounting *accounting, FILE *out) {
+    uint64_t now = monotonic_ns();
+    struct server_accounting_client *stats;
+    wl_list_for_each(stats, &accounting->clients, link) {
+        client_print(stats, out, now);
+    }
+    fflush(out);
+}
+
+struct server_accounting *server_accounting_create(struct wl_display *display) {
+    struct server_accounting *accounting =
+            static_cast<struct server_accounting *>(calloc(1, sizeof(*accounting)));
+    if (!accounting)
+        return NULL;
+    accounting->display = display;
+    accounting->loop = wl_display_get_event_loop(display);
+    wl_list_init(&accounting->clients);
+    accounting->logger = wl_display_add_protocol_logger(display, protocol_logger, accounting);
+    if (!accounting->logger) {
+        free(accounting);
+        return NULL;
+    }
+    accounting->client_created.notify = client_created;
+    wl_display_add_client_created_listener(display, &accounting->client_created);
+    return accounting;
+}
+
+/* Clients must be gone already */
+void server_accounting_destroy(struct server_accounting *accounting) {
+    if (accounting->idle)
+        wl_event_source_remove(accounting->idle);
+    wl_protocol_logger_destroy(accounting->logger);
+    wl_list_remove(&accounting->client_created.link);
+    free(accounting);
+}
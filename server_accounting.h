@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <wayland-server.h>
+
+/*
+ * Per-client protocol accounting for the headless server
+ *
+ * A protocol logger counts every request and event by interface and opcode,
+ * with its size on the wire and the file descriptors it carries. libwayland
+ * has no hook after a request handler returns, so a request's handler time
+ * runs from the logger call to the next dispatch boundary: the next request
+ * of any client, a server timer, or the idle pass at the end of the loop
+ * iteration. The server's own timers mark the boundary when they start.
+ */
+
+struct server_accounting;
+
+struct server_accounting *server_accounting_create(struct wl_display *display);
+void server_accounting_destroy(struct server_accounting *accounting);
+/* Ends the running request handler, if any */
+void server_accounting_mark(struct server_accounting *accounting);
+/* A wl_surface.commit of `client` that copied `shm_bytes` out of a buffer */
+void server_accounting_commit(struct server_accounting *accounting, struct wl_client *client, uint64_t shm_bytes);
+/* Every connected client, busiest messages first */
+void server_accounting_dump(struct server_accounting *accounting, FILE *out);
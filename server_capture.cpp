@@ -0,0 +1,318 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "server_capture.h"
+
+enum server_capture_format {
+    SERVER_CAPTURE_Y4M,
+    SERVER_CAPTURE_RGB24,
+};
+
+struct server_capture {
+    char path[256];
+    enum server_capture_format format;
+    int fd;
+    int32_t width, height;
+    uint32_t every;
+    uint64_t vblanks;
+    bool wait;
+
+    /* Slots head..tail-1 are queued, the event loop fills, the writer drains */
+    uint32_t **slots;
+    uint32_t slot_count;
+    uint64_t head;
+    uint64_t tail;
+    uint8_t *frame;                 /* Converted frame, writer thread only */
+    size_t frame_size;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t queued;
+    pthread_cond_t freed;
+    bool quit;
+    int error;                      /* errno of the write that failed */
+
+    uint64_t captured;
+    uint64_t dropped;
+    uint64_t written;
+    uint32_t max_queued;
+    uint64_t write_ns;              /* Conversion and write, writer thread */
+    uint64_t write_max_ns;
+};
+
+static uint64_t monotonic_ns() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    while (size > 0) {
+        ssize_t n = write(fd, bytes, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        bytes += n;
+        size -= (size_t) n;
+    }
+    return true;
+}
+
+/* Full range BT.601, as in JPEG, with 8 bit fixed point weights */
+static inline uint8_t rgb_y(int32_t r, int32_t g, int32_t b) {
+    return (uint8_t) ((77 * r + 150 * g + 29 * b + 128) >> 8);
+}
+
+static inline uint8_t rgb_u(int32_t r, int32_t g, int32_t b) {
+    return (uint8_t) (((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128);
+}
+
+static inline uint8_t rgb_v(int32_t r, int32_t g, int32_t b) {
+    return (uint8_t) (((128 * r - 107 * g - 21 * b + 128) >> 8) + 128);
+}
+
+static void convert_y4m(const struct server_capture *capture, const uint32_t *pixels) {
+    int32_t width = capture->width, height = capture->height;
+    int32_t chroma_width = (width + 1) / 2, chroma_height = (height + 1) / 2;
+    uint8_t *y_plane = capture->frame + 6;      /* After "FRAME\n" */
+    uint8_t *u_plane = y_plane + (size_t) width * height;
+    uint8_t *v_plane = u_plane + (size_t) chroma_width * chroma_height;
+
+    for (int32_t y = 0; y < height; ++y) {
+        const uint32_t *row = pixels + (size_t) y * width;
+        uint8_t *out = y_plane + (size_t) y * width;
+        for (int32_t x = 0; x < width; ++x)
+            out[x] = rgb_y((row[x] >> 16) & 0xff, (row[x] >> 8) & 0xff, row[x] & 0xff);
+    }
+
+    /* Chroma from the mean colour of each 2x2 block, edges repeat */
+    for (int32_t cy = 0; cy < chroma_height; ++cy) {
+        const uint32_t *row0 = pixels + (size_t) (2 * cy) * width;
+        const uint32_t *row1 = 2 * cy + 1 < height ? row0 + width : row0;
+        for (int32_t cx = 0; cx < chroma_width; ++cx) {
+            int32_t x0 = 2 * cx, x1 = x0 + 1 < width ? x0 + 1 : x0;
+            uint32_t p[4] = {row0[x0], row0[x1], row1[x0], row1[x1]};
+            int32_t r = 0, g = 0, b = 0;
+            for (uint32_t i = 0; i < 4; ++i) {
+                r += (p[i] >> 16) & 0xff;
+                g += (p[i] >> 8) & 0xff;
+                b += p[i] & 0xff;
+            }
+            r = (r + 2) >> 2;
+            g = (g + 2) >> 2;
+            b = (b + 2) >> 2;
+            u_plane[(size_t) cy * chroma_width + cx] = rgb_u(r, g, b);
+            v_plane[(size_t) cy * chroma_width + cx] = rgb_v(r, g, b);
+        }
+    }
+}
+
+static void convert_rgb24(const struct server_capture *capture, const uint32_t *pixels) {
+    size_t count = (size_t) capture->width * capture->height;
+    uint8_t *out = capture->frame;
+    for (size_t i = 0; i < count; ++i) {
+        out[3 * i] = (uint8_t) (pixels[i] >> 16);
+        out[3 * i + 1] = (uint8_t) (pixels[i] >> 8);
+        out[3 * i + 2] = (uint8_t) pixels[i];
+    }
+}
+
+static void *writer_main(void *data) {
+    struct server_capture *capture = static_cast<struct server_capture *>(data);
+
+    pthread_mutex_lock(&capture->lock);
+    for (;;) {
+        while (!capture->quit && capture->tail == capture->head)
+            pthread_cond_wait(&capture->queued, &capture->lock);
+        /* Quitting still drains the ring */
+        if (capture->tail == capture->head)
+            break;
+        const uint32_t *pixels = capture->slots[capture->tail % capture->slot_count];
+        bool failed = capture->error != 0;
+        pthread_mutex_unlock(&capture->lock);
+
+        int error = 0;
+        uint64_t start = monotonic_ns(), elapsed = 0;
+        if (!failed) {
+            if (capture->format == SERVER_CAPTURE_Y4M)
+                convert_y4m(capture, pixels);
+            else
+                convert_rgb24(capture, pixels);
+            if (!write_all(capture->fd, capture->frame, capture->frame_size))
+                error = errno ? errno : EIO;
+            elapsed = monotonic_ns() - start;
+        }
+
+        pthread_mutex_lock(&capture->lock);
+        capture->tail++;
+        if (failed || error) {
+            capture->dropped++;
+            if (error)
+                capture->error = error;
+        } else {
+            capture->written++;
+            capture->write_ns += elapsed;
+            if (elapsed > capture->write_max_ns)
+                capture->write_max_ns = elapsed;
+        }
+        pthread_cond_signal(&capture->freed);
+    }
+    pthread_mutex_unlock(&capture->lock);
+    return NULL;
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+    while (b) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static bool write_header(struct server_capture *capture, int32_t refresh_mhz) {
+    if (capture->format != SERVER_CAPTURE_Y4M)
+        return true;
+    uint64_t num = (uint64_t) refresh_mhz, den = 1000ull * capture->every;
+    uint64_t divisor = gcd(num, den);
+    char header[128];
+    int length = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%llu:%llu Ip A1:1 C420jpeg\n",
+                          capture->width, capture->height, (unsigned long long) (num / divisor),
+                          (unsigned long long) (den / divisor));
+    return write_all(capture->fd, header, (size_t) length);
+}
+
+static void capture_free(struct server_capture *capture) {
+    if (capture->slots) {
+        for (uint32_t i = 0; i < capture->slot_count; ++i)
+            free(capture->slots[i]);
+        free(capture->slots);
+    }
+    free(capture->frame);
+    if (capture->fd >= 0)
+        close(capture->fd);
+    free(capture);
+}
+
+struct server_capture *server_capture_create(const char *path, int32_t width, int32_t height,
+                                             int32_t refresh_mhz, uint32_t every, uint32_t slots, bool wait) {
+    if (every == 0 || slots < SERVER_CAPTURE_MIN_SLOTS || slots > SERVER_CAPTURE_MAX_SLOTS)
+        return NULL;
+    struct server_capture *capture = static_cast<struct server_capture *>(calloc(1, sizeof(*capture)));
+    if (!capture)
+        return NULL;
+    snprintf(capture->path, sizeof(capture->path), "%s", path);
+    size_t length = strlen(path);
+    capture->format = length > 4 && strcmp(path + length - 4, ".y4m") == 0
+            ? SERVER_CAPTURE_Y4M : SERVER_CAPTURE_RGB24;
+    capture->width = width;
+    capture->height = height;
+    capture->every = every;
+    capture->wait = wait;
+    capture->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (capture->fd < 0) {
+        capture_free(capture);
+        return NULL;
+    }
+
+    size_t pixels = (size_t) width * height;
+    if (capture->format == SERVER_CAPTURE_Y4M)
+        capture->frame_size = 6 + pixels + 2 * (size_t) ((width + 1) / 2) * ((height + 1) / 2);
+    else
+        capture->frame_size = 3 * pixels;
+    capture->frame = static_cast<uint8_t *>(malloc(capture->frame_size));
+    capture->slots = static_cast<uint32_t **>(calloc(slots, sizeof(*capture->slots)));
+    if (!capture->frame || !capture->slots) {
+        capture_free(capture);
+        return NULL;
+    }
+    capture->slot_count = slots;
+    for (uint32_t i = 0; i < slots; ++i) {
+        capture->slots[i] = static_cast<uint32_t *>(malloc(pixels * 4));
+        if (!capture->slots[i]) {
+            capture_free(capture);
+            return NULL;
+        }
+        /* Fault the pages in now rather than on the first captured vblanks */
+        memset(capture->slots[i], 0, pixels * 4);
+    }
+    if (capture->format == SERVER_CAPTURE_Y4M)
+        memcpy(capture->frame, "FRAME\n", 6);
+    if (!write_header(capture, refresh_mhz)) {
+        capture_free(capture);
+        return NULL;
+    }
+
+    pthread_mutex_init(&capture->lock, NULL);
+    pthread_cond_init(&capture->queued, NULL);
+    pthread_cond_init(&capture->freed, NULL);
+    if (pthread_create(&capture->thread, NULL, writer_main, capture) != 0) {
+        pthread_cond_destroy(&capture->freed);
+        pthread_cond_destroy(&capture->queued);
+        pthread_mutex_destroy(&capture->lock);
+        capture_free(capture);
+        return NULL;
+    }
+    return capture;
+}
+
+void server_capture_destroy(struct server_capture *capture) {
+    pthread_mutex_lock(&capture->lock);
+    capture->quit = true;
+    pthread_cond_signal(&capture->queued);
+    pthread_mutex_unlock(&capture->lock);
+    pthread_join(capture->thread, NULL);
+    pthread_cond_destroy(&capture->freed);
+    pthread_cond_destroy(&capture->queued);
+    pthread_mutex_destroy(&capture->lock);
+
+    fprintf(stderr, "capture %s: %llu frames, %llu written, %llu dropped, %u of %u slots used at most",
+            capture->path, (unsigned long long) capture->captured, (unsigned long long) capture->written,
+            (unsigned long long) capture->dropped, capture->max_queued, capture->slot_count);
+    if (capture->written)
+        fprintf(stderr, ", %.1f us mean write, %.1f us max",
+                capture->write_ns / 1000.0 / capture->written, capture->write_max_ns / 1000.0);
+    fprintf(stderr, "\n");
+    if (capture->error)
+        fprintf(stderr, "capture %s: %s\n", capture->path, strerror(capture->error));
+    else if (capture->format == SERVER_CAPTURE_RGB24)
+        fprintf(stderr, "capture %s: rawvideo rgb24 %dx%d, one frame every %u vblanks\n",
+                capture->path, capture->width, capture->height, capture->every);
+    capture_free(capture);
+}
+
+void server_capture_frame(struct server_capture *capture, const uint32_t *pixels) {
+    if (capture->vblanks++ % capture->every != 0)
+        return;
+    capture->captured++;
+
+    pthread_mutex_lock(&capture->lock);
+    while (capture->wait && !capture->error && capture->head - capture->tail == capture->slot_count)
+        pthread_cond_wait(&capture->freed, &capture->lock);
+    bool drop = capture->error || capture->head - capture->tail == capture->slot_count;
+    if (drop)
+        capture->dropped++;
+    pthread_mutex_unlock(&capture->lock);
+    if (drop)
+        return;
+
+    /* The writer never touches the slot at head until it is queued */
+    memcpy(capture->slots[capture->head % capture->slot_count], pixels,
+           (size_t) capture->width * capture->height * 4);
+
+    pthread_mutex_lock(&capture->lock);
+    capture->head++;
+    uint32_t queued = (uint32_t) (capture->head - capture->tail);
+    if (queued > capture->max_queued)
+        capture->max_queued = queued;
+    pthread_cond_signal(&capture->queued);
+    pthread_mutex_unlock(&capture->lock);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Output capture for the headless server
+ *
+ * Every captured vblank copies the output image into the next free slot of a
+ * ring allocated up front, and a writer thread converts and writes the slots
+ * in order, so the event loop never waits on the disk. When the ring is full
+ * the frame is dropped and counted instead, except in virtual time mode where
+ * the vblank waits for a slot because the timeline does not depend on it.
+ *
+ * A FILE ending in .y4m gets YUV4MPEG2 with full range BT.601 4:2:0, anything
+ * else gets headerless packed RGB24 frames.
+ */
+
+#define SERVER_CAPTURE_MIN_SLOTS 2
+#define SERVER_CAPTURE_MAX_SLOTS 64
+#define SERVER_CAPTURE_DEFAULT_SLOTS 8
+
+struct server_capture;
+
+/* Keeps one vblank out of `every`. NULL if the file or the ring can't be made */
+struct server_capture *server_capture_create(const char *path, int32_t width, int32_t height,
+                                             int32_t refresh_mhz, uint32_t every, uint32_t slots, bool wait);
+/* Writes out what is queued and prints the statistics */
+void server_capture_destroy(struct server_capture *capture);
+/* Called on every vblank with the composited output image */
+void server_capture_frame(struct server_capture *capture, const uint32_t *pixels);
@@ -0,0 +1,337 @@
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SERVER_COMPOSITE_X86 1
+#endif
+#include "server_composite.h"
+
+/* Bands thinner than this are not worth waking a thread for */
+#define SERVER_COMPOSITE_MIN_BAND 32
+
+typedef void (*blend_row_func)(uint32_t *dst, const uint32_t *src, int32_t count);
+
+struct server_compositor_worker {
+    struct server_compositor *compositor;
+    uint32_t index;
+    pthread_t thread;
+};
+
+struct server_compositor {
+    uint32_t thread_count;          /* Including the caller */
+    struct server_compositor_worker workers[SERVER_COMPOSITE_MAX_THREADS];
+    blend_row_func blend;
+    const char *kernel;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    uint64_t generation;
+    uint32_t pending;
+    uint32_t bands;
+    bool quit;
+    const struct server_composite_target *target;
+    int32_t y1, y2;                 /* Rows covered by the clip region */
+};
+
+/*
+ * dst = src + dst * (255 - src.alpha) / 255 per channel, with the division
+ * rounded the same way in every kernel so their output is bit-identical.
+ */
+static inline uint32_t blend_pixel(uint32_t s, uint32_t d) {
+    uint32_t inverse = 255 - (s >> 24), result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t x = ((d >> shift) & 0xFF) * inverse + 0x80;
+        x = (x + (x >> 8)) >> 8;
+        x += (s >> shift) & 0xFF;
+        result |= (x > 255 ? 255 : x) << shift;
+    }
+    return result;
+}
+
+static void blend_row_scalar(uint32_t *dst, const uint32_t *src, int32_t count) {
+    for (int32_t i = 0; i < count; ++i) {
+        uint32_t s = src[i];
+        if (s >> 24 == 255)
+            dst[i] = s;
+        else if (s != 0)
+            dst[i] = blend_pixel(s, dst[i]);
+    }
+}
+
+#ifdef SERVER_COMPOSITE_X86
+__attribute__((target("sse2")))
+static inline __m128i blend_sse2(__m128i s, __m128i d) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i bias = _mm_set1_epi16(0x80);
+    __m128i inverse = _mm_sub_epi32(_mm_set1_epi32(255), _mm_srli_epi32(s, 24));
+    inverse = _mm_or_si128(inverse, _mm_slli_epi32(inverse, 16));
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi32(inverse, inverse));
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi32(inverse, inverse));
+    lo = _mm_add_epi16(lo, bias);
+    hi = _mm_add_epi16(hi, bias);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+    return _mm_adds_epu8(s, _mm_packus_epi16(lo, hi));
+}
+
+__attribute__((target("sse2")))
+static void blend_row_sse2(uint32_t *dst, const uint32_t *src, int32_t count) {
+    const __m128i alpha = _mm_set1_epi32((int) 0xFF000000);
+    int32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128i a = _mm_and_si128(s, alpha);
+        /* Whole vectors of opaque or empty pixels skip the arithmetic */
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, alpha)) == 0xFFFF) {
+            _mm_storeu_si128((__m128i *) (dst + i), s);
+            continue;
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(s, _mm_setzero_si128())) == 0xFFFF)
+            continue;
+        __m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+        _mm_storeu_si128((__m128i *) (dst + i), blend_sse2(s, d));
+    }
+    blend_row_scalar(dst + i, src + i, count - i);
+}
+
+/* The same as blend_sse2, every 256-bit operation below stays within its 128-bit lane */
+__attribute__((target("avx2")))
+static void blend_row_avx2(uint32_t *dst, const uint32_t *src, int32_t count) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i bias = _mm256_set1_epi16(0x80);
+    const __m256i alpha = _mm256_set1_epi32((int) 0xFF000000);
+    int32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i s = _mm256_loadu_si256((const __m256i *) (src + i));
+        __m256i a = _mm256_and_si256(s, alpha);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, alpha)) == -1) {
+            _mm256_storeu_si256((__m256i *) (dst + i), s);
+            continue;
+        }
+        if (_mm256_testz_si256(s, s))
+            continue;
+        __m256i d = _mm256_loadu_si256((const __m256i *) (dst + i));
+        __m256i inverse = _mm256_sub_epi32(_mm256_set1_epi32(255), _mm256_srli_epi32(s, 24));
+        inverse = _mm256_or_si256(inverse, _mm256_slli_epi32(inverse, 16));
+        __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi32(inverse, inverse));
+        __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi32(inverse, inverse));
+        lo = _mm256_add_epi16(lo, bias);
+        hi = _mm256_add_epi16(hi, bias);
+        lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+        hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+        _mm256_storeu_si256((__m256i *) (dst + i), _mm256_adds_epu8(s, _mm256_packus_epi16(lo, hi)));
+    }
+    blend_row_sse2(dst + i, src + i, count - i);
+}
+#endif
+
+static inline const uint32_t *layer_source(const struct server_layer *layer, int32_t x, int32_t y) {
+    return layer->pixels + (size_t) ((y - layer->y) * layer->scale) * layer->stride
+           + (x - layer->x) * layer->scale;
+}
+
+static void copy_box(const struct server_composite_target *target, const struct server_layer *layer,
+                     const struct server_box *box) {
+    for (int32_t y = box->y1; y < box->y2; ++y) {
+        uint32_t *dst = target->pixels + (size_t) y * target->width;
+        const uint32_t *src = layer_source(layer, box->x1, y);
+        if (layer->scale == 1) {
+            memcpy(dst + box->x1, src, (size_t) (box->x2 - box->x1) * 4);
+            continue;
+        }
+        for (int32_t x = box->x1; x < box->x2; ++x, src += layer->scale)
+            dst[x] = *src;
+    }
+}
+
+static void blend_box(const struct server_composite_target *target, const struct server_layer *layer,
+                      const struct server_box *box, blend_row_func blend) {
+    for (int32_t y = box->y1; y < box->y2; ++y) {
+        uint32_t *dst = target->pixels + (size_t) y * target->width;
+        const uint32_t *src = layer_source(layer, box->x1, y);
+        if (layer->scale == 1) {
+            blend(dst + box->x1, src, box->x2 - box->x1);
+            continue;
+        }
+        for (int32_t x = box->x1; x < box->x2; ++x, src += layer->scale) {
+            if (*src >> 24 == 255)
+                dst[x] = *src;
+            else if (*src != 0)
+                dst[x] = blend_pixel(*src, dst[x]);
+        }
+    }
+}
+
+static void composite_layer(const struct server_composite_target *target, const struct server_layer *layer,
+                            const struct server_box *area, blend_row_func blend) {
+    if (!layer->has_alpha) {
+        copy_box(target, layer, area);
+        return;
+    }
+    /* Opaque parts are copied, the remainder is blended */
+    struct server_region rest;
+    server_region_init(&rest, false);
+    rest.boxes[0] = *area;
+    rest.count = 1;
+    for (uint32_t i = 0; i < layer->opaque.count; ++i) {
+        struct server_box piece = server_box_intersect(area, &layer->opaque.boxes[i]);
+        if (server_box_empty(&piece))
+            continue;
+        copy_box(target, layer, &piece);
+        /* On overflow this grows back, re-blending opaque pixels is harmless */
+        server_region_subtract(&rest, &piece);
+    }
+    for (uint32_t i = 0; i < rest.count; ++i)
+        blend_box(target, layer, &rest.boxes[i], blend);
+}
+
+static void composite_band(const struct server_composite_target *target, int32_t y1, int32_t y2,
+                           blend_row_func blend) {
+    struct server_box band = {0, y1, target->width, y2};
+    for (uint32_t i = 0; i < target->clip->count; ++i) {
+        struct server_box box = server_box_intersect(&target->clip->boxes[i], &band);
+        if (server_box_empty(&box))
+            continue;
+        for (int32_t y = box.y1; y < box.y2; ++y) {
+            uint32_t *dst = target->pixels + (size_t) y * target->width;
+            for (int32_t x = box.x1; x < box.x2; ++x)
+                dst[x] = target->background;
+        }
+        for (uint32_t j = 0; j < target->layer_count; ++j) {
+            const struct server_layer *layer = &target->layers[j];
+            struct server_box rect = server_box_make(layer->x, layer->y, layer->width, layer->height);
+            struct server_box area = server_box_intersect(&box, &rect);
+            if (!server_box_empty(&area))
+                composite_layer(target, layer, &area, blend);
+        }
+    }
+}
+
+static void worker_band(struct server_compositor *compositor, uint32_t index) {
+    int32_t rows = compositor->y2 - compositor->y1;
+    int32_t y1 = compositor->y1 + (int32_t) ((int64_t) rows * index / compositor->bands);
+    int32_t y2 = compositor->y1 + (int32_t) ((int64_t) rows * (index + 1) / compositor->bands);
+    composite_band(compositor->target, y1, y2, compositor->blend);
+}
+
+static void *worker_main(void *data) {
+    struct server_compositor_worker *worker = static_cast<struct server_compositor_worker *>(data);
+    struct server_compositor *compositor = worker->compositor;
+    uint64_t seen = 0;
+
+    pthread_mutex_lock(&compositor->lock);
+    for (;;) {
+        while (!compositor->quit && compositor->generation == seen)
+            pthread_cond_wait(&compositor->wake, &compositor->lock);
+        if (compositor->quit)
+            break;
+        seen = compositor->generation;
+        bool active = worker->index < compositor->bands;
+        pthread_mutex_unlock(&compositor->lock);
+
+        if (active)
+            worker_band(compositor, worker->index);
+
+        pthread_mutex_lock(&compositor->lock);
+        if (--compositor->pending == 0)
+            pthread_cond_signal(&compositor->done);
+    }
+    pthread_mutex_unlock(&compositor->lock);
+    return NULL;
+}
+
+struct server_compositor *server_compositor_create(uint32_t threads) {
+    struct server_compositor *compositor =
+            static_cast<struct server_compositor *>(calloc(1, sizeof(*compositor)));
+    if (!compositor)
+        return NULL;
+
+    compositor->blend = blend_row_scalar;
+    compositor->kernel = "scalar";
+#ifdef SERVER_COMPOSITE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        compositor->blend = blend_row_avx2;
+        compositor->kernel = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        compositor->blend = blend_row_sse2;
+        compositor->kernel = "sse2";
+    }
+#endif
+
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (uint32_t) cpus : 1;
+    }
+    if (threads > SERVER_COMPOSITE_MAX_THREADS)
+        threads = SERVER_COMPOSITE_MAX_THREADS;
+
+    pthread_mutex_init(&compositor->lock, NULL);
+    pthread_cond_init(&compositor->wake, NULL);
+    pthread_cond_init(&compositor->done, NULL);
+    compositor->thread_count = 1;
+    for (uint32_t i = 1; i < threads; ++i) {
+        struct server_compositor_worker *worker = &compositor->workers[i];
+        worker->compositor = compositor;
+        worker->index = i;
+        if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+            break;
+        compositor->thread_count++;
+    }
+    return compositor;
+}
+
+void server_compositor_destroy(struct server_compositor *compositor) {
+    pthread_mutex_lock(&compositor->lock);
+    compositor->quit = true;
+    pthread_cond_broadcast(&compositor->wake);
+    pthread_mutex_unlock(&compositor->lock);
+    for (uint32_t i = 1; i < compositor->thread_count; ++i)
+        pthread_join(compositor->workers[i].thread, NULL);
+    pthread_cond_destroy(&compositor->done);
+    pthread_cond_destroy(&compositor->wake);
+    pthread_mutex_destroy(&compositor->lock);
+    free(compositor);
+}
+
+void server_compositor_run(struct server_compositor *compositor, const struct server_composite_target *target) {
+    struct server_box extents = server_region_extents(target->clip);
+    if (server_box_empty(&extents))
+        return;
+
+    uint32_t bands = (uint32_t) ((extents.y2 - extents.y1) / SERVER_COMPOSITE_MIN_BAND);
+    if (bands > compositor->thread_count)
+        bands = compositor->thread_count;
+    if (bands <= 1) {
+        composite_band(target, extents.y1, extents.y2, compositor->blend);
+        return;
+    }
+
+    pthread_mutex_lock(&compositor->lock);
+    compositor->target = target;
+    compositor->y1 = extents.y1;
+    compositor->y2 = extents.y2;
+    compositor->bands = bands;
+    compositor->pending = compositor->thread_count - 1;
+    compositor->generation++;
+    pthread_cond_broadcast(&compositor->wake);
+    pthread_mutex_unlock(&compositor->lock);
+
+    worker_band(compositor, 0);
+
+    pthread_mutex_lock(&compositor->lock);
+    while (compositor->pending > 0)
+        pthread_cond_wait(&compositor->done, &compositor->lock);
+    pthread_mutex_unlock(&compositor->lock);
+}
+
+const char *server_compositor_kernel(const struct server_compositor *compositor) {
+    return compositor->kernel;
+}
+
+uint32_t server_compositor_threads(const struct server_compositor *compositor) {
+    return compositor->thread_count;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include "server_region.h"
+
+/*
+ * Software compositor for the headless server
+ *
+ * Layers are drawn bottom to top into an XRGB8888 image, but only inside the
+ * clip region. Surfaces without alpha and the opaque regions of the others are
+ * plain row copies, everything else is premultiplied "over" with SSE2 or AVX2,
+ * whichever the CPU supports. The clip region is cut into scanline bands, one
+ * per worker thread, the calling thread taking the first band.
+ */
+
+#define SERVER_COMPOSITE_MAX_THREADS 16
+
+struct server_layer {
+    const uint32_t *pixels;
+    int32_t stride;                 /* In pixels */
+    /* Target rectangle, in output pixels */
+    int32_t x, y;
+    int32_t width, height;
+    int32_t scale;                  /* Buffer pixels per output pixel */
+    bool has_alpha;
+    struct server_region opaque;    /* Output pixels, never blended */
+};
+
+struct server_composite_target {
+    uint32_t *pixels;
+    int32_t width, height;
+    uint32_t background;
+    const struct server_layer *layers;  /* Bottom to top */
+    uint32_t layer_count;
+    const struct server_region *clip;
+};
+
+struct server_compositor;
+
+/* Zero threads picks one per CPU */
+struct server_compositor *server_compositor_create(uint32_t threads);
+void server_compositor_destroy(struct server_compositor *compositor);
+/* Returns once every band of the target is done */
+void server_compositor_run(struct server_compositor *compositor, const struct server_composite_target *target);
+const char *server_compositor_kernel(const struct server_compositor *compositor);
+uint32_t server_compositor_threads(const struct server_compositor *compositor);
@@ -0,0 +1,380 @@
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <linux/input-event-codes.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include "input_record_format.h"
+#include "server.h"
+#include "server_input.h"
+
+/* Falling further behind than this drops samples instead of bursting them */
+#define SERVER_INPUT_MAX_CATCH_UP_NS 100000000ull
+#define SERVER_INPUT_TRACE_MAX_ARGS 16
+
+enum server_input_generator {
+    SERVER_INPUT_POINTER,
+    SERVER_INPUT_AXIS,
+    SERVER_INPUT_KEYS,
+    SERVER_INPUT_TOUCH,
+    SERVER_INPUT_TRACE,
+};
+
+struct server_input {
+    struct server *server;
+    struct wl_list link;
+    enum server_input_generator generator;
+    char name[64];
+    uint32_t rate;
+    uint64_t period_ns;
+    int timer_fd;
+    struct wl_event_source *source;
+    uint64_t next_ns;               /* Scheduled time of the next sample */
+    uint64_t sample;
+
+    uint64_t samples;
+    uint64_t skipped;
+    uint64_t max_late_ns;
+
+    uint32_t key_index;
+    bool touching;
+
+    /* The whole recording, replayed in a loop */
+    uint8_t *trace;
+    size_t trace_size;
+    size_t trace_offset;
+};
+
+static const uint32_t typed_keys[] = {
+        KEY_T, KEY_H, KEY_E, KEY_SPACE, KEY_Q, KEY_U, KEY_I, KEY_C, KEY_K, KEY_SPACE,
+        KEY_B, KEY_R, KEY_O, KEY_W, KEY_N, KEY_SPACE, KEY_F, KEY_O, KEY_X, KEY_ENTER,
+};
+
+static uint64_t monotonic_ns() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void input_arm(struct server_input *input) {
+    struct itimerspec spec{};
+    spec.it_value.tv_sec = (time_t) (input->next_ns / 1000000000);
+    spec.it_value.tv_nsec = (long) (input->next_ns % 1000000000);
+    timerfd_settime(input->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static bool focused(struct wl_resource *resource, struct server_surface *focus) {
+    return focus && wl_resource_get_client(resource) == wl_resource_get_client(focus->resource);
+}
+
+static void pointer_sample(struct server_input *input, uint32_t time, struct server_surface *focus) {
+    double width = server_surface_width(focus), height = server_surface_height(focus);
+    double radius = (width < height ? width : height) / 3;
+    double angle = 2 * M_PI * (double) (input->sample % input->rate) / input->rate;
+    wl_fixed_t x = wl_fixed_from_double(width / 2 + radius * cos(angle));
+    wl_fixed_t y = wl_fixed_from_double(height / 2 + radius * sin(angle));
+
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &input->server->seat.pointers) {
+        if (!focused(resource, focus))
+            continue;
+        wl_pointer_send_motion(resource, time, x, y);
+        if (wl_resource_get_version(resource) >= WL_POINTER_FRAME_SINCE_VERSION)
+            wl_pointer_send_frame(resource);
+    }
+}
+
+static void axis_sample(struct server_input *input, uint32_t time, struct server_surface *focus) {
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &input->server->seat.pointers) {
+        if (!focused(resource, focus))
+            continue;
+        bool framed = wl_resource_get_version(resource) >= WL_POINTER_FRAME_SINCE_VERSION;
+        if (framed) {
+            wl_pointer_send_axis_source(resource, WL_POINTER_AXIS_SOURCE_WHEEL);
+            wl_pointer_send_axis_discrete(resource, WL_POINTER_AXIS_VERTICAL_SCROLL, 1);
+        }
+        wl_pointer_send_axis(resource, time, WL_POINTER_AXIS_VERTICAL_SCROLL, wl_fixed_from_int(15));
+        if (framed)
+            wl_pointer_send_frame(resource);
+    }
+}
+
+/* Even samples press, odd ones release, so keys@HZ types HZ/2 keys a second */
+static void keys_sample(struct server_input *input, uint32_t time, struct server_surface *focus) {
+    uint32_t key = typed_keys[input->key_index % (sizeof(typed_keys) / sizeof(typed_keys[0]))];
+    bool pressed = input->sample % 2 == 0;
+    uint32_t serial = wl_display_next_serial(input->server->display);
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &input->server->seat.keyboards) {
+        if (focused(resource, focus))
+            wl_keyboard_send_key(resource, serial, time, key,
+                                 pressed ? WL_KEYBOARD_KEY_STATE_PRESSED : WL_KEYBOARD_KEY_STATE_RELEASED);
+    }
+    if (!pressed)
+        input->key_index++;
+}
+
+/* One stroke a second: down on the left, motion across, up on the right */
+static void touch_sample(struct server_input *input, uint32_t time, struct server_surface *focus) {
+    uint64_t step = input->sample % input->rate;
+    wl_fixed_t x = wl_fixed_from_double(server_surface_width(focus) * (step + 0.5) / input->rate);
+    wl_fixed_t y = wl_fixed_from_int(server_surface_height(focus) / 2);
+    uint32_t serial = wl_display_next_serial(input->server->display);
+
+    struct wl_resource *resource;
+    wl_resource_for_each(resource, &input->server->seat.touches) {
+        if (!focused(resource, focus))
+            continue;
+        if (!input->touching)
+            wl_touch_send_down(resource, serial, time, focus->resource, 0, x, y);
+        else if (step == input->rate - 1)
+            wl_touch_send_up(resource, serial, time, 0);
+        else
+            wl_touch_send_motion(resource, time, 0, x, y);
+        wl_touch_send_frame(resource);
+    }
+    if (!input->touching)
+        input->touching = true;
+    else if (step == input->rate - 1)
+        input->touching = false;
+}
+
+/* Recorded times and serials are replaced, everything else is sent as recorded */
+static void trace_event(struct server_input *input, const struct input_record_header *header,
+                        const uint32_t *a, uint32_t time, struct server_surface *focus) {
+    struct server *server = input->server;
+    uint32_t serial = wl_display_next_serial(server->display);
+    struct wl_resource *resource;
+
+    switch (header->interface) {
+    case INPUT_RECORD_POINTER:
+        wl_resource_for_each(resource, &server->seat.pointers) {
+            if (!focused(resource, focus))
+                continue;
+            bool v5 = wl_resource_get_version(resource) >= WL_POINTER_FRAME_SINCE_VERSION;
+            switch (header->opcode) {
+            case WL_POINTER_MOTION: wl_pointer_send_motion(resource, time, a[1], a[2]); break;
+            case WL_POINTER_BUTTON: wl_pointer_send_button(resource, serial, time, a[2], a[3]); break;
+            case WL_POINTER_AXIS: wl_pointer_send_axis(resource, time, a[1], a[2]); break;
+            case WL_POINTER_FRAME: if (v5) wl_pointer_send_frame(resource); break;
+            case WL_POINTER_AXIS_SOURCE: if (v5) wl_pointer_send_axis_source(resource, a[0]); break;
+            case WL_POINTER_AXIS_STOP: if (v5) wl_pointer_send_axis_stop(resource, time, a[1]); break;
+            case WL_POINTER_AXIS_DISCRETE: if (v5) wl_pointer_send_axis_discrete(resource, a[0], a[1]); break;
+            }
+        }
+        break;
+    case INPUT_RECORD_KEYBOARD:
+        wl_resource_for_each(resource, &server->seat.keyboards) {
+            if (!focused(resource, focus))
+                continue;
+            switch (header->opcode) {
+            case WL_KEYBOARD_KEY: wl_keyboard_send_key(resource, serial, time, a[2], a[3]); break;
+            case WL_KEYBOARD_MODIFIERS: wl_keyboard_send_modifiers(resource, serial, a[1], a[2], a[3], a[4]); break;
+            }
+        }
+        break;
+    case INPUT_RECORD_TOUCH:
+        wl_resource_for_each(resource, &server->seat.touches) {
+            if (!focused(resource, focus))
+                continue;
+            bool v6 = wl_resource_get_version(resource) >= WL_TOUCH_SHAPE_SINCE_VERSION;
+            switch (header->opcode) {
+            case WL_TOUCH_DOWN: wl_touch_send_down(resource, serial, time, focus->resource, a[2], a[3], a[4]); break;
+            case WL_TOUCH_UP: wl_touch_send_up(resource, serial, time, a[2]); break;
+            case WL_TOUCH_MOTION: wl_touch_send_motion(resource, time, a[1], a[2], a[3]); break;
+            case WL_TOUCH_FRAME: wl_touch_send_frame(resource); break;
+            case WL_TOUCH_CANCEL: wl_touch_send_cancel(resource); break;
+            case WL_TOUCH_SHAPE: if (v6) wl_touch_send_shape(resource, a[0], a[1], a[2]); break;
+            case WL_TOUCH_ORIENTATION: if (v6) wl_touch_send_orientation(resource, a[0], a[1]); break;
+            }
+        }
+        break;
+    }
+}
+
+/* Sends the record at the current offset, then schedules the one after it */
+static void trace_sample(struct server_input *input, uint32_t time, struct server_surface *focus) {
+    struct input_record_header header;
+    if (input->trace_offset + sizeof(header) > input->trace_size)
+        return;
+    memcpy(&header, input->trace + input->trace_offset, sizeof(header));
+    if (input->trace_offset + sizeof(header) + header.size > input->trace_size)
+        return;
+    const uint8_t *payload = input->trace + input->trace_offset + sizeof(header);
+    uint32_t args[SERVER_INPUT_TRACE_MAX_ARGS] = {};
+    memcpy(args, payload, header.size < sizeof(args) ? header.size : sizeof(args));
+
+    input->trace_offset += sizeof(header) + header.size;
+    if (header.interface == INPUT_RECORD_KEYBOARD && header.opcode == WL_KEYBOARD_KEYMAP)
+        input->trace_offset += args[1];
+    if (focus)
+        trace_event(input, &header, args, time, focus);
+}
+
+static uint64_t trace_next_delay(struct server_input *input) {
+    struct input_record_header header;
+    if (input->trace_offset + sizeof(header) <= input->trace_size) {
+        memcpy(&header, input->trace + input->trace_offset, sizeof(header));
+        if (input->trace_offset + sizeof(header) + header.size <= input->trace_size)
+            return (uint64_t) header.delta_us * 1000;
+    }
+    /* Loop, with a pause so an instant trace cannot spin */
+    input->trace_offset = 8;
+    return 1000000;
+}
+
+static void input_sample(struct server_input *input, uint64_t time_ns) {
+    struct server_surface *focus = input->server->seat.focus;
+    uint32_t time = (uint32_t) (time_ns / 1000000);
+    switch (input->generator) {
+    case SERVER_INPUT_POINTER: if (focus) pointer_sample(input, time, focus); break;
+    case SERVER_INPUT_AXIS: if (focus) axis_sample(input, time, focus); break;
+    case SERVER_INPUT_KEYS: if (focus) keys_sample(input, time, focus); break;
+    case SERVER_INPUT_TOUCH:
+        if (focus)
+            touch_sample(input, time, focus);
+        else
+            input->touching = false;
+        break;
+    case SERVER_INPUT_TRACE: trace_sample(input, time, focus); break;
+    }
+    input->sample++;
+    input->samples++;
+}
+
+static int input_timer(int fd, uint32_t mask, void *data) {
+    struct server_input *input = static_cast<struct server_input *>(data);
+    if (input->server->accounting)
+        server_accounting_mark(input->server->accounting);
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        return 0;
+
+    uint64_t now = monotonic_ns();
+    if (input->generator != SERVER_INPUT_TRACE && now > input->next_ns + SERVER_INPUT_MAX_CATCH_UP_NS) {
+        uint64_t missed = (now - input->next_ns) / input->period_ns;
+        input->skipped += missed;
+        input->sample += missed;
+        input->next_ns += missed * input->period_ns;
+    }
+    while (input->next_ns <= now) {
+        if (now - input->next_ns > input->max_late_ns)
+            input->max_late_ns = now - input->next_ns;
+        input_sample(input, input->next_ns);
+        input->next_ns += input->generator == SERVER_INPUT_TRACE ? trace_next_delay(input) : input->period_ns;
+    }
+    input_arm(input);
+    return 0;
+}
+
+static bool input_load_trace(struct server_input *input, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    input->trace = static_cast<uint8_t *>(malloc(size > 0 ? size : 1));
+    uint32_t version = 0;
+    bool valid = input->trace && size >= (long) (8 + sizeof(struct input_record_header))
+                 && fread(input->trace, 1, size, file) == (size_t) size
+                 && memcmp(input->trace, input_record_magic, sizeof(input_record_magic)) == 0
+                 && (memcpy(&version, input->trace + 4, sizeof(version)), version) == INPUT_RECORD_VERSION;
+    fclose(file);
+    /* trace_next_delay wraps back to the first record, it has to be complete */
+    struct input_record_header header;
+    if (valid) {
+        memcpy(&header, input->trace + 8, sizeof(header));
+        valid = 8 + sizeof(header) + header.size <= (size_t) size;
+    }
+    if (!valid) {
+        fprintf(stderr, "%s is not an input recording\n", path);
+        return false;
+    }
+    input->trace_size = size;
+    input->trace_offset = 8;
+    return true;
+}
+
+struct server_input *server_input_create(struct server *server, const char *spec) {
+    struct server_input *input = static_cast<struct server_input *>(calloc(1, sizeof(*input)));
+    if (!input)
+        return NULL;
+    input->server = server;
+    input->timer_fd = -1;
+    snprintf(input->name, sizeof(input->name), "%s", spec);
+
+    static const struct {
+        const char *prefix;
+        enum server_input_generator generator;
+    } generators[] = {
+            {"pointer@", SERVER_INPUT_POINTER},
+            {"axis@", SERVER_INPUT_AXIS},
+            {"keys@", SERVER_INPUT_KEYS},
+            {"touch@", SERVER_INPUT_TOUCH},
+    };
+    bool valid = false;
+    if (strncmp(spec, "trace:", 6) == 0) {
+        input->generator = SERVER_INPUT_TRACE;
+        valid = input_load_trace(input, spec + 6);
+    }
+    for (size_t i = 0; i < sizeof(generators) / sizeof(generators[0]); ++i) {
+        size_t length = strlen(generators[i].prefix);
+        if (strncmp(spec, generators[i].prefix, length) != 0)
+            continue;
+        char *end;
+        long rate = strtol(spec + length, &end, 10);
+        if (*end != '\0' || rate < SERVER_INPUT_MIN_RATE || rate > SERVER_INPUT_MAX_RATE)
+            break;
+        input->generator = generators[i].generator;
+        input->rate = (uint32_t) rate;
+        input->period_ns = 1000000000ull / rate;
+        valid = true;
+    }
+    if (valid)
+        input->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (input->timer_fd >= 0)
+        input->source = wl_event_loop_add_fd(server->loop, input->timer_fd, WL_EVENT_READABLE,
+                                             input_timer, input);
+    if (!input->source) {
+        if (input->timer_fd >= 0)
+            close(input->timer_fd);
+        free(input->trace);
+        free(input);
+        return NULL;
+    }
+
+    input->next_ns = monotonic_ns()
+                     + (input->generator == SERVER_INPUT_TRACE ? trace_next_delay(input) : input->period_ns);
+    input_arm(input);
+    wl_list_insert(server->inputs.prev, &input->link);
+    return input;
+}
+
+void server_input_destroy(struct server_input *input) {
+    wl_list_remove(&input->link);
+    wl_event_source_remove(input->source);
+    close(input->timer_fd);
+    free(input->trace);
+    free(input);
+}
+
+bool server_input_uses_touch(const struct server_input *input) {
+    return input->generator == SERVER_INPUT_TOUCH || input->generator == SERVER_INPUT_TRACE;
+}
+
+void server_inputs_destroy(struct server *server) {
+    struct server_input *input, *tmp;
+    wl_list_for_each_safe(input, tmp, &server->inputs, link) {
+        fprintf(stderr, "input %s: %llu samples, %llu skipped, %.1f us max lateness\n", input->name,
+                (unsigned long long) input->samples, (unsigned long long) input->skipped,
+                input->max_late_ns / 1000.0);
+        server_input_destroy(input);
+    }
+}
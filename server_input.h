@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include <wayland-server.h>
+
+/*
+ * Synthetic seat input for the headless server
+ *
+ * Every generator owns a timerfd armed at the absolute CLOCK_MONOTONIC time of
+ * its next sample, so rates up to 8 kHz hold without a hardware device. A
+ * wakeup that comes late sends every sample that fell due since, each one
+ * stamped with its own scheduled time rather than the time it was sent.
+ * Events go to the client with seat focus, pointer and touch samples end
+ * with their frame event.
+ *
+ *   pointer@HZ   circles around the focused surface, one turn per second
+ *   axis@HZ      wheel notches
+ *   keys@HZ      key presses and releases, typing a fixed phrase
+ *   touch@HZ     one finger swiping across the surface every second
+ *   trace:FILE   loops a pnt_events/key_events --record file at its own pace
+ */
+
+#define SERVER_INPUT_MIN_RATE 1
+#define SERVER_INPUT_MAX_RATE 8000
+
+struct server;
+struct server_input;
+
+/* NULL if `spec` is not one of the forms above */
+struct server_input *server_input_create(struct server *server, const char *spec);
+void server_input_destroy(struct server_input *input);
+bool server_input_uses_touch(const struct server_input *input);
+/* Prints the statistics of every generator, then destroys them */
+void server_inputs_destroy(struct server *server);
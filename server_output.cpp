@@ -0,0 +1,426 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include "presentation-time-server-protocol.h"
+#include "server.h"
+
+#define SERVER_BACKGROUND 0xFF202020
+/* How long virtual time waits for a client that stopped drawing */
+#define SERVER_CLOCK_WATCHDOG_MS 1000
+
+static uint64_t monotonic_ns() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void unlink_resource(struct wl_resource *resource) {
+    wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void destroy_resource(struct wl_client *client, struct wl_resource *resource) {
+    wl_resource_destroy(resource);
+}
+
+static bool surface_on_output(const struct server_surface *surface, const struct server_output *output) {
+    if (surface->output)
+        return surface->output == output;
+    /* Unmapped surfaces, such as cursors, follow the first output */
+    return output->link.prev == &output->server->outputs;
+}
+
+void server_surface_update_outputs(struct server_surface *surface) {
+    struct server *server = surface->server;
+    struct server_box surface_box = server_box_make(surface->x, surface->y,
+                                                    server_surface_width(surface),
+                                                    server_surface_height(surface));
+    uint32_t outputs = 0;
+    struct server_output *primary = NULL;
+    struct server_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        struct server_box output_box = server_box_make(output->x, output->y, output->width, output->height);
+        struct server_box overlap = server_box_intersect(&surface_box, &output_box);
+        if (!surface->mapped || server_box_empty(&overlap))
+            continue;
+        outputs |= 1u << output->index;
+        if (!primary)
+            primary = output;
+    }
+
+    uint32_t changed = outputs ^ surface->outputs;
+    wl_list_for_each(output, &server->outputs, link) {
+        uint32_t bit = 1u << output->index;
+        if (!(changed & bit))
+            continue;
+        struct wl_resource *resource;
+        wl_resource_for_each(resource, &output->resources) {
+            if (wl_resource_get_client(resource) != wl_resource_get_client(surface->resource))
+                continue;
+            if (outputs & bit)
+                wl_surface_send_enter(surface->resource, resource);
+            else
+                wl_surface_send_leave(surface->resource, resource);
+        }
+    }
+    surface->outputs = outputs;
+    surface->output = primary;
+}
+
+/* Presentation feedback */
+void server_feedbacks_discard(struct wl_list *feedbacks) {
+    struct wl_resource *resource, *tmp;
+    wl_resource_for_each_safe(resource, tmp, feedbacks) {
+        wp_presentation_feedback_send_discarded(resource);
+        wl_resource_destroy(resource);
+    }
+}
+
+static void feedbacks_present(struct wl_list *feedbacks, struct server_output *output, uint64_t time_ns) {
+    uint64_t seconds = time_ns / 1000000000;
+    struct wl_resource *resource, *tmp;
+    wl_resource_for_each_safe(resource, tmp, feedbacks) {
+        struct wl_resource *output_resource;
+        wl_resource_for_each(output_resource, &output->resources) {
+            if (wl_resource_get_client(output_resource) == wl_resource_get_client(resource))
+                wp_presentation_feedback_send_sync_output(resource, output_resource);
+        }
+        /* The timestamps are the computed ideal vblank grid, not read from
+         * hardware, and nothing signalled completion: only VSYNC holds */
+        wp_presentation_feedback_send_presented(resource, (uint32_t) (seconds >> 32), (uint32_t) seconds,
+                                                (uint32_t) (time_ns % 1000000000),
+                                                (uint32_t) output->period_ns,
+                                                (uint32_t) (output->msc >> 32), (uint32_t) output->msc,
+                                                WP_PRESENTATION_FEEDBACK_KIND_VSYNC);
+        wl_resource_destroy(resource);
+    }
+}
+
+static void presentation_feedback(struct wl_client *client, struct wl_resource *resource, uint32_t id,
+                                  struct wl_resource *surface_resource) {
+    struct server_surface *surface =
+            static_cast<struct server_surface *>(wl_resource_get_user_data(surface_resource));
+    struct wl_resource *feedback = wl_resource_create(client, &wp_presentation_feedback_interface, 1, id);
+    if (!feedback) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(feedback, NULL, NULL, unlink_resource);
+    wl_list_insert(surface->pending.feedbacks.prev, wl_resource_get_link(feedback));
+}
+
+static const struct wp_presentation_interface presentation_implementation = {
+        .destroy = destroy_resource,
+        .feedback = presentation_feedback,
+};
+
+static void presentation_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct wl_resource *resource = wl_resource_create(client, &wp_presentation_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &presentation_implementation, data, NULL);
+    /* Virtual time also counts in CLOCK_MONOTONIC units, from server start */
+    wp_presentation_send_clock_id(resource, CLOCK_MONOTONIC);
+}
+
+void server_presentation_init(struct server *server) {
+    server->presentation = wl_global_create(server->display, &wp_presentation_interface, 1, server,
+                                            presentation_bind);
+}
+
+/* Outputs */
+static const struct wl_output_interface output_implementation = {
+        .release = destroy_resource,
+};
+
+static void output_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct server_output *output = static_cast<struct server_output *>(data);
+    struct wl_resource *resource = wl_resource_create(client, &wl_output_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &output_implementation, output, unlink_resource);
+    wl_list_insert(&output->resources, wl_resource_get_link(resource));
+
+    /* Pretend to be a 96 DPI screen */
+    wl_output_send_geometry(resource, output->x, output->y,
+                            output->width * 254 / 960, output->height * 254 / 960,
+                            WL_OUTPUT_SUBPIXEL_UNKNOWN, "wl_sample", "headless",
+                            WL_OUTPUT_TRANSFORM_NORMAL);
+    wl_output_send_mode(resource, WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED,
+                        output->width, output->height, output->refresh_mhz);
+    if (version >= WL_OUTPUT_SCALE_SINCE_VERSION)
+        wl_output_send_scale(resource, 1);
+    if (version >= WL_OUTPUT_DONE_SINCE_VERSION)
+        wl_output_send_done(resource);
+
+    struct server_surface *surface;
+    wl_list_for_each(surface, &output->server->surfaces, link) {
+        if ((surface->outputs & 1u << output->index) && wl_resource_get_client(surface->resource) == client)
+            wl_surface_send_enter(surface->resource, resource);
+    }
+}
+
+void server_surface_damage(struct server_surface *surface) {
+    struct server_region whole;
+    server_region_init(&whole, false);
+    struct server_box box = server_box_make(0, 0, server_surface_width(surface), server_surface_height(surface));
+    server_region_add(&whole, &box);
+    server_surface_damage_region(surface, &whole);
+}
+
+void server_surface_damage_region(struct server_surface *surface, const struct server_region *damage) {
+    struct server_box bounds = server_box_make(0, 0, server_surface_width(surface), server_surface_height(surface));
+    struct server_output *output;
+    wl_list_for_each(output, &surface->server->outputs, link) {
+        if (!(surface->outputs & 1u << output->index))
+            continue;
+        /* Surface coordinates are output pixels shifted by the two positions */
+        int32_t dx = surface->x - output->x, dy = surface->y - output->y;
+        for (uint32_t i = 0; i < damage->count; ++i) {
+            struct server_box box = server_box_intersect(&damage->boxes[i], &bounds);
+            if (server_box_empty(&box))
+                continue;
+            box = server_box_make(box.x1 + dx, box.y1 + dy, box.x2 - box.x1, box.y2 - box.y1);
+            server_scene_damage_box(&output->scene, &box);
+        }
+    }
+}
+
+/* Redraws the damaged part of the output image from the visible surfaces */
+static void output_composite(struct server_output *output) {
+    struct server_scene *scene = &output->scene;
+    if (scene->damage.count == 0)
+        return;
+    uint64_t start = monotonic_ns();
+
+    server_scene_reset(scene);
+    struct server_surface *surface;
+    wl_list_for_each(surface, &output->server->surfaces, link) {
+        if (!surface->mapped || !surface->pixels || !(surface->outputs & 1u << output->index))
+            continue;
+        struct server_layer *layer = server_scene_push(scene);
+        if (!layer)
+            break;
+        layer->pixels = surface->pixels;
+        layer->stride = surface->buffer_width;
+        layer->x = surface->x - output->x;
+        layer->y = surface->y - output->y;
+        layer->width = server_surface_width(surface);
+        layer->height = server_surface_height(surface);
+        layer->scale = surface->scale;
+        layer->has_alpha = surface->has_alpha;
+        /* Clipped in surface coordinates, a client may send an opaque region up to INT32_MAX */
+        layer->opaque = surface->opaque;
+        struct server_box rect = server_box_make(0, 0, layer->width, layer->height);
+        server_region_intersect(&layer->opaque, &rect);
+        server_region_translate(&layer->opaque, layer->x, layer->y);
+    }
+    server_scene_cull(scene);
+
+    struct server_composite_target target = {
+            output->pixels, output->width, output->height, SERVER_BACKGROUND,
+            scene->layers, scene->count, &scene->damage,
+    };
+    server_compositor_run(output->server->compositor, &target);
+    uint64_t elapsed = monotonic_ns() - start;
+    server_scene_frame_done(scene, elapsed);
+
+    if (output->server->stats) {
+        fprintf(stderr, "output %u frame %llu: %.2f%% touched, %u layers, %u culled, %.1f us\n",
+                output->index, (unsigned long long) scene->frames,
+                100.0 * scene->touched / ((uint64_t) output->width * output->height),
+                scene->count, scene->culled, elapsed / 1000.0);
+    }
+}
+
+/* One vblank at `time_ns`: composite, then answer callbacks and feedback */
+static void output_present(struct server_output *output, uint64_t time_ns) {
+    output_composite(output);
+    if (output->capture)
+        server_capture_frame(output->capture, output->pixels);
+    output->msc++;
+
+    struct server_surface *surface;
+    wl_list_for_each(surface, &output->server->surfaces, link) {
+        if (!surface_on_output(surface, output))
+            continue;
+        if (!wl_list_empty(&surface->frame_callbacks)) {
+            struct wl_resource *callback, *tmp;
+            wl_resource_for_each_safe(callback, tmp, &surface->frame_callbacks) {
+                wl_callback_send_done(callback, (uint32_t) (time_ns / 1000000));
+                wl_resource_destroy(callback);
+            }
+            surface->awaiting_commit = true;
+        }
+        if (surface->mapped)
+            feedbacks_present(&surface->feedbacks, output, time_ns);
+        else
+            server_feedbacks_discard(&surface->feedbacks);
+    }
+}
+
+static int output_vblank(void *data) {
+    struct server_output *output = static_cast<struct server_output *>(data);
+    if (output->server->accounting)
+        server_accounting_mark(output->server->accounting);
+    output_present(output, output->next_vblank_ns);
+
+    /* Keep to the refresh grid, counting vblanks that were missed */
+    uint64_t now = monotonic_ns();
+    output->next_vblank_ns += output->period_ns;
+    while (output->next_vblank_ns <= now) {
+        output->next_vblank_ns += output->period_ns;
+        output->msc++;
+    }
+    int delay_ms = (int) ((output->next_vblank_ns - now + 999999) / 1000000);
+    wl_event_source_timer_update(output->vblank, delay_ms);
+    return 0;
+}
+
+struct server_output *server_output_create(struct server *server, int32_t width, int32_t height,
+                                           int32_t refresh_mhz) {
+    uint32_t index = 0;
+    int32_t x = 0;
+    struct server_output *other;
+    wl_list_for_each(other, &server->outputs, link) {
+        index = other->index + 1;
+        x = other->x + other->width;
+    }
+    if (index >= SERVER_MAX_OUTPUTS)
+        return NULL;
+
+    struct server_output *output = static_cast<struct server_output *>(calloc(1, sizeof(*output)));
+    if (!output)
+        return NULL;
+    output->pixels = static_cast<uint32_t *>(malloc((size_t) width * height * 4));
+    if (!output->pixels) {
+        free(output);
+        return NULL;
+    }
+    /* Outputs are laid out left to right */
+    output->server = server;
+    output->index = index;
+    output->x = x;
+    output->width = width;
+    output->height = height;
+    output->refresh_mhz = refresh_mhz;
+    output->period_ns = 1000000000000ull / refresh_mhz;
+    wl_list_init(&output->resources);
+    server_scene_init(&output->scene, width, height);
+    server_scene_damage_all(&output->scene);
+    output->global = wl_global_create(server->display, &wl_output_interface, 3, output, output_bind);
+    if (server->virtual_time) {
+        output->next_vblank_ns = server->virtual_now_ns + output->period_ns;
+    } else {
+        output->vblank = wl_event_loop_add_timer(server->loop, output_vblank, output);
+        output->next_vblank_ns = monotonic_ns() + output->period_ns;
+        wl_event_source_timer_update(output->vblank, (int) (output->period_ns / 1000000) + 1);
+    }
+    wl_list_insert(server->outputs.prev, &output->link);
+    return output;
+}
+
+void server_output_destroy(struct server_output *output) {
+    if (output->vblank)
+        wl_event_source_remove(output->vblank);
+    wl_global_destroy(output->global);
+    wl_list_remove(&output->link);
+    if (output->capture)
+        server_capture_destroy(output->capture);
+    server_scene_fini(&output->scene);
+    free(output->pixels);
+    free(output);
+}
+
+/* Virtual time */
+static void clock_schedule(struct server *server);
+
+/* Jumps to the earliest pending vblank of any output */
+static void clock_advance(struct server *server) {
+    uint64_t next = UINT64_MAX;
+    struct server_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        if (output->next_vblank_ns < next)
+            next = output->next_vblank_ns;
+    }
+    if (next == UINT64_MAX)
+        return;
+    server->virtual_now_ns = next;
+    wl_list_for_each(output, &server->outputs, link) {
+        if (output->next_vblank_ns != next)
+            continue;
+        output_present(output, next);
+        output->next_vblank_ns += output->period_ns;
+    }
+}
+
+static void clock_tick(void *data) {
+    struct server *server = static_cast<struct server *>(data);
+    server->virtual_tick = NULL;
+    if (server->accounting)
+        server_accounting_mark(server->accounting);
+    clock_advance(server);
+    wl_event_source_timer_update(server->virtual_watchdog, SERVER_CLOCK_WATCHDOG_MS);
+    clock_schedule(server);
+}
+
+/* Advances once no client owes a commit and somebody waits for a frame */
+static void clock_schedule(struct server *server) {
+    if (!server->virtual_time || server->virtual_tick)
+        return;
+    bool pending = false;
+    struct server_surface *surface;
+    wl_list_for_each(surface, &server->surfaces, link) {
+        if (surface->awaiting_commit)
+            return;
+        if (!wl_list_empty(&surface->frame_callbacks) || !wl_list_empty(&surface->feedbacks))
+            pending = true;
+    }
+    /* An idle source runs after the current batch of requests is dispatched */
+    if (pending)
+        server->virtual_tick = wl_event_loop_add_idle(server->loop, clock_tick, server);
+}
+
+static int clock_watchdog(void *data) {
+    struct server *server = static_cast<struct server *>(data);
+    bool stalled = false;
+    struct server_surface *surface;
+    wl_list_for_each(surface, &server->surfaces, link) {
+        stalled |= surface->awaiting_commit;
+        surface->awaiting_commit = false;
+    }
+    if (stalled) {
+        fprintf(stderr, "virtual clock: a client stopped committing, moving on\n");
+        clock_schedule(server);
+    }
+    return 0;
+}
+
+void server_clock_init(struct server *server, bool virtual_time) {
+    server->virtual_time = virtual_time;
+    server->virtual_now_ns = monotonic_ns();
+    if (virtual_time)
+        server->virtual_watchdog = wl_event_loop_add_timer(server->loop, clock_watchdog, server);
+}
+
+void server_clock_fini(struct server *server) {
+    if (server->virtual_tick)
+        wl_event_source_remove(server->virtual_tick);
+    if (server->virtual_watchdog)
+        wl_event_source_remove(server->virtual_watchdog);
+    server->virtual_tick = NULL;
+    server->virtual_watchdog = NULL;
+}
+
+void server_clock_surface_committed(struct server_surface *surface) {
+    surface->awaiting_commit = false;
+    clock_schedule(surface->server);
+}
+
+void server_clock_surface_destroyed(struct server *server) {
+    clock_schedule(server);
+}
@@ -0,0 +1,171 @@
+#include "server_region.h"
+
+struct server_box server_box_intersect(const struct server_box *a, const struct server_box *b) {
+    struct server_box box = {
+            a->x1 > b->x1 ? a->x1 : b->x1, a->y1 > b->y1 ? a->y1 : b->y1,
+            a->x2 < b->x2 ? a->x2 : b->x2, a->y2 < b->y2 ? a->y2 : b->y2,
+    };
+    if (server_box_empty(&box))
+        box = {0, 0, 0, 0};
+    return box;
+}
+
+/* Splits `box` minus `cut` into at most four boxes, returns how many */
+static int box_subtract(const struct server_box *box, const struct server_box *cut,
+                        struct server_box out[4]) {
+    struct server_box overlap = server_box_intersect(box, cut);
+    if (server_box_empty(&overlap)) {
+        out[0] = *box;
+        return 1;
+    }
+    int count = 0;
+    if (box->y1 < overlap.y1)
+        out[count++] = {box->x1, box->y1, box->x2, overlap.y1};
+    if (overlap.y2 < box->y2)
+        out[count++] = {box->x1, overlap.y2, box->x2, box->y2};
+    if (box->x1 < overlap.x1)
+        out[count++] = {box->x1, overlap.y1, overlap.x1, overlap.y2};
+    if (overlap.x2 < box->x2)
+        out[count++] = {overlap.x2, overlap.y1, box->x2, overlap.y2};
+    return count;
+}
+
+void server_region_init(struct server_region *region, bool shrink_on_overflow) {
+    region->count = 0;
+    region->shrink_on_overflow = shrink_on_overflow;
+}
+
+void server_region_clear(struct server_region *region) {
+    region->count = 0;
+}
+
+static void region_overflow(struct server_region *region, const struct server_box *extra) {
+    if (region->shrink_on_overflow)
+        return;
+    struct server_box extents = server_region_extents(region);
+    if (region->count == 0)
+        extents = *extra;
+    if (extra->x1 < extents.x1) extents.x1 = extra->x1;
+    if (extra->y1 < extents.y1) extents.y1 = extra->y1;
+    if (extra->x2 > extents.x2) extents.x2 = extra->x2;
+    if (extra->y2 > extents.y2) extents.y2 = extra->y2;
+    region->boxes[0] = extents;
+    region->count = 1;
+}
+
+void server_region_add(struct server_region *region, const struct server_box *box) {
+    if (server_box_empty(box))
+        return;
+
+    /* Keep the boxes disjoint: only add what is not covered yet */
+    struct server_box pieces[SERVER_REGION_MAX_BOXES];
+    uint32_t count = 1;
+    pieces[0] = *box;
+    for (uint32_t i = 0; i < region->count && count > 0; ++i) {
+        struct server_box next[SERVER_REGION_MAX_BOXES];
+        uint32_t next_count = 0;
+        for (uint32_t j = 0; j < count; ++j) {
+            struct server_box split[4];
+            int n = box_subtract(&pieces[j], &region->boxes[i], split);
+            if (next_count + n > SERVER_REGION_MAX_BOXES) {
+                region_overflow(region, box);
+                return;
+            }
+            for (int k = 0; k < n; ++k)
+                next[next_count++] = split[k];
+        }
+        for (uint32_t j = 0; j < next_count; ++j)
+            pieces[j] = next[j];
+        count = next_count;
+    }
+
+    if (region->count + count > SERVER_REGION_MAX_BOXES) {
+        region_overflow(region, box);
+        return;
+    }
+    for (uint32_t j = 0; j < count; ++j)
+        region->boxes[region->count++] = pieces[j];
+}
+
+void server_region_add_region(struct server_region *region, const struct server_region *other) {
+    for (uint32_t i = 0; i < other->count; ++i)
+        server_region_add(region, &other->boxes[i]);
+}
+
+void server_region_subtract(struct server_region *region, const struct server_box *box) {
+    struct server_box result[SERVER_REGION_MAX_BOXES];
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < region->count; ++i) {
+        struct server_box split[4];
+        int n = box_subtract(&region->boxes[i], box, split);
+        if (count + n > SERVER_REGION_MAX_BOXES) {
+            /* An opaque region loses the rest, damage skips the subtraction */
+            if (region->shrink_on_overflow)
+                break;
+            struct server_box extents = server_region_extents(region);
+            region->boxes[0] = extents;
+            region->count = 1;
+            return;
+        }
+        for (int k = 0; k < n; ++k)
+            result[count++] = split[k];
+    }
+    for (uint32_t i = 0; i < count; ++i)
+        region->boxes[i] = result[i];
+    region->count = count;
+}
+
+void server_region_intersect(struct server_region *region, const struct server_box *box) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < region->count; ++i) {
+        struct server_box clipped = server_box_intersect(&region->boxes[i], box);
+        if (!server_box_empty(&clipped))
+            region->boxes[count++] = clipped;
+    }
+    region->count = count;
+}
+
+void server_region_translate(struct server_region *region, int32_t dx, int32_t dy) {
+    for (uint32_t i = 0; i < region->count; ++i) {
+        region->boxes[i].x1 = server_coord_saturate((int64_t) region->boxes[i].x1 + dx);
+        region->boxes[i].y1 = server_coord_saturate((int64_t) region->boxes[i].y1 + dy);
+        region->boxes[i].x2 = server_coord_saturate((int64_t) region->boxes[i].x2 + dx);
+        region->boxes[i].y2 = server_coord_saturate((int64_t) region->boxes[i].y2 + dy);
+    }
+}
+
+struct server_box server_region_extents(const struct server_region *region) {
+    if (region->count == 0)
+        return {0, 0, 0, 0};
+    struct server_box extents = region->boxes[0];
+    for (uint32_t i = 1; i < region->count; ++i) {
+        const struct server_box *box = &region->boxes[i];
+        if (box->x1 < extents.x1) extents.x1 = box->x1;
+        if (box->y1 < extents.y1) extents.y1 = box->y1;
+        if (box->x2 > extents.x2) extents.x2 = box->x2;
+        if (box->y2 > extents.y2) extents.y2 = box->y2;
+    }
+    return extents;
+}
+
+uint64_t server_region_area(const struct server_region *region) {
+    uint64_t area = 0;
+    for (uint32_t i = 0; i < region->count; ++i) {
+        const struct server_box *box = &region->boxes[i];
+        area += (uint64_t) (box->x2 - box->x1) * (box->y2 - box->y1);
+    }
+    return area;
+}
+
+bool server_region_contains(const struct server_region *region, const struct server_box *box) {
+    if (server_box_empty(box))
+        return true;
+    /* Growing on overflow can only make the answer "no", never a wrong "yes" */
+    struct server_region rest;
+    server_region_init(&rest, false);
+    rest.boxes[0] = *box;
+    rest.count = 1;
+    for (uint32_t i = 0; i < region->count && rest.count > 0; ++i)
+        server_region_subtract(&rest, &region->boxes[i]);
+    return rest.count == 0;
+}
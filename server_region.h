@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Small rectangle sets for the headless compositor
+ *
+ * A region is a fixed array of disjoint boxes, which is plenty for surface
+ * damage and opaque regions. When an operation needs more boxes than fit, a
+ * growing region (damage) collapses to its bounding box, while a shrinking
+ * region (opaque areas) drops the pieces that do not fit, so either way the
+ * result errs on the safe side.
+ */
+
+#define SERVER_REGION_MAX_BOXES 32
+
+struct server_box {
+    int32_t x1, y1;
+    int32_t x2, y2;
+};
+
+struct server_region {
+    struct server_box boxes[SERVER_REGION_MAX_BOXES];
+    uint32_t count;
+    bool shrink_on_overflow;
+};
+
+static inline int32_t server_coord_saturate(int64_t value) {
+    return (int32_t) (value > INT32_MAX ? INT32_MAX : value < INT32_MIN ? INT32_MIN : value);
+}
+
+/* Saturates, clients like to damage INT32_MAX wide rectangles */
+static inline struct server_box server_box_make(int32_t x, int32_t y, int32_t width, int32_t height) {
+    struct server_box box = {x, y, server_coord_saturate((int64_t) x + width),
+                             server_coord_saturate((int64_t) y + height)};
+    return box;
+}
+
+static inline bool server_box_empty(const struct server_box *box) {
+    return box->x1 >= box->x2 || box->y1 >= box->y2;
+}
+
+struct server_box server_box_intersect(const struct server_box *a, const struct server_box *b);
+
+void server_region_init(struct server_region *region, bool shrink_on_overflow);
+void server_region_clear(struct server_region *region);
+void server_region_add(struct server_region *region, const struct server_box *box);
+void server_region_add_region(struct server_region *region, const struct server_region *other);
+void server_region_subtract(struct server_region *region, const struct server_box *box);
+void server_region_intersect(struct server_region *region, const struct server_box *box);
+/* Saturates like server_box_make instead of wrapping */
+void server_region_translate(struct server_region *region, int32_t dx, int32_t dy);
+struct server_box server_region_extents(const struct server_region *region);
+uint64_t server_region_area(const struct server_region *region);
+/* True if every pixel of `box` is in the region */
+bool server_region_contains(const struct server_region *region, const struct server_box *box);
@@ -0,0 +1,106 @@
+#include <cstdlib>
+#include "server_scene.h"
+
+void server_scene_init(struct server_scene *scene, int32_t width, int32_t height) {
+    scene->width = width;
+    scene->height = height;
+    scene->layers = NULL;
+    scene->count = 0;
+    scene->capacity = 0;
+    server_region_init(&scene->damage, false);
+    scene->culled = 0;
+    scene->touched = 0;
+    scene->frames = 0;
+    scene->frame_pixels = 0;
+    scene->touched_pixels = 0;
+    scene->culled_layers = 0;
+    scene->composite_ns = 0;
+    scene->composite_max_ns = 0;
+}
+
+void server_scene_fini(struct server_scene *scene) {
+    free(scene->layers);
+    scene->layers = NULL;
+    scene->count = scene->capacity = 0;
+}
+
+void server_scene_reset(struct server_scene *scene) {
+    scene->count = 0;
+}
+
+struct server_layer *server_scene_push(struct server_scene *scene) {
+    if (scene->count == scene->capacity) {
+        uint32_t capacity = scene->capacity ? scene->capacity * 2 : 16;
+        struct server_layer *layers =
+                static_cast<struct server_layer *>(realloc(scene->layers, capacity * sizeof(*layers)));
+        if (!layers)
+            return NULL;
+        scene->layers = layers;
+        scene->capacity = capacity;
+    }
+    return &scene->layers[scene->count++];
+}
+
+void server_scene_damage_box(struct server_scene *scene, const struct server_box *box) {
+    struct server_box output = {0, 0, scene->width, scene->height};
+    struct server_box clipped = server_box_intersect(box, &output);
+    server_region_add(&scene->damage, &clipped);
+}
+
+void server_scene_damage_all(struct server_scene *scene) {
+    struct server_box output = {0, 0, scene->width, scene->height};
+    server_region_clear(&scene->damage);
+    server_region_add(&scene->damage, &output);
+}
+
+/* True if some damaged pixel of `rect` is not covered by `above` */
+static bool layer_visible(const struct server_region *damage, const struct server_region *above,
+                          const struct server_box *rect) {
+    for (uint32_t i = 0; i < damage->count; ++i) {
+        struct server_box piece = server_box_intersect(&damage->boxes[i], rect);
+        if (!server_box_empty(&piece) && !server_region_contains(above, &piece))
+            return true;
+    }
+    return false;
+}
+
+uint32_t server_scene_cull(struct server_scene *scene) {
+    /* Top down, what is opaque so far hides everything below it */
+    struct server_region above;
+    server_region_init(&above, true);
+    uint32_t total = scene->count, kept = 0;
+    for (uint32_t i = total; i-- > 0;) {
+        struct server_layer *layer = &scene->layers[i];
+        struct server_box rect = server_box_make(layer->x, layer->y, layer->width, layer->height);
+        bool visible = layer_visible(&scene->damage, &above, &rect);
+
+        if (!layer->has_alpha)
+            server_region_add(&above, &rect);
+        else
+            server_region_add_region(&above, &layer->opaque);
+
+        /* Survivors gather at the top end, still in order */
+        if (visible) {
+            kept++;
+            if (i != total - kept)
+                scene->layers[total - kept] = *layer;
+        }
+    }
+    for (uint32_t i = 0; i < kept; ++i)
+        scene->layers[i] = scene->layers[total - kept + i];
+    scene->count = kept;
+    scene->culled = total - kept;
+    return kept;
+}
+
+void server_scene_frame_done(struct server_scene *scene, uint64_t composite_ns) {
+    scene->touched = server_region_area(&scene->damage);
+    server_region_clear(&scene->damage);
+    scene->frames++;
+    scene->frame_pixels += (uint64_t) scene->width * scene->height;
+    scene->touched_pixels += scene->touched;
+    scene->culled_layers += scene->culled;
+    scene->composite_ns += composite_ns;
+    if (composite_ns > scene->composite_max_ns)
+        scene->composite_max_ns = composite_ns;
+}
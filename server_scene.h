@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include "server_composite.h"
+#include "server_region.h"
+
+/*
+ * Per-output scene for the headless server
+ *
+ * Every vblank the output lists its surfaces bottom to top as layers in
+ * output pixels. Damage is collected here between vblanks, already moved
+ * through surface positions and buffer scales, and culling drops the layers
+ * that are outside the damage or hidden under opaque layers above them, so
+ * the compositor only visits what can change on screen.
+ */
+
+struct server_scene {
+    int32_t width, height;
+    struct server_layer *layers;    /* Bottom to top */
+    uint32_t count;
+    uint32_t capacity;
+    struct server_region damage;    /* Output pixels */
+
+    /* Last frame */
+    uint32_t culled;
+    uint64_t touched;               /* Damaged pixels */
+
+    /* Totals */
+    uint64_t frames;
+    uint64_t frame_pixels;
+    uint64_t touched_pixels;
+    uint64_t culled_layers;
+    uint64_t composite_ns;
+    uint64_t composite_max_ns;
+};
+
+void server_scene_init(struct server_scene *scene, int32_t width, int32_t height);
+void server_scene_fini(struct server_scene *scene);
+/* Empties the layer list, keeps the damage */
+void server_scene_reset(struct server_scene *scene);
+/* NULL when out of memory */
+struct server_layer *server_scene_push(struct server_scene *scene);
+/* `box` in output pixels, clipped to the output */
+void server_scene_damage_box(struct server_scene *scene, const struct server_box *box);
+void server_scene_damage_all(struct server_scene *scene);
+/* Drops layers the damage does not reach, returns how many are left */
+uint32_t server_scene_cull(struct server_scene *scene);
+/* Called after compositing, clears the damage and counts the frame */
+void server_scene_frame_done(struct server_scene *scene, uint64_t composite_ns);
@@ -0,0 +1,562 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/sockios.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include "xdg-shell-client-protocol.h"
+
+/*
+ * Multi-client scaling harness
+ *
+ * Opens N connections to the compositor from one process, each with its own
+ * toplevel that redraws on every frame callback, the way frame does. N grows
+ * step by step; every step waits a second for the new clients to settle, then
+ * measures frame rates, vblanks that clients missed according to the frame
+ * callback timestamps, compositor CPU and memory, and the bytes queued in the
+ * sockets. The ramp stops once the missed share crosses the threshold.
+ */
+
+#define STRESS_WARMUP_NS 1000000000ull
+#define STRESS_DEFAULT_REFRESH_MHZ 60000
+
+struct stress_buffer {
+    struct wl_buffer *wl_buffer;
+    uint32_t *data;
+    bool busy;
+};
+
+struct stress_client {
+    struct stress *stress;
+    uint32_t index;
+    struct wl_display *wl_display;
+    struct wl_registry *wl_registry;
+    struct wl_shm *wl_shm;
+    struct wl_compositor *wl_compositor;
+    struct xdg_wm_base *xdg_wm_base;
+    struct wl_output *wl_output;
+    struct wl_surface *wl_surface;
+    struct xdg_surface *xdg_surface;
+    struct xdg_toplevel *xdg_toplevel;
+    struct stress_buffer buffers[2];
+    void *pool_data;
+    size_t pool_size;
+    bool configured;
+    bool failed;
+
+    uint32_t frame;
+    uint32_t last_time;             /* Of the previous frame callback, ms */
+    /* Current step */
+    uint64_t frames;
+    uint64_t missed;
+};
+
+struct stress {
+    int32_t width, height;
+    int32_t refresh_mhz;            /* From the first wl_output, if any */
+    bool measuring;
+    struct stress_client **clients;
+    uint32_t count;
+};
+
+struct stress_sample {
+    uint64_t cpu_ticks;             /* utime + stime */
+    uint64_t rss_kb;
+};
+
+static uint64_t monotonic_ns() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void randname(char *buf) {
+    struct timespec ts{};
+    clock_gettime(CLOCK_REALTIME, &ts);
+    long r = ts.tv_nsec;
+    for (int i = 0; i < 6; ++i) {
+        buf[i] = 'A' + (r & 15) + (r & 16) * 2;
+        r >>= 5;
+    }
+}
+
+static int allocate_shm_file(size_t size) {
+    int retries = 100;
+    int fd;
+    do {
+        char name[] = "/wl_shm-XXXXXX";
+        randname(name + sizeof(name) - 7);
+        --retries;
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd >= 0) {
+            shm_unlink(name);
+            break;
+        }
+    } while (retries > 0 && errno == EEXIST);
+    if (fd < 0)
+        return -1;
+    int ret;
+    do {
+        ret = ftruncate(fd, (off_t) size);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* /proc/PID/stat and /proc/PID/status, zeros if the process is gone */
+static struct stress_sample sample_process(pid_t pid) {
+    struct stress_sample sample = {0, 0};
+    char path[64], line[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+    FILE *file = fopen(path, "r");
+    if (file) {
+        if (fgets(line, sizeof(line), file)) {
+            /* The command name may contain spaces, fields resume after its ')' */
+            const char *fields = strrchr(line, ')');
+            unsigned long long utime = 0, stime = 0;
+            if (fields && sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+                                 &utime, &stime) == 2)
+                sample.cpu_ticks = utime + stime;
+        }
+        fclose(file);
+    }
+    snprintf(path, sizeof(path), "/proc/%d/status", (int) pid);
+    file = fopen(path, "r");
+    if (file) {
+        unsigned long long rss;
+        while (fgets(line, sizeof(line), file)) {
+            if (sscanf(line, "VmRSS: %llu kB", &rss) == 1) {
+                sample.rss_kb = rss;
+                break;
+            }
+        }
+        fclose(file);
+    }
+    return sample;
+}
+
+static void buffer_release(void *data, struct wl_buffer *wl_buffer) {
+    static_cast<struct stress_buffer *>(data)->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+        .release = buffer_release,
+};
+
+static bool client_create_buffers(struct stress_client *client) {
+    int32_t width = client->stress->width, height = client->stress->height;
+    int32_t stride = width * 4;
+    size_t size = (size_t) stride * height;
+    client->pool_size = 2 * size;
+
+    int fd = allocate_shm_file(client->pool_size);
+    if (fd < 0)
+        return false;
+    client->pool_data = mmap(NULL, client->pool_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (client->pool_data == MAP_FAILED) {
+        client->pool_data = NULL;
+        close(fd);
+        return false;
+    }
+    struct wl_shm_pool *pool = wl_shm_create_pool(client->wl_shm, fd, (int32_t) client->pool_size);
+    for (int i = 0; i < 2; ++i) {
+        struct stress_buffer *buffer = &client->buffers[i];
+        buffer->data = reinterpret_cast<uint32_t *>(static_cast<uint8_t *>(client->pool_data) + i * size);
+        buffer->wl_buffer = wl_shm_pool_create_buffer(pool, (int32_t) (i * size), width, height, stride,
+                                                      WL_SHM_FORMAT_XRGB8888);
+        wl_buffer_add_listener(buffer->wl_buffer, &buffer_listener, buffer);
+    }
+    wl_shm_pool_destroy(pool);
+    close(fd);
+    return true;
+}
+
+static void client_draw(struct stress_client *client) {
+    struct stress_buffer *buffer = NULL;
+    for (int i = 0; i < 2; ++i) {
+        if (!client->buffers[i].busy) {
+            buffer = &client->buffers[i];
+            break;
+        }
+    }
+    /* Both still held by the compositor, commit without new content */
+    if (!buffer)
+        return;
+
+    /* A bar sweeping down over a tint that tells the clients apart */
+    int32_t width = client->stress->width, height = client->stress->height;
+    uint32_t tint = 0xff000000 | (client->index * 0x3f1d27u & 0x7f7f7f);
+    int32_t bar = (int32_t) (client->frame % (uint32_t) height);
+    for (int32_t y = 0; y < height; ++y) {
+        uint32_t color = y >= bar && y < bar + 8 ? 0xffffffff : tint;
+        uint32_t *row = buffer->data + (size_t) y * width;
+        for (int32_t x = 0; x < width; ++x)
+            row[x] = color;
+    }
+    client->frame++;
+
+    wl_surface_attach(client->wl_surface, buffer->wl_buffer, 0, 0);
+    wl_surface_damage_buffer(client->wl_surface, 0, 0, INT32_MAX, INT32_MAX);
+    buffer->busy = true;
+}
+
+static void frame_done(void *data, struct wl_callback *callback, uint32_t time);
+
+static const struct wl_callback_listener frame_listener = {
+        .done = frame_done,
+};
+
+static void client_commit_frame(struct stress_client *client) {
+    struct wl_callback *callback = wl_surface_frame(client->wl_surface);
+    wl_callback_add_listener(callback, &frame_listener, client);
+    client_draw(client);
+    wl_surface_commit(client->wl_surface);
+}
+
+static void frame_done(void *data, struct wl_callback *callback, uint32_t time) {
+    wl_callback_destroy(callback);
+    struct stress_client *client = static_cast<struct stress_client *>(data);
+    struct stress *stress = client->stress;
+
+    if (stress->measuring && client->last_time != 0) {
+        /* Every vblank that passed since the previous callback without one is a miss */
+        uint32_t interval_us = (time - client->last_time) * 1000;
+        uint32_t period_us = (uint32_t) (1000000000ull / stress->refresh_mhz);
+        uint32_t vblanks = (interval_us + period_us / 2) / period_us;
+        if (vblanks > 1)
+            client->missed += vblanks - 1;
+        client->frames++;
+    }
+    client->last_time = time;
+    client_commit_frame(client);
+}
+
+static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface, uint32_t serial) {
+    struct stress_client *client = static_cast<struct stress_client *>(data);
+    xdg_surface_ack_configure(xdg_surface, serial);
+    if (client->configured)
+        return;
+    client->configured = true;
+    client_commit_frame(client);
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+        .configure = xdg_surface_configure,
+};
+
+static void xdg_wm_base_ping(void *data, struct xdg_wm_base *xdg_wm_base, uint32_t serial) {
+    xdg_wm_base_pong(xdg_wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener xdg_wm_base_listener = {
+        .ping = xdg_wm_base_ping,
+};
+
+static void output_geometry(void *data, struct wl_output *wl_output, int32_t x, int32_t y, int32_t physical_width,
+                            int32_t physical_height, int32_t subpixel, const char *make, const char *model,
+                            int32_t transform) {
+}
+
+static void output_mode(void *data, struct wl_output *wl_output, uint32_t flags, int32_t width, int32_t height,
+                        int32_t refresh) {
+    struct stress_client *client = static_cast<struct stress_client *>(data);
+    if ((flags & WL_OUTPUT_MODE_CURRENT) && refresh > 0)
+        client->stress->refresh_mhz = refresh;
+}
+
+static void output_done(void *data, struct wl_output *wl_output) {
+}
+
+static void output_scale(void *data, struct wl_output *wl_output, int32_t factor) {
+}
+
+static const struct wl_output_listener output_listener = {
+        .geometry = output_geometry,
+        .mode = output_mode,
+        .done = output_done,
+        .scale = output_scale,
+};
+
+static void registry_global(void *data, struct wl_registry *wl_registry, uint32_t name, const char *interface,
+                            uint32_t version) {
+    struct stress_client *client = static_cast<struct stress_client *>(data);
+    if (strcmp(interface, wl_shm_interface.name) == 0) {
+        client->wl_shm = static_cast<wl_shm *>(wl_registry_bind(wl_registry, name, &wl_shm_interface, 1));
+    } else if (strcmp(interface, wl_compositor_interface.name) == 0) {
+        client->wl_compositor = static_cast<wl_compositor *>(wl_registry_bind(
+                wl_registry, name, &wl_compositor_interface, 4));
+    } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+        client->xdg_wm_base = static_cast<xdg_wm_base *>(wl_registry_bind(
+                wl_registry, name, &xdg_wm_base_interface, 1));
+        xdg_wm_base_add_listener(client->xdg_wm_base, &xdg_wm_base_listener, client);
+    } else if (strcmp(interface, wl_output_interface.name) == 0 && client->index == 0 && !client->wl_output) {
+        /* The first client reads the refresh rate for everybody */
+        client->wl_output = static_cast<wl_output *>(wl_registry_bind(wl_registry, name, &wl_output_interface, 2));
+        wl_output_add_listener(client->wl_output, &output_listener, client);
+    }
+}
+
+static void registry_global_remove(void *data, struct wl_registry *wl_registry, uint32_t name) {
+}
+
+static const struct wl_registry_listener registry_listener = {
+        .global = registry_global,
+        .global_remove = registry_global_remove,
+};
+
+static void client_destroy(struct stress_client *client) {
+    for (int i = 0; i < 2; ++i) {
+        if (client->buffers[i].wl_buffer)
+            wl_buffer_destroy(client->buffers[i].wl_buffer);
+    }
+    if (client->pool_data)
+        munmap(client->pool_data, client->pool_size);
+    if (client->xdg_toplevel)
+        xdg_toplevel_destroy(client->xdg_toplevel);
+    if (client->xdg_surface)
+        xdg_surface_destroy(client->xdg_surface);
+    if (client->wl_surface)
+        wl_surface_destroy(client->wl_surface);
+    if (client->wl_display)
+        wl_display_disconnect(client->wl_display);
+    free(client);
+}
+
+static struct stress_client *client_create(struct stress *stress, uint32_t index) {
+    struct stress_client *client = static_cast<struct stress_client *>(calloc(1, sizeof(*client)));
+    if (!client)
+        return NULL;
+    client->stress = stress;
+    client->index = index;
+    client->wl_display = wl_display_connect(NULL);
+    if (!client->wl_display) {
+        client_destroy(client);
+        return NULL;
+    }
+    client->wl_registry = wl_display_get_registry(client->wl_display);
+    wl_registry_add_listener(client->wl_registry, &registry_listener, client);
+    wl_display_roundtrip(client->wl_display);
+    if (!client->wl_shm || !client->wl_compositor || !client->xdg_wm_base || !client_create_buffers(client)) {
+        client_destroy(client);
+        return NULL;
+    }
+
+    client->wl_surface = wl_compositor_create_surface(client->wl_compositor);
+    client->xdg_surface = xdg_wm_base_get_xdg_surface(client->xdg_wm_base, client->wl_surface);
+    xdg_surface_add_listener(client->xdg_surface, &xdg_surface_listener, client);
+    client->xdg_toplevel = xdg_surface_get_toplevel(client->xdg_surface);
+    char title[32];
+    snprintf(title, sizeof(title), "stress %u", index);
+    xdg_toplevel_set_title(client->xdg_toplevel, title);
+    wl_surface_commit(client->wl_surface);
+    wl_display_flush(client->wl_display);
+    return client;
+}
+
+/* Bytes waiting in the socket, unread events and requests the compositor has not taken yet */
+static void client_backlog(struct stress_client *client, uint64_t *in, uint64_t *out) {
+    int fd = wl_display_get_fd(client->wl_display);
+    int queued = 0;
+    if (ioctl(fd, SIOCINQ, &queued) == 0)
+        *in = (uint64_t) queued;
+    if (ioctl(fd, SIOCOUTQ, &queued) == 0)
+        *out = (uint64_t) queued;
+}
+
+/* Runs every connection for `duration_ns`, tracking the deepest socket queues */
+static bool stress_run(struct stress *stress, struct pollfd *fds, uint64_t duration_ns, uint64_t *max_in,
+                       uint64_t *max_out) {
+    uint64_t end = monotonic_ns() + duration_ns;
+    for (;;) {
+        for (uint32_t i = 0; i < stress->count; ++i) {
+            struct stress_client *client = stress->clients[i];
+            fds[i].fd = wl_display_get_fd(client->wl_display);
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+            if (client->failed)
+                continue;
+            wl_display_dispatch_pending(client->wl_display);
+            if (wl_display_flush(client->wl_display) < 0 && errno == EAGAIN)
+                fds[i].events |= POLLOUT;
+
+            uint64_t in = 0, out = 0;
+            client_backlog(client, &in, &out);
+            if (in > *max_in)
+                *max_in = in;
+            if (out > *max_out)
+                *max_out = out;
+        }
+
+        uint64_t now = monotonic_ns();
+        if (now >= end)
+            return true;
+        int timeout = (int) ((end - now + 999999) / 1000000);
+        if (poll(fds, stress->count, timeout < 100 ? timeout : 100) < 0 && errno != EINTR)
+            return false;
+
+        for (uint32_t i = 0; i < stress->count; ++i) {
+            struct stress_client *client = stress->clients[i];
+            if (client->failed || !(fds[i].revents & (POLLIN | POLLERR | POLLHUP)))
+                continue;
+            if (wl_display_dispatch(client->wl_display) < 0) {
+                fprintf(stderr, "client %u lost its connection: %s\n", client->index,
+                        strerror(wl_display_get_error(client->wl_display)));
+                client->failed = true;
+                return false;
+            }
+        }
+    }
+}
+
+static pid_t compositor_pid(struct stress_client *client) {
+    struct ucred credentials{};
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(wl_display_get_fd(client->wl_display), SOL_SOCKET, SO_PEERCRED, &credentials, &length) < 0)
+        return 0;
+    return credentials.pid;
+}
+
+static uint64_t self_cpu_us() {
+    struct rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return (uint64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+           + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--start N] [--step N] [--max N] [--seconds S] [--size WIDTHxHEIGHT] [--miss PERCENT]\n",
+            name);
+    fprintf(stderr, "  --start    clients in the first step (default 1)\n");
+    fprintf(stderr, "  --step     clients added per step (default 4)\n");
+    fprintf(stderr, "  --max      stop after this many clients (default 256)\n");
+    fprintf(stderr, "  --seconds  measured time per step (default 3)\n");
+    fprintf(stderr, "  --size     window size (default 256x256)\n");
+    fprintf(stderr, "  --miss     stop once this share of vblanks is missed (default 5)\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct stress stress = {};
+    stress.width = 256;
+    stress.height = 256;
+    stress.refresh_mhz = STRESS_DEFAULT_REFRESH_MHZ;
+    int start = 1, step = 4, max = 256;
+    double seconds = 3, miss_percent = 5;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "--start") == 0 && (start = atoi(argv[i + 1])) > 0)
+            continue;
+        if (strcmp(argv[i], "--step") == 0 && (step = atoi(argv[i + 1])) > 0)
+            continue;
+        if (strcmp(argv[i], "--max") == 0 && (max = atoi(argv[i + 1])) > 0)
+            continue;
+        if (strcmp(argv[i], "--seconds") == 0 && (seconds = atof(argv[i + 1])) > 0)
+            continue;
+        if (strcmp(argv[i], "--miss") == 0 && (miss_percent = atof(argv[i + 1])) > 0)
+            continue;
+        if (strcmp(argv[i], "--size") == 0 && sscanf(argv[i + 1], "%dx%d", &stress.width, &stress.height) == 2
+                && stress.width > 0 && stress.height > 0)
+            continue;
+        usage(argv[0]);
+        return 1;
+    }
+    if (argc % 2 == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    stress.clients = static_cast<struct stress_client **>(calloc((size_t) max, sizeof(*stress.clients)));
+    struct pollfd *fds = static_cast<struct pollfd *>(calloc((size_t) max, sizeof(*fds)));
+    if (!stress.clients || !fds)
+        return 1;
+
+    /* Every connection holds a socket, a few hundred of them pass the usual soft limit */
+    struct rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    pid_t compositor = 0;
+    long ticks_per_second = sysconf(_SC_CLK_TCK);
+    printf("clients  fps mean  fps min  missed  compositor cpu  harness cpu  backlog in/out max  "
+           "compositor rss  harness rss\n");
+    if (start > max)
+        start = max;
+    for (int target = start;; target = target + step < max ? target + step : max) {
+        while (stress.count < (uint32_t) target) {
+            struct stress_client *client = client_create(&stress, stress.count);
+            if (!client) {
+                fprintf(stderr, "Unable to connect client %u\n", stress.count);
+                goto done;
+            }
+            stress.clients[stress.count++] = client;
+            if (!compositor)
+                compositor = compositor_pid(client);
+        }
+
+        uint64_t max_in = 0, max_out = 0;
+        stress.measuring = false;
+        if (!stress_run(&stress, fds, STRESS_WARMUP_NS, &max_in, &max_out))
+            break;
+        for (uint32_t i = 0; i < stress.count; ++i) {
+            stress.clients[i]->frames = 0;
+            stress.clients[i]->missed = 0;
+        }
+        max_in = max_out = 0;
+        stress.measuring = true;
+        struct stress_sample before = sample_process(compositor);
+        uint64_t self_before = self_cpu_us();
+        uint64_t measure_start = monotonic_ns();
+        if (!stress_run(&stress, fds, (uint64_t) (seconds * 1e9), &max_in, &max_out))
+            break;
+        double elapsed = (monotonic_ns() - measure_start) / 1e9;
+        struct stress_sample after = sample_process(compositor);
+        uint64_t self_after = self_cpu_us();
+
+        double fps_sum = 0, fps_min = 0;
+        uint64_t frames = 0, missed = 0;
+        for (uint32_t i = 0; i < stress.count; ++i) {
+            const struct stress_client *client = stress.clients[i];
+            double fps = client->frames / elapsed;
+            fps_sum += fps;
+            if (i == 0 || fps < fps_min)
+                fps_min = fps;
+            frames += client->frames;
+            missed += client->missed;
+        }
+        double missed_share = frames + missed ? 100.0 * missed / (frames + missed) : 100.0;
+        printf("%7u  %8.1f  %7.1f  %5.1f%%  %13.1f%%  %10.1f%%  %8llu/%-8llu  %10llu kB  %8llu kB\n",
+               stress.count, fps_sum / stress.count, fps_min, missed_share,
+               ticks_per_second > 0 ? 100.0 * (after.cpu_ticks - before.cpu_ticks) / ticks_per_second / elapsed : 0.0,
+               (self_after - self_before) / 1e4 / elapsed, (unsigned long long) max_in,
+               (unsigned long long) max_out, (unsigned long long) after.rss_kb,
+               (unsigned long long) sample_process(getpid()).rss_kb);
+        fflush(stdout);
+        if (missed_share > miss_percent) {
+            printf("frame callback deadlines missed at %u clients, %.3f Hz output\n", stress.count,
+                   stress.refresh_mhz / 1000.0);
+            break;
+        }
+        if (target == max)
+            break;
+    }
+
+done:
+    for (uint32_t i = 0; i < stress.count; ++i)
+        client_destroy(stress.clients[i]);
+    free(stress.clients);
+    free(fds);
+    return 0;
+}
@@ -1,5 +1,8 @@
 
 #include "vulkan_base.h"
+
+#include <linux/input-event-codes.h>
+
 #define VK_CHECK_RESULT(f)																				\
 {																										\
 	VkResult res = (f);																					\
@@ -67,21 +70,31 @@ static VkCommandBufferAllocateInfo commandBufferAllocateInfo(
 
 void VulkanBase::createCommandBuffers()
 {
-	// Create one command buffer for each swap chain image and reuse for rendering
-	drawCmdBuffers.resize(swapChain.imageCount);
+	// Create one command buffer per frame in flight, it is re-recorded for
+	// whichever swap chain image the frame acquires
+	framesInFlight = std::min(std::max(framesInFlight, 1u), (uint32_t)MAX_FRAMES_IN_FLIGHT);
+	frames.resize(framesInFlight);
 
+	std::vector<VkCommandBuffer> cmdBuffers(frames.size());
 	VkCommandBufferAllocateInfo cmdBufAllocateInfo =
 		commandBufferAllocateInfo(
 			cmdPool,
 			VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-			static_cast<uint32_t>(drawCmdBuffers.size()));
+			static_cast<uint32_t>(cmdBuffers.size()));
 
-	VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, drawCmdBuffers.data()));
+	VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdBufAllocateInfo, cmdBuffers.data()));
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		frames[i].cmdBuffer = cmdBuffers[i];
+	}
 }
 
 void VulkanBase::destroyCommandBuffers()
 {
-	vkFreeCommandBuffers(device, cmdPool, static_cast<uint32_t>(drawCmdBuffers.size()), drawCmdBuffers.data());
+	for (auto& frame : frames)
+	{
+		vkFreeCommandBuffers(device, cmdPool, 1, &frame.cmdBuffer);
+	}
 }
 
 std::string VulkanBase::getShadersPath() const
@@ -107,7 +120,36 @@ void VulkanBase::prepare()
 	setupRenderPass();
 	createPipelineCache();
 	setupFrameBuffer();
+	upload.create(vulkanDevice, transferQueue, queue, UPLOAD_STAGING_SIZE);
+
+	statsWindowStart = std::chrono::steady_clock::now();
+}
+
+static double msBetween(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+	return std::chrono::duration<double, std::milli>(end - start).count();
+}
 
+void VulkanBase::logFrameStats(const char *label, const FrameStats &stats)
+{
+	printf("%s%s, %u images, %zu in flight: %.1f fps, blocked %.2f ms, retire %.2f ms\n",
+		label, vulkan_swap_chain::presentModeName(swapChain.presentMode), swapChain.imageCount, frames.size(),
+		stats.frames / stats.seconds,
+		stats.frames ? stats.blockedMs / stats.frames : 0.0,
+		stats.retired ? stats.retireMs / stats.retired : 0.0);
+	fflush(stdout);
+}
+
+// Fold the current window into the run totals and start a new window
+void VulkanBase::rollFrameStats()
+{
+	statsTotal.frames += statsWindow.frames;
+	statsTotal.blockedMs += statsWindow.blockedMs;
+	statsTotal.retireMs += statsWindow.retireMs;
+	statsTotal.retired += statsWindow.retired;
+	statsTotal.seconds += statsWindow.seconds;
+	statsWindow = FrameStats();
+	statsWindowStart = std::chrono::steady_clock::now();
 }
 
 
@@ -125,6 +167,15 @@ void VulkanBase::renderLoop()
 
 		render();
 	}
+	if (frameStats)
+	{
+		statsWindow.seconds = msBetween(statsWindowStart, std::chrono::steady_clock::now()) / 1000.0;
+		rollFrameStats();
+		if (statsTotal.seconds > 0.0)
+		{
+			logFrameStats("total: ", statsTotal);
+		}
+	}
 	// Flush device to make sure all resources can be freed
 	if (device != VK_NULL_HANDLE) {
 		vkDeviceWaitIdle(device);
@@ -139,6 +190,7 @@ VulkanBase::VulkanBase()
 VulkanBase::~VulkanBase()
 {
 	// Clean up Vulkan resources
+	destroyRetired(true);
 	swapChain.cleanup();
 	if (descriptorPool != VK_NULL_HANDLE)
 	{
@@ -164,13 +216,11 @@ VulkanBase::~VulkanBase()
 
 	vkDestroyPipelineCache(device, pipelineCache, nullptr);
 
+	upload.cleanup();
+
 	vkDestroyCommandPool(device, cmdPool, nullptr);
 
-	vkDestroySemaphore(device, semaphores.presentComplete, nullptr);
-	vkDestroySemaphore(device, semaphores.renderComplete, nullptr);
-	for (auto& fence : waitFences) {
-		vkDestroyFence(device, fence, nullptr);
-	}
+	destroySynchronizationPrimitives();
 
 
 	delete vulkanDevice;
@@ -181,8 +231,17 @@ VulkanBase::~VulkanBase()
 	xdg_toplevel_destroy(xdg_toplevel);
 	xdg_surface_destroy(xdg_surface);
 	wl_surface_destroy(surface);
+	lockPointer(false);
+	if (relativePointer)
+		zwp_relative_pointer_v1_destroy(relativePointer);
+	if (pointer)
+		wl_pointer_destroy(pointer);
 	if (seat)
 		wl_seat_destroy(seat);
+	if (pointerConstraints)
+		zwp_pointer_constraints_v1_destroy(pointerConstraints);
+	if (relativePointerManager)
+		zwp_relative_pointer_manager_v1_destroy(relativePointerManager);
 	xdg_wm_base_destroy(shell);
 	wl_compositor_destroy(compositor);
 	wl_registry_destroy(registry);
@@ -250,7 +309,9 @@ bool VulkanBase::initVulkan()
 	// and encapsulates functions related to a device
 	vulkanDevice = new vulkan_device(physicalDevice);
 
-	VkResult res = vulkanDevice->createLogicalDevice(enabledFeatures, enabledDeviceExtensions, deviceCreatepNextChain);
+	// Also request a transfer queue, a dedicated transfer queue family is used for uploads if the device has one
+	VkResult res = vulkanDevice->createLogicalDevice(enabledFeatures, enabledDeviceExtensions, deviceCreatepNextChain, true,
+		VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT);
 	if (res != VK_SUCCESS) {
         std::cerr << "Could not create Vulkan device";
         exit(-1);
@@ -259,6 +320,7 @@ bool VulkanBase::initVulkan()
 
 	// Get a graphics queue from the device
 	vkGetDeviceQueue(device, vulkanDevice->queueFamilyIndices.graphics, 0, &queue);
+	vkGetDeviceQueue(device, vulkanDevice->queueFamilyIndices.transfer, 0, &transferQueue);
 
 	// Find a suitable depth format
 	VkBool32 validDepthFormat = getSupportedDepthFormat(physicalDevice, &depthFormat);
@@ -266,25 +328,6 @@ bool VulkanBase::initVulkan()
 
 	swapChain.connect(instance, physicalDevice, device);
 
-	// Create synchronization objects
-	VkSemaphoreCreateInfo semaphoreCreateInfo = semCreateInfo();
-	// Create a semaphore used to synchronize image presentation
-	// Ensures that the image is displayed before we start submitting new commands to the queue
-	VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphores.presentComplete));
-	// Create a semaphore used to synchronize command submission
-	// Ensures that the image is not presented until all commands have been submitted and executed
-	VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphores.renderComplete));
-
-	// Set up submit info structure
-	// Semaphores will stay the same during application lifetime
-	// Command buffer submission info is set by each example
-	submitInfo = sbmInfo();
-	submitInfo.pWaitDstStageMask = &submitPipelineStages;
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = &semaphores.presentComplete;
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = &semaphores.renderComplete;
-
 	return true;
 }
 
@@ -306,6 +349,151 @@ static const struct xdg_wm_base_listener xdg_wm_base_listener = {
 	xdg_wm_base_ping,
 };
 
+static void pointer_handle_enter(void *data, struct wl_pointer *pointer,
+		uint32_t serial, struct wl_surface *surface, wl_fixed_t sx, wl_fixed_t sy)
+{
+	VulkanBase *base = (VulkanBase *) data;
+
+	base->mousePos = glm::vec2(wl_fixed_to_double(sx), wl_fixed_to_double(sy));
+}
+
+static void pointer_handle_leave(void *data, struct wl_pointer *pointer,
+		uint32_t serial, struct wl_surface *surface)
+{
+	VulkanBase *base = (VulkanBase *) data;
+
+	base->mouseButtons.left = false;
+	base->mouseButtons.right = false;
+	base->mouseButtons.middle = false;
+}
+
+static void pointer_handle_motion(void *data, struct wl_pointer *pointer,
+		uint32_t time, wl_fixed_t sx, wl_fixed_t sy)
+{
+	VulkanBase *base = (VulkanBase *) data;
+
+	// Absolute positions are quantized and clamped to the window, the relative
+	// pointer below reports the raw device motion when it is available
+	if (!base->relativePointer)
+	{
+		glm::vec2 pos(wl_fixed_to_double(sx), wl_fixed_to_double(sy));
+		base->mouseDelta += pos - base->mousePos;
+	}
+	base->mousePos = glm::vec2(wl_fixed_to_double(sx), wl_fixed_to_double(sy));
+}
+
+static void pointer_handle_button(void *data, struct wl_pointer *pointer,
+		uint32_t serial, uint32_t time, uint32_t button, uint32_t state)
+{
+	VulkanBase *base = (VulkanBase *) data;
+	bool pressed = state == WL_POINTER_BUTTON_STATE_PRESSED;
+
+	switch (button)
+	{
+	case BTN_LEFT:
+		base->mouseButtons.left = pressed;
+		// Dragging with the left button locks the cursor in place so the
+		// camera can keep turning past the window edge
+		base->lockPointer(pressed);
+		break;
+	case BTN_MIDDLE:
+		base->mouseButtons.middle = pressed;
+		break;
+	case BTN_RIGHT:
+		base->mouseButtons.right = pressed;
+		break;
+	default:
+		break;
+	}
+}
+
+static void pointer_handle_axis(void *data, struct wl_pointer *pointer,
+		uint32_t time, uint32_t axis, wl_fixed_t value)
+{
+}
+
+static const struct wl_pointer_listener pointer_listener = {
+	pointer_handle_enter,
+	pointer_handle_leave,
+	pointer_handle_motion,
+	pointer_handle_button,
+	pointer_handle_axis,
+};
+
+static void relative_pointer_handle_motion(void *data,
+		struct zwp_relative_pointer_v1 *relative_pointer,
+		uint32_t utime_hi, uint32_t utime_lo, wl_fixed_t dx, wl_fixed_t dy,
+		wl_fixed_t dx_unaccel, wl_fixed_t dy_unaccel)
+{
+	VulkanBase *base = (VulkanBase *) data;
+	glm::vec2 delta(wl_fixed_to_double(dx_unaccel), wl_fixed_to_double(dy_unaccel));
+
+	base->mouseDelta += delta;
+	// wl_pointer stops sending motion while locked
+	if (base->lockedPointer)
+		base->mousePos += delta;
+}
+
+static const struct zwp_relative_pointer_v1_listener relative_pointer_listener = {
+	relative_pointer_handle_motion,
+};
+
+static void seat_handle_capabilities(void *data, wl_seat *seat, uint32_t caps)
+{
+	VulkanBase *base = (VulkanBase *) data;
+	base->seatCapabilities(caps);
+}
+
+static void seat_handle_name(void *data, wl_seat *seat, const char *name)
+{
+}
+
+static const struct wl_seat_listener seat_listener = {
+	seat_handle_capabilities,
+	seat_handle_name,
+};
+
+void VulkanBase::seatCapabilities(uint32_t caps)
+{
+	if ((caps & WL_SEAT_CAPABILITY_POINTER) && !pointer)
+	{
+		pointer = wl_seat_get_pointer(seat);
+		wl_pointer_add_listener(pointer, &pointer_listener, this);
+		if (relativePointerManager)
+		{
+			relativePointer = zwp_relative_pointer_manager_v1_get_relative_pointer(
+					relativePointerManager, pointer);
+			zwp_relative_pointer_v1_add_listener(relativePointer,
+					&relative_pointer_listener, this);
+		}
+	}
+	else if (!(caps & WL_SEAT_CAPABILITY_POINTER) && pointer)
+	{
+		lockPointer(false);
+		if (relativePointer)
+		{
+			zwp_relative_pointer_v1_destroy(relativePointer);
+			relativePointer = nullptr;
+		}
+		wl_pointer_destroy(pointer);
+		pointer = nullptr;
+	}
+}
+
+void VulkanBase::lockPointer(bool lock)
+{
+	if (lock && !lockedPointer && pointerConstraints && pointer && surface)
+	{
+		lockedPointer = zwp_pointer_constraints_v1_lock_pointer(pointerConstraints,
+				surface, pointer, nullptr, ZWP_POINTER_CONSTRAINTS_V1_LIFETIME_PERSISTENT);
+	}
+	else if (!lock && lockedPointer)
+	{
+		zwp_locked_pointer_v1_destroy(lockedPointer);
+		lockedPointer = nullptr;
+	}
+}
+
 void VulkanBase::registryGlobal(wl_registry *registry, uint32_t name,
                                 const char *interface, uint32_t version)
 {
@@ -324,7 +512,17 @@ void VulkanBase::registryGlobal(wl_registry *registry, uint32_t name,
 	{
 		seat = (wl_seat *) wl_registry_bind(registry, name, &wl_seat_interface,
 				1);
-
+		wl_seat_add_listener(seat, &seat_listener, this);
+	}
+	else if (strcmp(interface, "zwp_relative_pointer_manager_v1") == 0)
+	{
+		relativePointerManager = (zwp_relative_pointer_manager_v1 *) wl_registry_bind(registry,
+				name, &zwp_relative_pointer_manager_v1_interface, 1);
+	}
+	else if (strcmp(interface, "zwp_pointer_constraints_v1") == 0)
+	{
+		pointerConstraints = (zwp_pointer_constraints_v1 *) wl_registry_bind(registry,
+				name, &zwp_pointer_constraints_v1_interface, 1);
 	}
 }
 
@@ -377,6 +575,9 @@ xdg_surface_handle_configure(void *data, struct xdg_surface *surface,
 
 	xdg_surface_ack_configure(surface, serial);
 	base->configured = true;
+	// The next frame is presented at the acked size
+	if (base->destWidth && (base->destWidth != base->width || base->destHeight != base->height))
+		base->resized = true;
 }
 
 static const struct xdg_surface_listener xdg_surface_listener = {
@@ -390,6 +591,13 @@ xdg_toplevel_handle_configure(void *data, struct xdg_toplevel *toplevel,
 			      struct wl_array *states)
 {
 	VulkanBase *base = (VulkanBase *) data;
+
+	// Zero leaves the size up to us, keep the current one
+	if (width > 0 && height > 0)
+	{
+		base->destWidth = width;
+		base->destHeight = height;
+	}
 }
 
 static void
@@ -421,7 +629,9 @@ struct xdg_surface *VulkanBase::setupWindow()
 	return xdg_surface;
 }
 
-void VulkanBase::buildCommandBuffers() {}
+void VulkanBase::buildCommandBuffer(VkCommandBuffer cmdBuffer, uint32_t imageIndex) {}
+
+void VulkanBase::windowResized() {}
 
 static VkFenceCreateInfo fCreateInfo(VkFenceCreateFlags flags = 0)
 {
@@ -433,12 +643,132 @@ static VkFenceCreateInfo fCreateInfo(VkFenceCreateFlags flags = 0)
 
 void VulkanBase::createSynchronizationPrimitives()
 {
-	// Wait fences to sync command buffer access
+	VkSemaphoreCreateInfo semaphoreCreateInfo = semCreateInfo();
+	// Created signaled so the first wait on each frame returns immediately
 	VkFenceCreateInfo fenceCreateInfo = fCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
-	waitFences.resize(drawCmdBuffers.size());
-	for (auto& fence : waitFences) {
-		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &fence));
+	for (auto& frame : frames)
+	{
+		// Ensures that the image is displayed before we start rendering to it
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &frame.presentComplete));
+		VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &frame.fence));
+	}
+	createRenderCompleteSemaphores();
+}
+
+void VulkanBase::createRenderCompleteSemaphores()
+{
+	VkSemaphoreCreateInfo semaphoreCreateInfo = semCreateInfo();
+	renderComplete.resize(swapChain.imageCount);
+	for (auto& semaphore : renderComplete)
+	{
+		// Ensures that the image is not presented until all commands have been executed
+		VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &semaphore));
+	}
+}
+
+void VulkanBase::destroySynchronizationPrimitives()
+{
+	for (auto& frame : frames)
+	{
+		vkDestroySemaphore(device, frame.presentComplete, nullptr);
+		vkDestroyFence(device, frame.fence, nullptr);
+	}
+	for (auto& semaphore : renderComplete)
+	{
+		vkDestroySemaphore(device, semaphore, nullptr);
+	}
+	renderComplete.clear();
+}
+
+/**
+* Wait until the current frame's resources are free again and acquire the next swap chain image into currentBuffer
+*
+* @note Only the frame submitted framesInFlight frames ago is waited on, younger frames keep executing
+* @note A pending resize is applied before acquiring, VK_ERROR_OUT_OF_DATE_KHR recreates the swap chain and the frame should be skipped
+*
+* @return VkResult of the image acquisition
+*/
+VkResult VulkanBase::prepareFrame()
+{
+	FrameData &frame = frames[currentFrame];
+	auto start = std::chrono::steady_clock::now();
+
+	VK_CHECK_RESULT(vkWaitForFences(device, 1, &frame.fence, VK_TRUE, UINT64_MAX));
+	// Frames complete in submission order on the queue, so every frame up to this one is done
+	completedSerial = std::max(completedSerial, frame.serial);
+	destroyRetired(false);
+	if (frameStats && frame.submitted)
+	{
+		statsWindow.retireMs += msBetween(frame.submitTime, std::chrono::steady_clock::now());
+		statsWindow.retired++;
+		frame.submitted = false;
+	}
+	if (resized)
+	{
+		windowResize();
+	}
+	VkResult result = swapChain.acquireNextImage(frame.presentComplete, &currentBuffer);
+	if (frameStats)
+	{
+		statsWindow.blockedMs += msBetween(start, std::chrono::steady_clock::now());
+	}
+	if (result == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		// Nothing was acquired, skip the frame and acquire from the new swap chain next time
+		windowResize();
+		return result;
+	}
+	if ((result != VK_SUCCESS) && (result != VK_SUBOPTIMAL_KHR))
+	{
+		return result;
 	}
+	// Only reset the fence once we know it will be signaled by a submission
+	VK_CHECK_RESULT(vkResetFences(device, 1, &frame.fence));
+	return result;
+}
+
+/**
+* Submit the current frame's command buffer, queue the acquired image for presentation and advance to the next frame
+*
+* @note VK_ERROR_OUT_OF_DATE_KHR and VK_SUBOPTIMAL_KHR schedule a swap chain recreation for the next frame
+*
+* @return VkResult of the queue presentation
+*/
+VkResult VulkanBase::submitFrame()
+{
+	FrameData &frame = frames[currentFrame];
+
+	VkSubmitInfo submitInfo = sbmInfo();
+	submitInfo.pWaitDstStageMask = &submitPipelineStages;
+	submitInfo.waitSemaphoreCount = 1;
+	submitInfo.pWaitSemaphores = &frame.presentComplete;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &renderComplete[currentBuffer];
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &frame.cmdBuffer;
+	frame.submitTime = std::chrono::steady_clock::now();
+	frame.submitted = true;
+	frame.serial = ++submitSerial;
+	VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, frame.fence));
+
+	VkResult result = swapChain.queuePresent(queue, currentBuffer, renderComplete[currentBuffer]);
+	if ((result == VK_ERROR_OUT_OF_DATE_KHR) || (result == VK_SUBOPTIMAL_KHR))
+	{
+		resized = true;
+	}
+	currentFrame = (currentFrame + 1) % frames.size();
+
+	if (frameStats)
+	{
+		statsWindow.frames++;
+		statsWindow.seconds = msBetween(statsWindowStart, std::chrono::steady_clock::now()) / 1000.0;
+		if (statsWindow.seconds >= 1.0)
+		{
+			logFrameStats("", statsWindow);
+			rollFrameStats();
+		}
+	}
+	return result;
 }
 
 void VulkanBase::createCommandPool()
@@ -594,7 +924,65 @@ void VulkanBase::initSwapchain()
 	swapChain.initSurface(display, surface);
 }
 
+/**
+* Recreate the swap chain at the configured size and rebuild the depth buffer and framebuffers
+*
+* @note The replaced resources are queued in retiredResources rather than waiting for the device to idle, so frames already in flight keep running
+* @note They are kept for framesInFlight frames past the last submission, the frame fences do not cover the presentation still queued on the old swap chain
+*/
+void VulkanBase::windowResize()
+{
+	resized = false;
+	if (destWidth && destHeight)
+	{
+		width = destWidth;
+		height = destHeight;
+	}
+
+	RetiredResources old;
+	old.serial = submitSerial + frames.size();
+	old.frameBuffers.swap(frameBuffers);
+	old.depthImage = depthStencil.image;
+	old.depthMem = depthStencil.mem;
+	old.depthView = depthStencil.view;
+	old.renderComplete.swap(renderComplete);
+	// Passes the current swap chain as oldSwapchain so presentation of already queued images can continue
+	swapChain.create(&width, &height, presentMode, swapChainImages, &old.swapChain);
+	retiredResources.push_back(std::move(old));
+
+	createRenderCompleteSemaphores();
+	setupDepthStencil();
+	setupFrameBuffer();
+	windowResized();
+}
+
+/**
+* Destroy retired resources no frame in flight can reference anymore
+*
+* @param all Destroy everything regardless of frame completion, only valid once the device is idle
+*/
+void VulkanBase::destroyRetired(bool all)
+{
+	auto it = retiredResources.begin();
+	for (; it != retiredResources.end() && (all || it->serial <= completedSerial); ++it)
+	{
+		for (auto& frameBuffer : it->frameBuffers)
+		{
+			vkDestroyFramebuffer(device, frameBuffer, nullptr);
+		}
+		vkDestroyImageView(device, it->depthView, nullptr);
+		vkDestroyImage(device, it->depthImage, nullptr);
+		vkFreeMemory(device, it->depthMem, nullptr);
+		for (auto& semaphore : it->renderComplete)
+		{
+			vkDestroySemaphore(device, semaphore, nullptr);
+		}
+		swapChain.destroyRetired(it->swapChain);
+	}
+	retiredResources.erase(retiredResources.begin(), it);
+}
+
 void VulkanBase::setupSwapChain()
 {
-    swapChain.create(&width, &height);
+    swapChain.create(&width, &height, presentMode, swapChainImages);
 }
@@ -2,6 +2,8 @@
 
 #include <wayland-client.h>
 #include "xdg-shell-client-protocol.h"
+#include "relative-pointer-unstable-v1-client-protocol.h"
+#include "pointer-constraints-unstable-v1-client-protocol.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -31,8 +33,12 @@
 
 #include "vulkan_swap_chain.h"
 #include "vulkan_device.h"
+#include "vulkan_upload.h"
 
-
+// Upper bound for VulkanBase::framesInFlight
+#define MAX_FRAMES_IN_FLIGHT 3
+// Size of the staging ring used for uploads to device local memory
+#define UPLOAD_STAGING_SIZE (1 << 20)
 
 class VulkanBase
 {
@@ -44,6 +50,10 @@ private:
 	void setupSwapChain();
 	void createCommandBuffers();
 	void destroyCommandBuffers();
+	void destroySynchronizationPrimitives();
+	void createRenderCompleteSemaphores();
+	void windowResize();
+	void destroyRetired(bool all);
 protected:
 	std::string getShadersPath() const;
 
@@ -58,27 +68,86 @@ protected:
 	void* deviceCreatepNextChain = nullptr;
 	VkDevice device;
 	VkQueue queue;
+	// Queue of the transfer queue family, the same as queue if there is no separate one
+	VkQueue transferQueue;
 	VkFormat depthFormat;
 	VkCommandPool cmdPool;
 	VkPipelineStageFlags submitPipelineStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-	VkSubmitInfo submitInfo;
-	std::vector<VkCommandBuffer> drawCmdBuffers;
 	VkRenderPass renderPass = VK_NULL_HANDLE;
 	std::vector<VkFramebuffer>frameBuffers;
+	// Swap chain image acquired for the current frame
 	uint32_t currentBuffer = 0;
 	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
 	std::vector<VkShaderModule> shaderModules;
 	VkPipelineCache pipelineCache;
 	vulkan_swap_chain swapChain;
-
-	struct {
+	// Copies buffer data to device local memory on the transfer queue
+	vulkan_upload upload;
+
+	// Resources owned by one frame in flight, they are only touched again
+	// once the fence of that frame has signaled so the CPU can record the
+	// next frame while the GPU is still rendering the previous ones
+	struct FrameData {
+		VkCommandBuffer cmdBuffer;
 		// Swap chain image presentation
 		VkSemaphore presentComplete;
-		// Command buffer submission and execution
-		VkSemaphore renderComplete;
-	} semaphores;
-	std::vector<VkFence> waitFences;
+		// Signaled when the GPU is done with the frame
+		VkFence fence;
+		bool submitted = false;
+		std::chrono::steady_clock::time_point submitTime;
+		// Serial of the last submission that used this frame
+		uint64_t serial = 0;
+	};
+	std::vector<FrameData> frames;
+	uint32_t currentFrame = 0;
+	// Command buffer submission and execution, one per swap chain image since
+	// the frame's fence does not cover the presentation waiting on it
+	std::vector<VkSemaphore> renderComplete;
+	// Serial of the last submitted frame and of the newest one known to be complete
+	uint64_t submitSerial = 0;
+	uint64_t completedSerial = 0;
+
+	// Resources replaced by a resize, destroyed once framesInFlight more frames
+	// have completed instead of waiting for the device to idle
+	struct RetiredResources {
+		uint64_t serial;
+		std::vector<VkFramebuffer> frameBuffers;
+		VkImage depthImage;
+		VkDeviceMemory depthMem;
+		VkImageView depthView;
+		RetiredSwapChain swapChain;
+		std::vector<VkSemaphore> renderComplete;
+	};
+	std::vector<RetiredResources> retiredResources;
+
+	VkResult prepareFrame();
+	VkResult submitFrame();
+
+	struct FrameStats {
+		uint32_t frames = 0;
+		// Time spent in prepareFrame waiting for the frame's fence and an image
+		double blockedMs = 0.0;
+		// Time from a frame's submission until its fence was seen signaled,
+		// an upper bound when the fence had signaled before the wait
+		double retireMs = 0.0;
+		uint32_t retired = 0;
+		double seconds = 0.0;
+	};
+	FrameStats statsWindow;
+	FrameStats statsTotal;
+	std::chrono::steady_clock::time_point statsWindowStart;
+	void logFrameStats(const char *label, const FrameStats &stats);
+	void rollFrameStats();
 public:
+	// Requested presentation mode and image count (0 lets the swap chain
+	// pick), see vulkan_swap_chain::create for the fallbacks
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+	uint32_t swapChainImages = 0;
+	// Log throughput and latency of the selected present mode every second
+	bool frameStats = false;
+	// Frames the CPU may run ahead of the GPU, clamped to
+	// [1, MAX_FRAMES_IN_FLIGHT] when the frame ring is created
+	uint32_t framesInFlight = 2;
 	bool prepared = false;
 	uint32_t width = 1280;
 	uint32_t height = 720;
@@ -88,6 +157,14 @@ public:
     glm::mat4 perspective;
     glm::mat4 view;
 	glm::vec2 mousePos;
+	// Unaccelerated motion since the consumer last cleared it, keeps
+	// accumulating while the pointer is locked
+	glm::vec2 mouseDelta = glm::vec2(0.0f);
+	struct {
+		bool left = false;
+		bool right = false;
+		bool middle = false;
+	} mouseButtons;
 
 	std::string title = "Vulkan Example";
 	std::string name = "vulkanExample";
@@ -102,11 +179,21 @@ public:
 	wl_compositor *compositor = nullptr;
 	struct xdg_wm_base *shell = nullptr;
 	wl_seat *seat = nullptr;
+	wl_pointer *pointer = nullptr;
+	zwp_relative_pointer_manager_v1 *relativePointerManager = nullptr;
+	zwp_relative_pointer_v1 *relativePointer = nullptr;
+	zwp_pointer_constraints_v1 *pointerConstraints = nullptr;
+	zwp_locked_pointer_v1 *lockedPointer = nullptr;
 	wl_surface *surface = nullptr;
 	struct xdg_surface *xdg_surface;
 	struct xdg_toplevel *xdg_toplevel;
 	bool quit = false;
 	bool configured = false;
+	// Size from the last toplevel configure, 0 until the compositor picks one
+	uint32_t destWidth = 0;
+	uint32_t destHeight = 0;
+	// Recreate the swap chain before the next frame
+	bool resized = false;
 
 
 	VulkanBase();
@@ -121,13 +208,17 @@ public:
 			const char *interface, uint32_t version);
 	static void registryGlobalRemoveCb(void *data, struct wl_registry *registry,
 			uint32_t name);
+	void seatCapabilities(uint32_t caps);
+	void lockPointer(bool lock);
 
 	virtual VkResult createInstance();
 	virtual void render() = 0;
-	virtual void buildCommandBuffers();
+	virtual void buildCommandBuffer(VkCommandBuffer cmdBuffer, uint32_t imageIndex);
 	virtual void setupDepthStencil();
 	virtual void setupFrameBuffer();
 	virtual void setupRenderPass();
+	// Called after a resize rebuilt the swap chain and framebuffers
+	virtual void windowResized();
     virtual void prepare();
     void renderLoop();
 };
\ No newline at end of file
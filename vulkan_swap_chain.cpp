@@ -3,6 +3,7 @@
 #include <wayland-client.h>
 #include <vulkan/vulkan_wayland.h>
 #include <iostream>
+#include <algorithm>
 
 #include "vulkan_swap_chain.h"
 
@@ -140,6 +141,30 @@ void vulkan_swap_chain::initSurface(wl_display *display, wl_surface *window)
 
 }
 
+/**
+* Get the name used for a presentation mode on the command line and in logs
+*
+* @param mode Presentation mode
+*
+* @return Name of the mode, "unknown" for modes not selectable by create()
+*/
+const char *vulkan_swap_chain::presentModeName(VkPresentModeKHR mode)
+{
+	switch (mode)
+	{
+	case VK_PRESENT_MODE_IMMEDIATE_KHR:
+		return "immediate";
+	case VK_PRESENT_MODE_MAILBOX_KHR:
+		return "mailbox";
+	case VK_PRESENT_MODE_FIFO_KHR:
+		return "fifo";
+	case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+		return "fifo-relaxed";
+	default:
+		return "unknown";
+	}
+}
+
 /**
 * Set instance, physical and logical device to use for the swapchain and get all required function pointers
 * 
@@ -170,9 +195,11 @@ void vulkan_swap_chain::connect(VkInstance instance, VkPhysicalDevice physicalDe
 * 
 * @param width Pointer to the width of the swapchain (may be adjusted to fit the requirements of the swapchain)
 * @param height Pointer to the height of the swapchain (may be adjusted to fit the requirements of the swapchain)
-* @param vsync (Optional) Can be used to force vsync-ed rendering (by using VK_PRESENT_MODE_FIFO_KHR as presentation mode)
+* @param requestedMode (Optional) Presentation mode to use, falls back to the closest supported mode and ultimately to VK_PRESENT_MODE_FIFO_KHR
+* @param requestedImageCount (Optional) Number of swapchain images, clamped to the surface limits (0 selects minImageCount + 1)
+* @param retired (Optional) Receives the replaced swap chain and its image views instead of destroying them right away, release with destroyRetired()
 */
-void vulkan_swap_chain::create(uint32_t *width, uint32_t *height)
+void vulkan_swap_chain::create(uint32_t *width, uint32_t *height, VkPresentModeKHR requestedMode, uint32_t requestedImageCount, RetiredSwapChain *retired)
 {
 	// Store the current swap chain handle so we can use it later on to ease up recreation
 	VkSwapchainKHR oldSwapchain = swapChain;
@@ -208,14 +235,43 @@ void vulkan_swap_chain::create(uint32_t *width, uint32_t *height)
 
 
 	// Select a present mode for the swapchain
+	// If the requested mode is not supported try the closest one: MAILBOX and IMMEDIATE both
+	// avoid waiting for the vertical blank, FIFO_RELAXED only differs from FIFO on late frames
+	std::vector<VkPresentModeKHR> candidates = { requestedMode };
+	if (requestedMode == VK_PRESENT_MODE_MAILBOX_KHR)
+	{
+		candidates.push_back(VK_PRESENT_MODE_IMMEDIATE_KHR);
+	}
+	else if (requestedMode == VK_PRESENT_MODE_IMMEDIATE_KHR)
+	{
+		candidates.push_back(VK_PRESENT_MODE_MAILBOX_KHR);
+	}
 
 	// The VK_PRESENT_MODE_FIFO_KHR mode must always be present as per spec
 	// This mode waits for the vertical blank ("v-sync")
 	VkPresentModeKHR swapchainPresentMode = VK_PRESENT_MODE_FIFO_KHR;
-
+	for (auto& candidate : candidates)
+	{
+		if (std::find(presentModes.begin(), presentModes.end(), candidate) != presentModes.end())
+		{
+			swapchainPresentMode = candidate;
+			break;
+		}
+	}
+	// Only report the fallback once, recreation keeps asking for the same mode
+	if (swapchainPresentMode != requestedMode && oldSwapchain == VK_NULL_HANDLE)
+	{
+		std::cerr << "Present mode " << presentModeName(requestedMode) << " not supported, using "
+			<< presentModeName(swapchainPresentMode) << "\n";
+	}
+	presentMode = swapchainPresentMode;
 
 	// Determine the number of images
-	uint32_t desiredNumberOfSwapchainImages = surfCaps.minImageCount + 1;
+	uint32_t desiredNumberOfSwapchainImages = requestedImageCount ? requestedImageCount : surfCaps.minImageCount + 1;
+	if (desiredNumberOfSwapchainImages < surfCaps.minImageCount)
+	{
+		desiredNumberOfSwapchainImages = surfCaps.minImageCount;
+	}
 	if ((surfCaps.maxImageCount > 0) && (desiredNumberOfSwapchainImages > surfCaps.maxImageCount))
 	{
 		desiredNumberOfSwapchainImages = surfCaps.maxImageCount;
@@ -282,7 +338,17 @@ void vulkan_swap_chain::create(uint32_t *width, uint32_t *height)
 
 	// If an existing swap chain is re-created, destroy the old swap chain
 	// This also cleans up all the presentable images
-	if (oldSwapchain != VK_NULL_HANDLE) 
+	if (oldSwapchain != VK_NULL_HANDLE && retired)
+	{
+		// Frames in flight may still render to the old images, let the caller destroy them once they are done
+		retired->swapChain = oldSwapchain;
+		retired->views.resize(imageCount);
+		for (uint32_t i = 0; i < imageCount; i++)
+		{
+			retired->views[i] = buffers[i].view;
+		}
+	}
+	else if (oldSwapchain != VK_NULL_HANDLE)
 	{ 
 		for (uint32_t i = 0; i < imageCount; i++)
 		{
@@ -370,6 +436,25 @@ VkResult vulkan_swap_chain::queuePresent(VkQueue queue, uint32_t imageIndex, VkS
 }
 
 
+/**
+* Destroy a swap chain handed out by create() once nothing references it anymore
+*
+* @param retired Swap chain and image views to destroy, cleared afterwards
+*/
+void vulkan_swap_chain::destroyRetired(RetiredSwapChain &retired)
+{
+	for (auto& view : retired.views)
+	{
+		vkDestroyImageView(device, view, nullptr);
+	}
+	if (retired.swapChain != VK_NULL_HANDLE)
+	{
+		fpDestroySwapchainKHR(device, retired.swapChain, nullptr);
+	}
+	retired.views.clear();
+	retired.swapChain = VK_NULL_HANDLE;
+}
+
 /**
 * Destroy and free Vulkan resources used for the swapchain
 */
@@ -23,6 +23,13 @@ typedef struct _SwapChainBuffers {
 	VkImageView view;
 } SwapChainBuffer;
 
+// Swap chain replaced by create() together with its image views, kept
+// alive until the frames that rendered to it have completed
+typedef struct _RetiredSwapChain {
+	VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+	std::vector<VkImageView> views;
+} RetiredSwapChain;
+
 class vulkan_swap_chain
 {
 private: 
@@ -48,11 +55,16 @@ public:
 	std::vector<VkImage> images;
 	std::vector<SwapChainBuffer> buffers;
 	uint32_t queueNodeIndex = UINT32_MAX;
+	// Presentation mode selected by the last create()
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+
+	static const char *presentModeName(VkPresentModeKHR mode);
 
 	void initSurface(wl_display* display, wl_surface* window);
 
 	void connect(VkInstance instance, VkPhysicalDevice physicalDevice, VkDevice device);
-	void create(uint32_t *width, uint32_t *height);
+	void create(uint32_t *width, uint32_t *height, VkPresentModeKHR requestedMode = VK_PRESENT_MODE_FIFO_KHR, uint32_t requestedImageCount = 0, RetiredSwapChain *retired = nullptr);
+	void destroyRetired(RetiredSwapChain &retired);
 	VkResult acquireNextImage(VkSemaphore presentCompleteSemaphore, uint32_t* imageIndex);
 	VkResult queuePresent(VkQueue queue, uint32_t imageIndex, VkSemaphore waitSemaphore = VK_NULL_HANDLE);
 	void cleanup();
@@ -0,0 +1,377 @@
+#include <string.h>
+#include <algorithm>
+
+#include "vulkan_upload.h"
+
+#define VK_CHECK_RESULT(f)																				\
+{																										\
+	VkResult res = (f);																					\
+	if (res != VK_SUCCESS)																				\
+	{																									\
+		std::cout << "Fatal : VkResult is " << res << "\" in " << __FILE__ << " at line " << __LINE__ << "\n"; \
+		assert(res == VK_SUCCESS);																		\
+	}																									\
+}
+
+// Offset alignment of allocations in the staging ring
+#define STAGING_ALIGNMENT 16
+
+/**
+* Create the staging ring and the command pools used for uploads
+*
+* @param device Device to upload to, queueFamilyIndices.transfer and queueFamilyIndices.graphics select the queue families
+* @param transferQueue Queue of the transfer queue family
+* @param graphicsQueue Queue of the graphics queue family the uploaded buffers are used on
+* @param stagingSize Size of the staging ring, larger uploads are split into several copies
+*/
+void vulkan_upload::create(vulkan_device *device, VkQueue transferQueue, VkQueue graphicsQueue, VkDeviceSize stagingSize)
+{
+	this->device = device;
+	this->transferQueue = transferQueue;
+	this->graphicsQueue = graphicsQueue;
+	this->stagingSize = stagingSize;
+	stagingHead = 0;
+
+	ownershipTransfer = device->queueFamilyIndices.transfer != device->queueFamilyIndices.graphics;
+	unifiedMemory = (device->properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU)
+		|| (device->properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU);
+
+	transferPool = device->createCommandPool(device->queueFamilyIndices.transfer, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+	if (ownershipTransfer)
+	{
+		// The acquire half of the ownership transfer has to be recorded for the graphics queue family
+		graphicsPool = device->createCommandPool(device->queueFamilyIndices.graphics, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+	}
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = stagingSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	VK_CHECK_RESULT(vkCreateBuffer(device->logicalDevice, &bufferInfo, nullptr, &stagingBuffer));
+
+	VkMemoryRequirements memReqs;
+	vkGetBufferMemoryRequirements(device->logicalDevice, stagingBuffer, &memReqs);
+	VkMemoryAllocateInfo memAlloc = {};
+	memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	memAlloc.allocationSize = memReqs.size;
+	memAlloc.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	VK_CHECK_RESULT(vkAllocateMemory(device->logicalDevice, &memAlloc, nullptr, &stagingMemory));
+	VK_CHECK_RESULT(vkBindBufferMemory(device->logicalDevice, stagingBuffer, stagingMemory, 0));
+	// Stays mapped for the lifetime of the ring
+	VK_CHECK_RESULT(vkMapMemory(device->logicalDevice, stagingMemory, 0, VK_WHOLE_SIZE, 0, (void **)&stagingMapped));
+}
+
+/**
+* Start recording the copies of a new batch if none is being recorded
+*/
+void vulkan_upload::begin()
+{
+	if (transferCmd != VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	VkCommandBufferAllocateInfo cmdBufAllocateInfo = {};
+	cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdBufAllocateInfo.commandPool = transferPool;
+	cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdBufAllocateInfo.commandBufferCount = 1;
+	VK_CHECK_RESULT(vkAllocateCommandBuffers(device->logicalDevice, &cmdBufAllocateInfo, &transferCmd));
+
+	VkCommandBufferBeginInfo cmdBufInfo = {};
+	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	VK_CHECK_RESULT(vkBeginCommandBuffer(transferCmd, &cmdBufInfo));
+}
+
+/**
+* Free the resources of completed batches
+*
+* @param wait Wait for all submitted batches to complete instead of only freeing the ones already done
+*/
+void vulkan_upload::collect(bool wait)
+{
+	auto it = batches.begin();
+	while (it != batches.end())
+	{
+		if (wait)
+		{
+			VK_CHECK_RESULT(vkWaitForFences(device->logicalDevice, 1, &it->fence, VK_TRUE, UINT64_MAX));
+		}
+		else if (vkGetFenceStatus(device->logicalDevice, it->fence) != VK_SUCCESS)
+		{
+			++it;
+			continue;
+		}
+		vkFreeCommandBuffers(device->logicalDevice, transferPool, 1, &it->transferCmd);
+		if (it->graphicsCmd != VK_NULL_HANDLE)
+		{
+			vkFreeCommandBuffers(device->logicalDevice, graphicsPool, 1, &it->graphicsCmd);
+		}
+		if (it->semaphore != VK_NULL_HANDLE)
+		{
+			vkDestroySemaphore(device->logicalDevice, it->semaphore, nullptr);
+		}
+		vkDestroyFence(device->logicalDevice, it->fence, nullptr);
+		it = batches.erase(it);
+	}
+}
+
+/**
+* Create a device local buffer and queue the upload of its contents
+*
+* @param usage Usage flags of the buffer, VK_BUFFER_USAGE_TRANSFER_DST_BIT is added when the data is staged
+* @param data Contents of the buffer
+* @param size Size of the buffer in bytes
+* @param buffer Pointer to the buffer handle to create
+* @param memory Pointer to the memory handle to allocate for the buffer
+*
+* @note The copies are only submitted by flush(), the buffer may be used by graphics submissions made after it
+*/
+void vulkan_upload::createBuffer(VkBufferUsageFlags usage, const void *data, VkDeviceSize size, VkBuffer *buffer, VkDeviceMemory *memory)
+{
+	VkDevice logicalDevice = device->logicalDevice;
+
+	VkBufferCreateInfo bufferInfo = {};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	VkMemoryAllocateInfo memAlloc = {};
+	memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	VkMemoryRequirements memReqs;
+
+	if (unifiedMemory)
+	{
+		// With unified memory a host visible device local type is as fast as any other, so skip the staging copy
+		VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, buffer));
+		vkGetBufferMemoryRequirements(logicalDevice, *buffer, &memReqs);
+		VkBool32 memTypeFound = VK_FALSE;
+		memAlloc.allocationSize = memReqs.size;
+		memAlloc.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &memTypeFound);
+		if (memTypeFound)
+		{
+			void *mapped;
+			VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, memory));
+			VK_CHECK_RESULT(vkMapMemory(logicalDevice, *memory, 0, size, 0, &mapped));
+			memcpy(mapped, data, size);
+			vkUnmapMemory(logicalDevice, *memory);
+			VK_CHECK_RESULT(vkBindBufferMemory(logicalDevice, *buffer, *memory, 0));
+			return;
+		}
+		// No such memory type for this usage after all, stage it like on a discrete GPU
+		vkDestroyBuffer(logicalDevice, *buffer, nullptr);
+	}
+
+	bufferInfo.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	VK_CHECK_RESULT(vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, buffer));
+	vkGetBufferMemoryRequirements(logicalDevice, *buffer, &memReqs);
+	memAlloc.allocationSize = memReqs.size;
+	memAlloc.memoryTypeIndex = device->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	VK_CHECK_RESULT(vkAllocateMemory(logicalDevice, &memAlloc, nullptr, memory));
+	VK_CHECK_RESULT(vkBindBufferMemory(logicalDevice, *buffer, *memory, 0));
+
+	VkDeviceSize offset = 0;
+	while (offset < size)
+	{
+		if (stagingHead == stagingSize)
+		{
+			// Wrap around, the start of the ring may only be reused once every copy reading it has executed
+			flush();
+			collect(true);
+			stagingHead = 0;
+		}
+		VkDeviceSize chunk = std::min(size - offset, stagingSize - stagingHead);
+		memcpy(stagingMapped + stagingHead, (const uint8_t *)data + offset, chunk);
+
+		begin();
+		VkBufferCopy copyRegion = {};
+		copyRegion.srcOffset = stagingHead;
+		copyRegion.dstOffset = offset;
+		copyRegion.size = chunk;
+		vkCmdCopyBuffer(transferCmd, stagingBuffer, *buffer, 1, &copyRegion);
+
+		stagingHead = std::min(stagingSize, (stagingHead + chunk + STAGING_ALIGNMENT - 1) & ~(VkDeviceSize)(STAGING_ALIGNMENT - 1));
+		offset += chunk;
+	}
+
+	// Where the graphics queue will first read the buffer
+	PendingBuffer pendingBuffer = {};
+	pendingBuffer.buffer = *buffer;
+	if (usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT)
+	{
+		pendingBuffer.dstAccessMask |= VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+		pendingBuffer.dstStageMask |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+	}
+	if (usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT)
+	{
+		pendingBuffer.dstAccessMask |= VK_ACCESS_INDEX_READ_BIT;
+		pendingBuffer.dstStageMask |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+	}
+	if (usage & (VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT))
+	{
+		pendingBuffer.dstAccessMask |= VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+		pendingBuffer.dstStageMask |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	}
+	if (pendingBuffer.dstStageMask == 0)
+	{
+		pendingBuffer.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+		pendingBuffer.dstStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	}
+	pending.push_back(pendingBuffer);
+}
+
+/**
+* Submit the copies recorded since the last flush
+*
+* With a separate transfer queue family the copies end with a release barrier and signal a semaphore, a second
+* submission on the graphics queue waits for it and acquires the buffers. Otherwise a single submission with a
+* plain barrier is enough. Neither blocks the CPU: graphics work submitted afterwards is ordered after the
+* acquire (or the barrier) by the graphics queue itself.
+*/
+void vulkan_upload::flush()
+{
+	collect(false);
+	if (transferCmd == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	Batch batch = {};
+	batch.transferCmd = transferCmd;
+	transferCmd = VK_NULL_HANDLE;
+
+	VkFenceCreateInfo fenceCreateInfo = {};
+	fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+	VK_CHECK_RESULT(vkCreateFence(device->logicalDevice, &fenceCreateInfo, nullptr, &batch.fence));
+
+	std::vector<VkBufferMemoryBarrier> barriers(pending.size());
+	VkPipelineStageFlags dstStageMask = 0;
+	for (size_t i = 0; i < pending.size(); i++)
+	{
+		barriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barriers[i].buffer = pending[i].buffer;
+		barriers[i].offset = 0;
+		barriers[i].size = VK_WHOLE_SIZE;
+		barriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barriers[i].dstAccessMask = pending[i].dstAccessMask;
+		barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		dstStageMask |= pending[i].dstStageMask;
+	}
+	pending.clear();
+	if (dstStageMask == 0)
+	{
+		// A wrap flushed part of a buffer before it was complete, there is nothing to hand over yet
+		dstStageMask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	}
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+
+	if (!ownershipTransfer)
+	{
+		// Same queue family (and queue) as graphics, make the copies visible to the stages reading the buffers
+		if (!barriers.empty())
+		{
+			vkCmdPipelineBarrier(batch.transferCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStageMask, 0,
+				0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+		}
+		VK_CHECK_RESULT(vkEndCommandBuffer(batch.transferCmd));
+		submitInfo.pCommandBuffers = &batch.transferCmd;
+		VK_CHECK_RESULT(vkQueueSubmit(transferQueue, 1, &submitInfo, batch.fence));
+		batches.push_back(batch);
+		return;
+	}
+
+	for (auto& barrier : barriers)
+	{
+		barrier.srcQueueFamilyIndex = device->queueFamilyIndices.transfer;
+		barrier.dstQueueFamilyIndex = device->queueFamilyIndices.graphics;
+	}
+
+	// Release: the destination access mask is ignored for the releasing queue family
+	std::vector<VkBufferMemoryBarrier> releaseBarriers(barriers);
+	for (auto& barrier : releaseBarriers)
+	{
+		barrier.dstAccessMask = 0;
+	}
+	if (!releaseBarriers.empty())
+	{
+		vkCmdPipelineBarrier(batch.transferCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+			0, nullptr, static_cast<uint32_t>(releaseBarriers.size()), releaseBarriers.data(), 0, nullptr);
+	}
+	VK_CHECK_RESULT(vkEndCommandBuffer(batch.transferCmd));
+
+	VkSemaphoreCreateInfo semaphoreCreateInfo = {};
+	semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	VK_CHECK_RESULT(vkCreateSemaphore(device->logicalDevice, &semaphoreCreateInfo, nullptr, &batch.semaphore));
+
+	submitInfo.pCommandBuffers = &batch.transferCmd;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &batch.semaphore;
+	VK_CHECK_RESULT(vkQueueSubmit(transferQueue, 1, &submitInfo, VK_NULL_HANDLE));
+
+	// Acquire: a matching barrier on the graphics queue family, the source access mask is ignored there
+	VkCommandBufferAllocateInfo cmdBufAllocateInfo = {};
+	cmdBufAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	cmdBufAllocateInfo.commandPool = graphicsPool;
+	cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	cmdBufAllocateInfo.commandBufferCount = 1;
+	VK_CHECK_RESULT(vkAllocateCommandBuffers(device->logicalDevice, &cmdBufAllocateInfo, &batch.graphicsCmd));
+
+	VkCommandBufferBeginInfo cmdBufInfo = {};
+	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	VK_CHECK_RESULT(vkBeginCommandBuffer(batch.graphicsCmd, &cmdBufInfo));
+	for (auto& barrier : barriers)
+	{
+		barrier.srcAccessMask = 0;
+	}
+	if (!barriers.empty())
+	{
+		vkCmdPipelineBarrier(batch.graphicsCmd, dstStageMask, dstStageMask, 0,
+			0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+	}
+	VK_CHECK_RESULT(vkEndCommandBuffer(batch.graphicsCmd));
+
+	// The semaphore wait chains with the acquire barrier through the stages reading the buffers
+	VkSubmitInfo acquireInfo = {};
+	acquireInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	acquireInfo.waitSemaphoreCount = 1;
+	acquireInfo.pWaitSemaphores = &batch.semaphore;
+	acquireInfo.pWaitDstStageMask = &dstStageMask;
+	acquireInfo.commandBufferCount = 1;
+	acquireInfo.pCommandBuffers = &batch.graphicsCmd;
+	VK_CHECK_RESULT(vkQueueSubmit(graphicsQueue, 1, &acquireInfo, batch.fence));
+	batches.push_back(batch);
+}
+
+/**
+* Free all upload resources, waits for outstanding batches
+*/
+void vulkan_upload::cleanup()
+{
+	if (device == nullptr)
+	{
+		return;
+	}
+	flush();
+	collect(true);
+	if (stagingMemory != VK_NULL_HANDLE)
+	{
+		vkUnmapMemory(device->logicalDevice, stagingMemory);
+		vkDestroyBuffer(device->logicalDevice, stagingBuffer, nullptr);
+		vkFreeMemory(device->logicalDevice, stagingMemory, nullptr);
+	}
+	vkDestroyCommandPool(device->logicalDevice, transferPool, nullptr);
+	if (graphicsPool != VK_NULL_HANDLE)
+	{
+		vkDestroyCommandPool(device->logicalDevice, graphicsPool, nullptr);
+	}
+	stagingMemory = VK_NULL_HANDLE;
+	stagingBuffer = VK_NULL_HANDLE;
+	stagingMapped = nullptr;
+	device = nullptr;
+}
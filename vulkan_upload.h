@@ -0,0 +1,63 @@
+/*
+* Class uploading buffer data to device local memory
+*
+* Data is copied into a persistently mapped staging ring and from there into the destination buffers on the
+* transfer queue family, ownership of the buffers is then handed over to the graphics queue family
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include <vulkan/vulkan.h>
+
+#include "vulkan_device.h"
+
+class vulkan_upload
+{
+private:
+	// Buffer written by the current batch, released to the graphics queue family on flush()
+	struct PendingBuffer {
+		VkBuffer buffer;
+		VkAccessFlags dstAccessMask;
+		VkPipelineStageFlags dstStageMask;
+	};
+	// Submitted batch, its command buffers and staging range are reusable once the fence has signaled
+	struct Batch {
+		VkCommandBuffer transferCmd;
+		VkCommandBuffer graphicsCmd;
+		VkSemaphore semaphore;
+		VkFence fence;
+	};
+
+	vulkan_device *device = nullptr;
+	VkQueue transferQueue = VK_NULL_HANDLE;
+	VkQueue graphicsQueue = VK_NULL_HANDLE;
+	VkCommandPool transferPool = VK_NULL_HANDLE;
+	VkCommandPool graphicsPool = VK_NULL_HANDLE;
+
+	// Staging memory is handed out front to back and only wrapped once every batch reading it has completed
+	VkBuffer stagingBuffer = VK_NULL_HANDLE;
+	VkDeviceMemory stagingMemory = VK_NULL_HANDLE;
+	uint8_t *stagingMapped = nullptr;
+	VkDeviceSize stagingSize = 0;
+	VkDeviceSize stagingHead = 0;
+
+	VkCommandBuffer transferCmd = VK_NULL_HANDLE;
+	std::vector<PendingBuffer> pending;
+	std::vector<Batch> batches;
+
+	void begin();
+	void collect(bool wait);
+public:
+	// Copies run on a queue family other than graphics and need a queue family ownership transfer
+	bool ownershipTransfer = false;
+	// Device local memory is also host visible (integrated GPUs), buffers are written directly without staging
+	bool unifiedMemory = false;
+
+	void create(vulkan_device *device, VkQueue transferQueue, VkQueue graphicsQueue, VkDeviceSize stagingSize);
+	void createBuffer(VkBufferUsageFlags usage, const void *data, VkDeviceSize size, VkBuffer *buffer, VkDeviceMemory *memory);
+	void flush();
+	void cleanup();
+};
@@ -44,10 +44,13 @@ public:
     } indices;
 
     // Uniform buffer block object
+    // One persistently mapped buffer holding a slice per frame in flight, selected with a dynamic offset
     struct {
         VkDeviceMemory memory;
         VkBuffer buffer;
         VkDescriptorBufferInfo descriptor;
+        VkDeviceSize sliceSize; // Size of the uniform block rounded up to minUniformBufferOffsetAlignment
+        void *mapped;
     }  uniformBufferVS;
 
     struct {
@@ -64,10 +67,8 @@ public:
 
     VkDescriptorSet descriptorSet;
 
-    VkSemaphore presentCompleteSemaphore;
-    VkSemaphore renderCompleteSemaphore;
-
-    std::vector<VkFence> queueCompleteFences;
+    // Model rotation in degrees, dragged with the left mouse button
+    glm::vec2 rotation = glm::vec2(0.0f);
 
     VulkanExample() : VulkanBase() {
         title = "Vulkan Example - Basic indexed triangle";
@@ -92,16 +93,9 @@ public:
         vkDestroyBuffer(device, indices.buffer, nullptr);
         vkFreeMemory(device, indices.memory, nullptr);
 
+        vkUnmapMemory(device, uniformBufferVS.memory);
         vkDestroyBuffer(device, uniformBufferVS.buffer, nullptr);
         vkFreeMemory(device, uniformBufferVS.memory, nullptr);
-
-        vkDestroySemaphore(device, presentCompleteSemaphore, nullptr);
-        vkDestroySemaphore(device, renderCompleteSemaphore, nullptr);
-
-        for (auto& fence : queueCompleteFences)
-        {
-            vkDestroyFence(device, fence, nullptr);
-        }
     }
 
     uint32_t getMemoryTypeIndex(uint32_t typeBits, VkMemoryPropertyFlags properties)
@@ -122,32 +116,6 @@ public:
         throw "Could not find a suitable memory type!";
     }
 
-    // Create the Vulkan synchronization primitives used in this example
-    void prepareSynchronizationPrimitives()
-    {
-        // Semaphores (Used for correct command ordering)
-        VkSemaphoreCreateInfo semaphoreCreateInfo = {};
-        semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-        semaphoreCreateInfo.pNext = nullptr;
-
-        // Semaphore used to ensure that image presentation is complete before starting to submit again
-        VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &presentCompleteSemaphore));
-
-        // Semaphore used to ensure that all commands submitted have been finished before submitting the image to the queue
-        VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCreateInfo, nullptr, &renderCompleteSemaphore));
-
-        // Fences (Used to check draw command buffer completion)
-        VkFenceCreateInfo fenceCreateInfo = {};
-        fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        // Create in signaled state so we don't wait on first render of each command buffer
-        fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-        queueCompleteFences.resize(drawCmdBuffers.size());
-        for (auto& fence : queueCompleteFences)
-        {
-            VK_CHECK_RESULT(vkCreateFence(device, &fenceCreateInfo, nullptr, &fence));
-        }
-    }
-
     static VkCommandBufferBeginInfo commandBufferBeginInfo()
     {
         VkCommandBufferBeginInfo cmdBufferBeginInfo {};
@@ -207,14 +175,15 @@ public:
         vkFreeCommandBuffers(device, cmdPool, 1, &commandBuffer);
     }
 
-    // Build separate command buffers for every framebuffer image
-    // Unlike in OpenGL all rendering commands are recorded once into command buffers that are then resubmitted to the queue
-    // This allows to generate work upfront and from multiple threads, one of the biggest advantages of Vulkan
-    void buildCommandBuffers()
+    // Record the frame's command buffer for the acquired framebuffer image
+    // The previous recording is only reset once the frame's fence has signaled (see VulkanBase::prepareFrame),
+    // so this overlaps with the GPU still executing the other frames in flight
+    void buildCommandBuffer(VkCommandBuffer cmdBuffer, uint32_t imageIndex)
     {
         VkCommandBufferBeginInfo cmdBufInfo = {};
         cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
         cmdBufInfo.pNext = nullptr;
+        cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
         // Set clear values for all framebuffer attachments with loadOp set to clear
         // We use two attachments (color and depth) that are cleared at the start of the subpass and as such we need to set clear values for both
@@ -232,96 +201,80 @@ public:
         renderPassBeginInfo.renderArea.extent.height = height;
         renderPassBeginInfo.clearValueCount = 2;
         renderPassBeginInfo.pClearValues = clearValues;
+        // Set target frame buffer
+        renderPassBeginInfo.framebuffer = frameBuffers[imageIndex];
 
-        for (int32_t i = 0; i < drawCmdBuffers.size(); ++i)
-        {
-            // Set target frame buffer
-            renderPassBeginInfo.framebuffer = frameBuffers[i];
-
-            VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[i], &cmdBufInfo));
+        // Beginning implicitly resets the buffer, the pool is created with VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
+        VK_CHECK_RESULT(vkBeginCommandBuffer(cmdBuffer, &cmdBufInfo));
 
-            // Start the first sub pass specified in our default render pass setup by the base class
-            // This will clear the color and depth attachment
-            vkCmdBeginRenderPass(drawCmdBuffers[i], &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+        // Start the first sub pass specified in our default render pass setup by the base class
+        // This will clear the color and depth attachment
+        vkCmdBeginRenderPass(cmdBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-            // Update dynamic viewport state
-            VkViewport viewport = {};
-            viewport.height = (float)height;
-            viewport.width = (float)width;
-            viewport.minDepth = (float) 0.0f;
-            viewport.maxDepth = (float) 1.0f;
-            vkCmdSetViewport(drawCmdBuffers[i], 0, 1, &viewport);
+        // Update dynamic viewport state
+        VkViewport viewport = {};
+        viewport.height = (float)height;
+        viewport.width = (float)width;
+        viewport.minDepth = (float) 0.0f;
+        viewport.maxDepth = (float) 1.0f;
+        vkCmdSetViewport(cmdBuffer, 0, 1, &viewport);
 
-            // Update dynamic scissor state
-            VkRect2D scissor = {};
-            scissor.extent.width = width;
-            scissor.extent.height = height;
-            scissor.offset.x = 0;
-            scissor.offset.y = 0;
-            vkCmdSetScissor(drawCmdBuffers[i], 0, 1, &scissor);
+        // Update dynamic scissor state
+        VkRect2D scissor = {};
+        scissor.extent.width = width;
+        scissor.extent.height = height;
+        scissor.offset.x = 0;
+        scissor.offset.y = 0;
+        vkCmdSetScissor(cmdBuffer, 0, 1, &scissor);
 
-            // Bind descriptor sets describing shader binding points
-            vkCmdBindDescriptorSets(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+        // Bind descriptor sets describing shader binding points
+        // The dynamic offset selects this frame's slice of the uniform buffer
+        uint32_t dynamicOffset = currentFrame * static_cast<uint32_t>(uniformBufferVS.sliceSize);
+        vkCmdBindDescriptorSets(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, 1, &dynamicOffset);
 
-            // Bind the rendering pipeline
-            // The pipeline (state object) contains all states of the rendering pipeline, binding it will set all the states specified at pipeline creation time
-            vkCmdBindPipeline(drawCmdBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+        // Bind the rendering pipeline
+        // The pipeline (state object) contains all states of the rendering pipeline, binding it will set all the states specified at pipeline creation time
+        vkCmdBindPipeline(cmdBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 
-            // Bind triangle vertex buffer (contains position and colors)
-            VkDeviceSize offsets[1] = { 0 };
-            vkCmdBindVertexBuffers(drawCmdBuffers[i], 0, 1, &vertices.buffer, offsets);
+        // Bind triangle vertex buffer (contains position and colors)
+        VkDeviceSize offsets[1] = { 0 };
+        vkCmdBindVertexBuffers(cmdBuffer, 0, 1, &vertices.buffer, offsets);
 
-            // Bind triangle index buffer
-            vkCmdBindIndexBuffer(drawCmdBuffers[i], indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+        // Bind triangle index buffer
+        vkCmdBindIndexBuffer(cmdBuffer, indices.buffer, 0, VK_INDEX_TYPE_UINT32);
 
-            // Draw indexed triangle
-            vkCmdDrawIndexed(drawCmdBuffers[i], indices.count, 1, 0, 0, 1);
+        // Draw indexed triangle
+        vkCmdDrawIndexed(cmdBuffer, indices.count, 1, 0, 0, 1);
 
-            vkCmdEndRenderPass(drawCmdBuffers[i]);
+        vkCmdEndRenderPass(cmdBuffer);
 
-            // Ending the render pass will add an implicit barrier transitioning the frame buffer color attachment to
-            // VK_IMAGE_LAYOUT_PRESENT_SRC_KHR for presenting it to the windowing system
+        // Ending the render pass will add an implicit barrier transitioning the frame buffer color attachment to
+        // VK_IMAGE_LAYOUT_PRESENT_SRC_KHR for presenting it to the windowing system
 
-            VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[i]));
-        }
+        VK_CHECK_RESULT(vkEndCommandBuffer(cmdBuffer));
     }
 
     void draw()
     {
-        // SRS - on other platforms use original bare code with local semaphores/fences for illustrative purposes
-        // Get next image in the swap chain (back/front buffer)
-        VkResult acquire = swapChain.acquireNextImage(presentCompleteSemaphore, &currentBuffer);
+        // Wait for the frame that last used this slot and get the next image in the swap chain (back/front buffer)
+        VkResult acquire = prepareFrame();
+        if (acquire == VK_ERROR_OUT_OF_DATE_KHR) {
+            // The swap chain has been recreated, nothing was acquired for this frame
+            return;
+        }
         if (!((acquire == VK_SUCCESS) || (acquire == VK_SUBOPTIMAL_KHR))) {
             VK_CHECK_RESULT(acquire);
+            return;
         }
 
-        // Use a fence to wait until the command buffer has finished execution before using it again
-        VK_CHECK_RESULT(vkWaitForFences(device, 1, &queueCompleteFences[currentBuffer], VK_TRUE, UINT64_MAX));
-        VK_CHECK_RESULT(vkResetFences(device, 1, &queueCompleteFences[currentBuffer]));
+        updateUniformBuffers();
+        buildCommandBuffer(frames[currentFrame].cmdBuffer, currentBuffer);
 
-        // Pipeline stage at which the queue submission will wait (via pWaitSemaphores)
-        VkPipelineStageFlags waitStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        // The submit info structure specifies a command buffer queue submission batch
-        VkSubmitInfo submitInfo = {};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.pWaitDstStageMask = &waitStageMask;               // Pointer to the list of pipeline stages that the semaphore waits will occur at
-        submitInfo.waitSemaphoreCount = 1;                           // One wait semaphore
-        submitInfo.signalSemaphoreCount = 1;                         // One signal semaphore
-        submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer]; // Command buffers(s) to execute in this batch (submission)
-        submitInfo.commandBufferCount = 1;                           // One command buffer
-
-        // SRS - on other platforms use original bare code with local semaphores/fences for illustrative purposes
-        submitInfo.pWaitSemaphores = &presentCompleteSemaphore;      // Semaphore(s) to wait upon before the submitted command buffer starts executing
-        submitInfo.pSignalSemaphores = &renderCompleteSemaphore;     // Semaphore(s) to be signaled when command buffers have completed
-
-        // Submit to the graphics queue passing a wait fence
-        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, queueCompleteFences[currentBuffer]));
-
-        // Present the current buffer to the swap chain
-        // Pass the semaphore signaled by the command buffer submission from the submit info as the wait semaphore for swap chain presentation
-        // This ensures that the image is not presented to the windowing system until all commands have been submitted
-        VkResult present = swapChain.queuePresent(queue, currentBuffer, renderCompleteSemaphore);
-        if (!((present == VK_SUCCESS) || (present == VK_SUBOPTIMAL_KHR))) {
+        // Submit waiting on the frame's acquire semaphore and present once its render semaphore is signaled
+        // The frame's fence is signaled when the GPU is done, which is what prepareFrame waits on framesInFlight frames later
+        // An out of date or suboptimal swap chain is recreated before the next frame
+        VkResult present = submitFrame();
+        if (!((present == VK_SUCCESS) || (present == VK_SUBOPTIMAL_KHR) || (present == VK_ERROR_OUT_OF_DATE_KHR))) {
             VK_CHECK_RESULT(present);
         }
     }
@@ -342,54 +295,22 @@ public:
         indices.count = static_cast<uint32_t>(indexBuffer.size());
         uint32_t indexBufferSize = indices.count * sizeof(uint32_t);
 
-        VkMemoryAllocateInfo memAlloc = {};
-        memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        VkMemoryRequirements memReqs;
-
-        void *data;
-
-        // Vertex buffer
-        VkBufferCreateInfo vertexBufferInfo = {};
-        vertexBufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        vertexBufferInfo.size = vertexBufferSize;
-        vertexBufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+        // Copy vertex and index data into device local buffers through the staging ring of the base class
+        // With a dedicated transfer queue family the copies run there and ownership is handed over to the graphics queue,
+        // devices with unified memory get host visible device local buffers written directly instead
+        upload.createBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer.data(), vertexBufferSize, &vertices.buffer, &vertices.memory);
+        upload.createBuffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer.data(), indexBufferSize, &indices.buffer, &indices.memory);
 
-        // Copy vertex data to a buffer visible to the host
-        VK_CHECK_RESULT(vkCreateBuffer(device, &vertexBufferInfo, nullptr, &vertices.buffer));
-        vkGetBufferMemoryRequirements(device, vertices.buffer, &memReqs);
-        memAlloc.allocationSize = memReqs.size;
-        // VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT is host visible memory, and VK_MEMORY_PROPERTY_HOST_COHERENT_BIT makes sure writes are directly visible
-        memAlloc.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-        VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &vertices.memory));
-        VK_CHECK_RESULT(vkMapMemory(device, vertices.memory, 0, memAlloc.allocationSize, 0, &data));
-        memcpy(data, vertexBuffer.data(), vertexBufferSize);
-        vkUnmapMemory(device, vertices.memory);
-        VK_CHECK_RESULT(vkBindBufferMemory(device, vertices.buffer, vertices.memory, 0));
-
-        // Index buffer
-        VkBufferCreateInfo indexbufferInfo = {};
-        indexbufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        indexbufferInfo.size = indexBufferSize;
-        indexbufferInfo.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
-
-        // Copy index data to a buffer visible to the host
-        VK_CHECK_RESULT(vkCreateBuffer(device, &indexbufferInfo, nullptr, &indices.buffer));
-        vkGetBufferMemoryRequirements(device, indices.buffer, &memReqs);
-        memAlloc.allocationSize = memReqs.size;
-        memAlloc.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-        VK_CHECK_RESULT(vkAllocateMemory(device, &memAlloc, nullptr, &indices.memory));
-        VK_CHECK_RESULT(vkMapMemory(device, indices.memory, 0, indexBufferSize, 0, &data));
-        memcpy(data, indexBuffer.data(), indexBufferSize);
-        vkUnmapMemory(device, indices.memory);
-        VK_CHECK_RESULT(vkBindBufferMemory(device, indices.buffer, indices.memory, 0));
+        // Submit without waiting, draws submitted to the graphics queue later on are ordered after the upload
+        upload.flush();
     }
 
     void setupDescriptorPool()
     {
         // We need to tell the API the number of max. requested descriptors per type
         VkDescriptorPoolSize typeCounts[1];
-        // This example only uses one descriptor type (uniform buffer) and only requests one descriptor of this type
-        typeCounts[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        // This example only uses one descriptor type (dynamic uniform buffer) and only requests one descriptor of this type
+        typeCounts[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         typeCounts[0].descriptorCount = 1;
         // For additional types you need to add new entries in the type count list
         // E.g. for two combined image samplers :
@@ -415,9 +336,9 @@ public:
         // Basically connects the different shader stages to descriptors for binding uniform buffers, image samplers, etc.
         // So every shader binding should map to one descriptor set layout binding
 
-        // Binding 0: Uniform buffer (Vertex shader)
+        // Binding 0: Uniform buffer (Vertex shader), offset into the frame's slice at bind time
         VkDescriptorSetLayoutBinding layoutBinding = {};
-        layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        layoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         layoutBinding.descriptorCount = 1;
         layoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
         layoutBinding.pImmutableSamplers = nullptr;
@@ -462,7 +383,7 @@ public:
         writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         writeDescriptorSet.dstSet = descriptorSet;
         writeDescriptorSet.descriptorCount = 1;
-        writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
         writeDescriptorSet.pBufferInfo = &uniformBufferVS.descriptor;
         // Binds this uniform buffer to binding point 0
         writeDescriptorSet.dstBinding = 0;
@@ -861,8 +782,17 @@ public:
         allocInfo.allocationSize = 0;
         allocInfo.memoryTypeIndex = 0;
 
+        // Each frame in flight gets its own slice so updating it never races with the GPU reading another frame's
+        // Dynamic offsets have to be a multiple of minUniformBufferOffsetAlignment (always a power of two)
+        VkDeviceSize alignment = deviceProperties.limits.minUniformBufferOffsetAlignment;
+        uniformBufferVS.sliceSize = sizeof(uboVS);
+        if (alignment > 0)
+        {
+            uniformBufferVS.sliceSize = (uniformBufferVS.sliceSize + alignment - 1) & ~(alignment - 1);
+        }
+
         bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = sizeof(uboVS);
+        bufferInfo.size = uniformBufferVS.sliceSize * frames.size();
         // This buffer will be used as a uniform buffer
         bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
 
@@ -874,19 +804,19 @@ public:
         // Get the memory type index that supports host visible memory access
         // Most implementations offer multiple memory types and selecting the correct one to allocate memory from is crucial
         // We also want the buffer to be host coherent so we don't have to flush (or sync after every update.
-        // Note: This may affect performance so you might not want to do this in a real world application that updates buffers on a regular base
         allocInfo.memoryTypeIndex = getMemoryTypeIndex(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
         // Allocate memory for the uniform buffer
         VK_CHECK_RESULT(vkAllocateMemory(device, &allocInfo, nullptr, &(uniformBufferVS.memory)));
         // Bind memory to buffer
         VK_CHECK_RESULT(vkBindBufferMemory(device, uniformBufferVS.buffer, uniformBufferVS.memory, 0));
+        // Map the whole buffer once and keep it mapped for the lifetime of the example
+        VK_CHECK_RESULT(vkMapMemory(device, uniformBufferVS.memory, 0, VK_WHOLE_SIZE, 0, &uniformBufferVS.mapped));
 
         // Store information in the uniform's descriptor that is used by the descriptor set
+        // The range covers a single slice, the dynamic offset passed at bind time picks which one
         uniformBufferVS.descriptor.buffer = uniformBufferVS.buffer;
         uniformBufferVS.descriptor.offset = 0;
         uniformBufferVS.descriptor.range = sizeof(uboVS);
-
-        updateUniformBuffers();
     }
 
     void updateUniformBuffers()
@@ -894,28 +824,30 @@ public:
         // Pass matrices to the shaders
         uboVS.projectionMatrix = perspective;
         uboVS.viewMatrix = view;
-        uboVS.modelMatrix = glm::mat4(1.0f);
+        uboVS.modelMatrix = glm::rotate(glm::mat4(1.0f), glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+        uboVS.modelMatrix = glm::rotate(uboVS.modelMatrix, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
 
-        // Map uniform buffer and update it
-        uint8_t *pData;
-        VK_CHECK_RESULT(vkMapMemory(device, uniformBufferVS.memory, 0, sizeof(uboVS), 0, (void **)&pData));
-        memcpy(pData, &uboVS, sizeof(uboVS));
-        // Unmap after data has been copied
+        // Copy into the current frame's slice, prepareFrame has waited for the frame that last read it
         // Note: Since we requested a host coherent memory type for the uniform buffer, the write is instantly visible to the GPU
-        vkUnmapMemory(device, uniformBufferVS.memory);
+        memcpy((uint8_t *)uniformBufferVS.mapped + currentFrame * uniformBufferVS.sliceSize, &uboVS, sizeof(uboVS));
+    }
+
+    // Keep the projection's aspect ratio in sync with the new swap chain size
+    // Note: Override of virtual function in the base class and called from within VulkanBase::windowResize
+    void windowResized()
+    {
+        perspective = glm::perspective(glm::radians(60.0f), (float)width / (float)height, 1.0f, 256.0f);
     }
 
     void prepare()
     {
         VulkanBase::prepare();
-        prepareSynchronizationPrimitives();
         prepareVertices();
         prepareUniformBuffers();
         setupDescriptorSetLayout();
         preparePipelines();
         setupDescriptorPool();
         setupDescriptorSet();
-        buildCommandBuffers();
         prepared = true;
     }
 
@@ -923,6 +855,11 @@ public:
     {
         if (!prepared)
             return;
+        if (mouseButtons.left && (mouseDelta.x != 0.0f || mouseDelta.y != 0.0f))
+        {
+            rotation += glm::vec2(mouseDelta.y, mouseDelta.x) * 0.25f;
+        }
+        mouseDelta = glm::vec2(0.0f);
         draw();
     }
 };
@@ -930,9 +867,63 @@ public:
 VulkanExample *vulkanExample;
 
 
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [--frames-in-flight 1-%d] [--present-mode fifo|fifo-relaxed|mailbox|immediate]\n"
+			"       [--images N] [--stats]\n", prog, MAX_FRAMES_IN_FLIGHT);
+	exit(1);
+}
+
 int main(const int argc, const char *argv[])
 {
+	static const VkPresentModeKHR presentModes[] = {
+		VK_PRESENT_MODE_FIFO_KHR,
+		VK_PRESENT_MODE_FIFO_RELAXED_KHR,
+		VK_PRESENT_MODE_MAILBOX_KHR,
+		VK_PRESENT_MODE_IMMEDIATE_KHR,
+	};
+	uint32_t framesInFlight = 2;
+	VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
+	uint32_t images = 0;
+	bool stats = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 1 || n > MAX_FRAMES_IN_FLIGHT)
+				usage(argv[0]);
+			framesInFlight = n;
+			continue;
+		}
+		if (strcmp(argv[i], "--present-mode") == 0 && i + 1 < argc) {
+			const char *name = argv[++i];
+			size_t m = 0;
+			while (m < sizeof(presentModes) / sizeof(presentModes[0])
+					&& strcmp(name, vulkan_swap_chain::presentModeName(presentModes[m])) != 0)
+				m++;
+			if (m == sizeof(presentModes) / sizeof(presentModes[0]))
+				usage(argv[0]);
+			presentMode = presentModes[m];
+			continue;
+		}
+		if (strcmp(argv[i], "--images") == 0 && i + 1 < argc) {
+			int n = atoi(argv[++i]);
+			if (n < 1)
+				usage(argv[0]);
+			images = n;
+			continue;
+		}
+		if (strcmp(argv[i], "--stats") == 0) {
+			stats = true;
+			continue;
+		}
+		usage(argv[0]);
+	}
+
 	vulkanExample = new VulkanExample();
+	vulkanExample->framesInFlight = framesInFlight;
+	vulkanExample->presentMode = presentMode;
+	vulkanExample->swapChainImages = images;
+	vulkanExample->frameStats = stats;
 	vulkanExample->initVulkan();
 	vulkanExample->setupWindow();
 	vulkanExample->prepare();
@@ -0,0 +1,151 @@
+#include <cstdlib>
+#include "widget_layer.h"
+
+struct widget_layer *widget_layer_create(int32_t width, int32_t height) {
+    struct widget_layer *layer =
+            static_cast<struct widget_layer *>(calloc(1, sizeof(*layer)));
+    if (!layer)
+        return NULL;
+    layer->width = width;
+    layer->height = height;
+    layer->columns = (width + WIDGET_CELL_SIZE - 1) / WIDGET_CELL_SIZE;
+    layer->rows = (height + WIDGET_CELL_SIZE - 1) / WIDGET_CELL_SIZE;
+    layer->cells = static_cast<struct widget_cell *>(
+            calloc(layer->columns * layer->rows, sizeof(*layer->cells)));
+    if (!layer->cells) {
+        free(layer);
+        return NULL;
+    }
+    layer->hovered = WIDGET_NONE;
+    layer->pressed = WIDGET_NONE;
+    return layer;
+}
+
+void widget_layer_destroy(struct widget_layer *layer) {
+    for (uint32_t i = 0; i < layer->columns * layer->rows; ++i)
+        free(layer->cells[i].items);
+    free(layer->cells);
+    free(layer->widgets);
+    free(layer);
+}
+
+/* True if widget `a` is drawn above widget `b` */
+static bool widget_above(const struct widget_layer *layer, uint32_t a, uint32_t b) {
+    if (layer->widgets[a].z != layer->widgets[b].z)
+        return layer->widgets[a].z > layer->widgets[b].z;
+    return a > b;
+}
+
+static bool cell_insert(const struct widget_layer *layer, struct widget_cell *cell,
+                        uint32_t index) {
+    if (cell->count == cell->capacity) {
+        uint32_t capacity = cell->capacity ? cell->capacity * 2 : 4;
+        uint32_t *items = static_cast<uint32_t *>(
+                realloc(cell->items, capacity * sizeof(*items)));
+        if (!items)
+            return false;
+        cell->items = items;
+        cell->capacity = capacity;
+    }
+    /* Keep the cell sorted topmost first */
+    uint32_t i = cell->count;
+    while (i > 0 && widget_above(layer, index, cell->items[i - 1])) {
+        cell->items[i] = cell->items[i - 1];
+        --i;
+    }
+    cell->items[i] = index;
+    cell->count++;
+    return true;
+}
+
+uint32_t widget_layer_add(struct widget_layer *layer, const struct widget *widget) {
+    if (layer->count == layer->capacity) {
+        uint32_t capacity = layer->capacity ? layer->capacity * 2 : 64;
+        struct widget *widgets = static_cast<struct widget *>(
+                realloc(layer->widgets, capacity * sizeof(*widgets)));
+        if (!widgets)
+            return WIDGET_NONE;
+        layer->widgets = widgets;
+        layer->capacity = capacity;
+    }
+    uint32_t index = layer->count++;
+    layer->widgets[index] = *widget;
+
+    /* Clip to the surface, widgets outside of it can never be hit */
+    int32_t x0 = widget->x < 0 ? 0 : widget->x;
+    int32_t y0 = widget->y < 0 ? 0 : widget->y;
+    int32_t x1 = widget->x + widget->width;
+    int32_t y1 = widget->y + widget->height;
+    if (x1 > layer->width)
+        x1 = layer->width;
+    if (y1 > layer->height)
+        y1 = layer->height;
+    if (x0 >= x1 || y0 >= y1)
+        return index;
+
+    for (int32_t row = y0 / WIDGET_CELL_SIZE; row <= (y1 - 1) / WIDGET_CELL_SIZE; ++row) {
+        for (int32_t column = x0 / WIDGET_CELL_SIZE; column <= (x1 - 1) / WIDGET_CELL_SIZE; ++column) {
+            if (!cell_insert(layer, &layer->cells[row * layer->columns + column], index))
+                return WIDGET_NONE;
+        }
+    }
+    return index;
+}
+
+uint32_t widget_layer_hit(const struct widget_layer *layer, double x, double y) {
+    if (x < 0 || y < 0 || x >= layer->width || y >= layer->height)
+        return WIDGET_NONE;
+    const struct widget_cell *cell = &layer->cells[(int32_t) y / WIDGET_CELL_SIZE * layer->columns
+                                                   + (int32_t) x / WIDGET_CELL_SIZE];
+    for (uint32_t i = 0; i < cell->count; ++i) {
+        const struct widget *widget = &layer->widgets[cell->items[i]];
+        if (x >= widget->x && x < widget->x + widget->width
+                && y >= widget->y && y < widget->y + widget->height)
+            return cell->items[i];
+    }
+    return WIDGET_NONE;
+}
+
+static void update_invalidate(struct widget_update *update, uint32_t index) {
+    if (index == WIDGET_NONE
+            || update->count == sizeof(update->invalidated) / sizeof(update->invalidated[0]))
+        return;
+    for (uint32_t i = 0; i < update->count; ++i) {
+        if (update->invalidated[i] == index)
+            return;
+    }
+    update->invalidated[update->count++] = index;
+}
+
+static void layer_hover(struct widget_layer *layer, uint32_t hovered,
+                        struct widget_update *update) {
+    if (hovered == layer->hovered)
+        return;
+    update_invalidate(update, layer->hovered);
+    update_invalidate(update, hovered);
+    layer->hovered = hovered;
+}
+
+void widget_layer_motion(struct widget_layer *layer, double x, double y,
+                         struct widget_update *update) {
+    layer_hover(layer, widget_layer_hit(layer, x, y), update);
+}
+
+void widget_layer_button(struct widget_layer *layer, bool pressed,
+                         struct widget_update *update) {
+    if (pressed) {
+        update_invalidate(update, layer->pressed);
+        layer->pressed = layer->hovered;
+        update_invalidate(update, layer->pressed);
+        return;
+    }
+    /* A click is a press and a release on the same widget */
+    if (layer->pressed != WIDGET_NONE && layer->pressed == layer->hovered)
+        update->clicked = layer->pressed;
+    update_invalidate(update, layer->pressed);
+    layer->pressed = WIDGET_NONE;
+}
+
+void widget_layer_leave(struct widget_layer *layer, struct widget_update *update) {
+    layer_hover(layer, WIDGET_NONE, update);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Retained widget layer with a spatial index
+ *
+ * Widgets are plain rectangles in surface coordinates with a z-order. The
+ * surface is divided into a uniform grid of WIDGET_CELL_SIZE cells and every
+ * cell keeps the widgets overlapping it sorted topmost first, so a hit test
+ * only looks at the handful of widgets under one cell rather than at the
+ * whole list. Hover and press state live in the layer; motion and button
+ * updates report which widgets need to be redrawn.
+ */
+
+#define WIDGET_CELL_SIZE 32
+#define WIDGET_NONE UINT32_MAX
+
+struct widget {
+    int32_t x, y;
+    int32_t width, height;
+    int32_t z;                  /* Higher is on top, ties go to the later widget */
+    uint32_t color;
+};
+
+/* Widgets whose look changed, and the widget clicked if any. Start from
+ * WIDGET_UPDATE_INIT, several calls may add to the same update. */
+struct widget_update {
+    uint32_t invalidated[4];
+    uint32_t count;
+    uint32_t clicked;
+};
+
+#define WIDGET_UPDATE_INIT {{0}, 0, WIDGET_NONE}
+
+struct widget_cell {
+    uint32_t *items;
+    uint32_t count;
+    uint32_t capacity;
+};
+
+struct widget_layer {
+    int32_t width, height;
+    uint32_t columns, rows;
+    struct widget_cell *cells;
+    struct widget *widgets;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t hovered;
+    uint32_t pressed;
+};
+
+struct widget_layer *widget_layer_create(int32_t width, int32_t height);
+void widget_layer_destroy(struct widget_layer *layer);
+/* Returns the new widget's index, or WIDGET_NONE on allocation failure */
+uint32_t widget_layer_add(struct widget_layer *layer, const struct widget *widget);
+/* Topmost widget under the point, or WIDGET_NONE */
+uint32_t widget_layer_hit(const struct widget_layer *layer, double x, double y);
+void widget_layer_motion(struct widget_layer *layer, double x, double y,
+                         struct widget_update *update);
+void widget_layer_button(struct widget_layer *layer, bool pressed,
+                         struct widget_update *update);
+void widget_layer_leave(struct widget_layer *layer, struct widget_update *update);